@@ -0,0 +1,465 @@
+#pragma once
+
+#include "job_system.h"
+#include "lz4_block.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+
+A packed asset archive: one file that holds every asset in the form the renderer uploads it in (decoded
+RGBA pixels rather than JPEGs, vertex and index arrays rather than an OBJ), so loading it involves neither
+opening a file per asset nor parsing or decoding any file format. The layout is
+
+	header | chunk payloads | entry table | chunk table
+
+Every entry is split into chunks of the same size (64 KiB to 1 MiB, the last one may be smaller), and each
+chunk is compressed on its own with LZ4, or stored as is if that doesn't make it smaller. Since no chunk
+depends on any other, all chunks of all entries can be decompressed at the same time, each one straight
+into its place in the destination. Payloads start at page boundaries in the file, and the reader places
+entries at offsets aligned for staging buffers, so a stored chunk is a single copy from the mapped archive.
+
+Packing (see BasicApp::packAssets):
+
+	assets::ArchiveWriter writer;
+	writer.add("textures/chalet.jpg", assets::EntryType::Texture, pixels, width * height * 4, { width, height, VK_FORMAT_R8G8B8A8_UNORM });
+	writer.write("assets.vba", &jobSystem);
+
+Loading:
+
+	assets::ArchiveReader archive("assets.vba");
+	const assets::Entry* entry = archive.find("textures/chalet.jpg");
+	archive.extract(*entry, mappedStagingMemory, &jobSystem);
+
+*/
+
+namespace assets
+{
+	enum class EntryType : uint32_t
+	{
+		Blob,
+		Texture,																	// metadata: width, height, VkFormat
+		Vertices,																	// metadata: vertex stride, then whatever the application needs
+		Indices																		// metadata: index size
+	};
+
+	enum class Codec : uint32_t
+	{
+		Stored,
+		Lz4
+	};
+
+	const uint32_t sMinChunkSize = 64 * 1024;
+	const uint32_t sMaxChunkSize = 1024 * 1024;
+	const uint32_t sDefaultChunkSize = 256 * 1024;
+	const uint32_t sPayloadAlignment = 4096;										// chunk payloads start at page boundaries in the file
+	const uint32_t sDefaultEntryAlignment = 256;									// covers optimalBufferCopyOffsetAlignment and the texel sizes of every format
+	const uint32_t sVersion = 1;
+
+	// the records as they are stored in the file (little endian, like every platform the application runs on)
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t chunkSize;
+		uint32_t entryCount;
+		uint32_t chunkCount;
+		uint32_t reserved;
+		uint64_t tableOffset;														// the entry table, directly followed by the chunk table
+	};
+
+	struct EntryRecord
+	{
+		char name[64];																// zero terminated
+		uint32_t type;
+		uint32_t firstChunk;
+		uint32_t chunkCount;
+		uint32_t alignment;
+		uint64_t size;
+		uint32_t metadata[4];
+	};
+
+	struct ChunkRecord
+	{
+		uint64_t offset;															// of the payload in the file
+		uint32_t storedSize;
+		uint32_t size;																// decompressed
+		uint32_t codec;
+		uint32_t reserved;
+	};
+
+	static_assert(sizeof(FileHeader) == 32 && sizeof(EntryRecord) == 104 && sizeof(ChunkRecord) == 24, "Archive records must not contain padding.");
+
+	using Metadata = std::array<uint32_t, 4>;
+
+	//! an asset in the archive
+	struct Entry
+	{
+		std::string name;
+		EntryType type;
+		uint64_t size;
+		uint32_t alignment;
+		Metadata metadata;
+		uint32_t firstChunk;
+		uint32_t chunkCount;
+	};
+
+	inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	class ArchiveWriter
+	{
+	public:
+		//! the chunk size is clamped to [sMinChunkSize, sMaxChunkSize]
+		explicit ArchiveWriter(uint32_t chunkSize = sDefaultChunkSize) :
+			mChunkSize(std::min(std::max(chunkSize, sMinChunkSize), sMaxChunkSize))
+		{
+		}
+
+		//! copy an asset into the archive
+		void add(const std::string& name, EntryType type, const void* data, size_t size, Metadata metadata = {}, uint32_t alignment = sDefaultEntryAlignment)
+		{
+			if (name.size() >= sizeof(EntryRecord::name))
+			{
+				throw std::runtime_error("Asset name " + name + " is too long for the archive.");
+			}
+
+			const char* bytes = static_cast<const char*>(data);
+			mEntries.push_back({ name, type, size, alignment, metadata, 0, 0 });
+			mData.emplace_back(bytes, bytes + size);
+		}
+
+		//! compress every chunk (in parallel, if a job system is given) and write the archive, returning its size in bytes
+		uint64_t write(const std::string& path, jobs::JobSystem* jobs = nullptr)
+		{
+			// split the entries into chunks
+			struct PendingChunk
+			{
+				const uint8_t* data;
+				uint32_t size;
+				Codec codec;
+				std::vector<uint8_t> stored;
+			};
+
+			std::vector<PendingChunk> chunks;
+			for (size_t i = 0; i < mEntries.size(); ++i)
+			{
+				Entry& entry = mEntries[i];
+				entry.firstChunk = static_cast<uint32_t>(chunks.size());
+
+				for (uint64_t offset = 0; offset < entry.size; offset += mChunkSize)
+				{
+					uint32_t size = static_cast<uint32_t>(std::min<uint64_t>(mChunkSize, entry.size - offset));
+					chunks.push_back({ reinterpret_cast<const uint8_t*>(mData[i].data()) + offset, size, Codec::Stored, {} });
+				}
+
+				entry.chunkCount = static_cast<uint32_t>(chunks.size()) - entry.firstChunk;
+			}
+
+			auto compressChunk = [&chunks](size_t i)
+			{
+				PendingChunk& chunk = chunks[i];
+				chunk.stored.resize(lz4::compressBound(chunk.size));
+				size_t compressed = lz4::compress(chunk.data, chunk.size, chunk.stored.data(), chunk.stored.size());
+
+				// incompressible data (i.e. already compressed) is stored as is
+				if (compressed > 0 && compressed < chunk.size)
+				{
+					chunk.stored.resize(compressed);
+					chunk.codec = Codec::Lz4;
+				}
+				else
+				{
+					chunk.stored.assign(chunk.data, chunk.data + chunk.size);
+					chunk.codec = Codec::Stored;
+				}
+			};
+
+			if (jobs)
+			{
+				jobs->parallelFor(chunks.size(), compressChunk);
+			}
+			else
+			{
+				for (size_t i = 0; i < chunks.size(); ++i)
+				{
+					compressChunk(i);
+				}
+			}
+
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				throw std::runtime_error("Failed to create archive " + path);
+			}
+
+			// the header is written again at the end, once the table offset is known
+			FileHeader header = {};
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			// the payloads, each at a page boundary
+			std::vector<ChunkRecord> chunkRecords;
+			uint64_t offset = sizeof(FileHeader);
+			for (const auto& chunk : chunks)
+			{
+				offset = pad(file, offset, sPayloadAlignment);
+				chunkRecords.push_back({ offset, static_cast<uint32_t>(chunk.stored.size()), chunk.size, static_cast<uint32_t>(chunk.codec), 0 });
+				file.write(reinterpret_cast<const char*>(chunk.stored.data()), chunk.stored.size());
+				offset += chunk.stored.size();
+			}
+
+			// the tables
+			offset = pad(file, offset, alignof(uint64_t));
+			std::memcpy(header.magic, "VBAA", 4);
+			header.version = sVersion;
+			header.chunkSize = mChunkSize;
+			header.entryCount = static_cast<uint32_t>(mEntries.size());
+			header.chunkCount = static_cast<uint32_t>(chunkRecords.size());
+			header.tableOffset = offset;
+
+			for (const auto& entry : mEntries)
+			{
+				EntryRecord record = {};
+				std::memcpy(record.name, entry.name.c_str(), entry.name.size());
+				record.type = static_cast<uint32_t>(entry.type);
+				record.firstChunk = entry.firstChunk;
+				record.chunkCount = entry.chunkCount;
+				record.alignment = entry.alignment;
+				record.size = entry.size;
+				std::copy(entry.metadata.begin(), entry.metadata.end(), record.metadata);
+				file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			}
+			file.write(reinterpret_cast<const char*>(chunkRecords.data()), chunkRecords.size() * sizeof(ChunkRecord));
+			uint64_t total = offset + mEntries.size() * sizeof(EntryRecord) + chunkRecords.size() * sizeof(ChunkRecord);
+
+			file.seekp(0);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			if (!file)
+			{
+				throw std::runtime_error("Failed to write archive " + path);
+			}
+
+			return total;
+		}
+
+	private:
+		static uint64_t pad(std::ofstream& file, uint64_t offset, uint64_t alignment)
+		{
+			static const char zeros[sPayloadAlignment] = {};
+			uint64_t aligned = alignUp(offset, alignment);
+			file.write(zeros, static_cast<std::streamsize>(aligned - offset));
+			return aligned;
+		}
+
+		uint32_t mChunkSize;
+		std::vector<Entry> mEntries;
+		std::vector<std::vector<char>> mData;
+	};
+
+	class ArchiveReader
+	{
+	public:
+		//! map the archive and read its tables, throwing if it's not a valid archive
+		explicit ArchiveReader(const std::string& path) :
+			mFile(path, io::AccessHint::WillNeed)
+		{
+			FileHeader header = {};
+			if (mFile.size() < sizeof(header))
+			{
+				throw std::runtime_error(path + " is not an asset archive.");
+			}
+
+			std::memcpy(&header, mFile.data(), sizeof(header));
+			if (std::memcmp(header.magic, "VBAA", 4) != 0 || header.version != sVersion)
+			{
+				throw std::runtime_error(path + " is not an asset archive, or one of an unsupported version.");
+			}
+
+			uint64_t tableSize = uint64_t(header.entryCount) * sizeof(EntryRecord) + uint64_t(header.chunkCount) * sizeof(ChunkRecord);
+			if (header.tableOffset > mFile.size() || tableSize > mFile.size() - header.tableOffset)
+			{
+				throw std::runtime_error("The tables of asset archive " + path + " are truncated.");
+			}
+
+			const char* table = mFile.data() + header.tableOffset;
+			mChunks.resize(header.chunkCount);
+			std::memcpy(mChunks.data(), table + header.entryCount * sizeof(EntryRecord), mChunks.size() * sizeof(ChunkRecord));
+
+			for (const auto& chunk : mChunks)
+			{
+				if (chunk.offset > mFile.size() || chunk.storedSize > mFile.size() - chunk.offset || chunk.size > sMaxChunkSize)
+				{
+					throw std::runtime_error("A chunk of asset archive " + path + " is out of bounds.");
+				}
+			}
+
+			for (uint32_t i = 0; i < header.entryCount; ++i)
+			{
+				EntryRecord record;
+				std::memcpy(&record, table + i * sizeof(EntryRecord), sizeof(record));
+				record.name[sizeof(record.name) - 1] = '\0';
+
+				uint64_t size = 0;
+				bool valid = uint64_t(record.firstChunk) + record.chunkCount <= mChunks.size() && record.alignment > 0;
+				for (uint32_t c = 0; valid && c < record.chunkCount; ++c)
+				{
+					size += mChunks[record.firstChunk + c].size;
+				}
+
+				if (!valid || size != record.size)
+				{
+					throw std::runtime_error("Entry " + std::string(record.name) + " of asset archive " + path + " is corrupt.");
+				}
+
+				Metadata metadata;
+				std::copy(record.metadata, record.metadata + 4, metadata.begin());
+				mEntries.push_back({ record.name, static_cast<EntryType>(record.type), record.size, record.alignment, metadata, record.firstChunk, record.chunkCount });
+			}
+		}
+
+		//! the entry with the given name, or nullptr
+		const Entry* find(const std::string& name) const
+		{
+			auto entry = std::find_if(mEntries.begin(), mEntries.end(), [&](const Entry& e) { return e.name == name; });
+			return entry != mEntries.end() ? &*entry : nullptr;
+		}
+
+		const std::vector<Entry>& entries() const { return mEntries; }
+
+		//! the size of the archive file, as opposed to the total size of its entries
+		uint64_t fileSize() const { return mFile.size(); }
+
+		//! place the entries one after another in a single staging allocation, returning the offset of each and the total size
+		static std::vector<uint64_t> layout(const std::vector<const Entry*>& entries, uint64_t& totalSize)
+		{
+			std::vector<uint64_t> offsets;
+			totalSize = 0;
+			for (const Entry* entry : entries)
+			{
+				totalSize = alignUp(totalSize, entry->alignment);
+				offsets.push_back(totalSize);
+				totalSize += entry->size;
+			}
+			return offsets;
+		}
+
+		//! decompress an entry into destination, which must have room for entry.size bytes
+		void extract(const Entry& entry, void* destination, jobs::JobSystem* jobs = nullptr) const
+		{
+			extract({ &entry }, { 0 }, destination, jobs);
+		}
+
+		//! decompress every entry to destination plus its offset (see layout), with all of their chunks in parallel
+		void extract(const std::vector<const Entry*>& entries, const std::vector<uint64_t>& offsets, void* destination, jobs::JobSystem* jobs = nullptr) const
+		{
+			std::vector<Task> tasks;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				uint8_t* out = static_cast<uint8_t*>(destination) + offsets[i];
+				for (uint32_t c = 0; c < entries[i]->chunkCount; ++c)
+				{
+					const ChunkRecord& chunk = mChunks[entries[i]->firstChunk + c];
+					tasks.push_back({ &chunk, out, 0, chunk.size });
+					out += chunk.size;
+				}
+			}
+
+			run(tasks, jobs);
+		}
+
+		//! decompress size bytes of an entry, starting at offset, into destination: chunks that are only partly in the range are decompressed into scratch memory first
+		void extract(const Entry& entry, uint64_t offset, uint64_t size, void* destination, jobs::JobSystem* jobs = nullptr) const
+		{
+			if (offset + size > entry.size)
+			{
+				throw std::runtime_error("Extracting past the end of " + entry.name + ".");
+			}
+
+			std::vector<Task> tasks;
+			uint8_t* out = static_cast<uint8_t*>(destination);
+			uint64_t chunkStart = 0;
+			for (uint32_t c = 0; c < entry.chunkCount && chunkStart < offset + size; ++c)
+			{
+				const ChunkRecord& chunk = mChunks[entry.firstChunk + c];
+				uint64_t chunkEnd = chunkStart + chunk.size;
+				if (chunkEnd > offset)
+				{
+					uint64_t skip = offset > chunkStart ? offset - chunkStart : 0;
+					uint64_t count = std::min(chunkEnd, offset + size) - chunkStart - skip;
+					tasks.push_back({ &chunk, out, skip, count });
+					out += count;
+				}
+				chunkStart = chunkEnd;
+			}
+
+			run(tasks, jobs);
+		}
+
+	private:
+		//! the part [skip, skip + count) of a chunk, which goes to destination
+		struct Task
+		{
+			const ChunkRecord* chunk;
+			uint8_t* destination;
+			uint64_t skip;
+			uint64_t count;
+		};
+
+		void run(const std::vector<Task>& tasks, jobs::JobSystem* jobs) const
+		{
+			auto extractChunk = [this, &tasks](size_t i)
+			{
+				const Task& task = tasks[i];
+				const ChunkRecord& chunk = *task.chunk;
+				const uint8_t* stored = reinterpret_cast<const uint8_t*>(mFile.data()) + chunk.offset;
+				bool whole = task.skip == 0 && task.count == chunk.size;
+
+				if (chunk.codec == static_cast<uint32_t>(Codec::Stored) && chunk.storedSize == chunk.size)
+				{
+					std::memcpy(task.destination, stored + task.skip, static_cast<size_t>(task.count));
+					return;
+				}
+
+				// a block only decompresses as a whole, so a partial chunk goes through scratch memory
+				std::vector<uint8_t> scratch(whole ? 0 : chunk.size);
+				uint8_t* out = whole ? task.destination : scratch.data();
+				if (chunk.codec != static_cast<uint32_t>(Codec::Lz4) || !lz4::decompress(stored, chunk.storedSize, out, chunk.size))
+				{
+					throw std::runtime_error("Failed to decompress a chunk of " + mFile.path() + ".");
+				}
+
+				if (!whole)
+				{
+					std::memcpy(task.destination, scratch.data() + task.skip, static_cast<size_t>(task.count));
+				}
+			};
+
+			if (jobs && tasks.size() > 1)
+			{
+				jobs->parallelFor(tasks.size(), extractChunk);
+			}
+			else
+			{
+				for (size_t i = 0; i < tasks.size(); ++i)
+				{
+					extractChunk(i);
+				}
+			}
+		}
+
+		io::MappedFile mFile;
+		std::vector<Entry> mEntries;
+		std::vector<ChunkRecord> mChunks;
+	};
+}
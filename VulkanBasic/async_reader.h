@@ -0,0 +1,597 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+/*
+
+Reads files asynchronously: a read is queued along with the buffer it should land in, and a callback
+runs once all of its bytes have arrived. Many reads are kept in flight at the same time, so the disk
+(an SSD in particular) always has a deep queue of requests to work on, and nothing blocks until the
+caller decides to wait:
+
+	io::AsyncReader reader;
+	io::AsyncReader::FileId file = reader.open("textures/chalet.jpg");
+	std::vector<char> buffer(reader.size(file));
+	reader.read(file, 0, buffer.size(), buffer.data(), [](bool ok) { startDecoding(); });
+	...
+	reader.wait();																// runs the callbacks of finished reads
+
+On Linux, reads go through io_uring: requests are written to a submission ring that is shared with the
+kernel, and a single system call submits all of them and collects whatever has finished from the
+completion ring. Where io_uring isn't available (other platforms, older kernels, or sandboxes that
+block it), a small pool of threads performs positioned reads (pread, or ReadFile with an offset) instead.
+Either way, reads larger than sMaxPieceSize are split into pieces that are in flight at the same time.
+
+The reader is used by one thread at a time: callbacks run on the thread that calls poll or wait.
+
+*/
+
+namespace io
+{
+	const size_t sMaxPieceSize = 1024 * 1024;
+
+	enum class ReadBackend
+	{
+		IoUring,
+		ThreadPool
+	};
+
+	//! counters for reporting
+	struct AsyncReaderStats
+	{
+		uint64_t reads = 0;
+		uint64_t pieces = 0;
+		uint64_t bytes = 0;
+		uint32_t maxInFlight = 0;													// the most pieces that were in flight at once
+	};
+
+	class AsyncReader
+	{
+	public:
+		using FileId = uint32_t;
+
+		//! uses io_uring if it's allowed and available, with a queue of the given depth, and threadCount positioned read threads otherwise
+		explicit AsyncReader(bool allowIoUring = true, uint32_t queueDepth = 64, uint32_t threadCount = 4) :
+			mQueueDepth(std::max(queueDepth, 1u))
+		{
+#ifdef __linux__
+			if (allowIoUring && initIoUring())
+			{
+				mBackend = ReadBackend::IoUring;
+				return;
+			}
+#else
+			(void)allowIoUring;
+#endif
+
+			mBackend = ReadBackend::ThreadPool;
+			for (uint32_t i = 0; i < std::max(threadCount, 1u); ++i)
+			{
+				mThreads.emplace_back([this]() { readerLoop(); });
+			}
+		}
+
+		AsyncReader(const AsyncReader&) = delete;
+		AsyncReader& operator=(const AsyncReader&) = delete;
+
+		~AsyncReader()
+		{
+			// the destination buffers belong to the caller, so nothing may still be writing to them once the reader is gone
+			wait();
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStopping = true;
+			}
+			mWork.notify_all();
+			for (auto& thread : mThreads)
+			{
+				thread.join();
+			}
+
+#ifdef __linux__
+			releaseIoUring();
+#endif
+
+			for (auto& file : mFiles)
+			{
+				closeHandle(file.handle);
+			}
+		}
+
+		ReadBackend backend() const { return mBackend; }
+		const char* backendName() const { return mBackend == ReadBackend::IoUring ? "io_uring" : "thread pool"; }
+		const AsyncReaderStats& stats() const { return mStats; }
+
+		//! open a file for reading, throwing if it can't be opened
+		FileId open(const std::string& path)
+		{
+			File file;
+#ifdef _WIN32
+			file.handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			LARGE_INTEGER size = {};
+			if (file.handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(file.handle, &size))
+			{
+				throw std::runtime_error("Failed to open file " + path);
+			}
+			file.size = static_cast<uint64_t>(size.QuadPart);
+#else
+			file.handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat status = {};
+			if (file.handle < 0 || fstat(file.handle, &status) != 0)
+			{
+				throw std::runtime_error("Failed to open file " + path);
+			}
+			file.size = static_cast<uint64_t>(status.st_size);
+#endif
+			mFiles.push_back(file);
+			return static_cast<FileId>(mFiles.size() - 1);
+		}
+
+		uint64_t size(FileId file) const
+		{
+			return mFiles[file].size;
+		}
+
+		//! queue a read of size bytes at offset into destination, which must stay valid until onComplete has run (with false if the read failed)
+		void read(FileId file, uint64_t offset, size_t size, void* destination, std::function<void(bool)> onComplete = {})
+		{
+			uint64_t id = mNextRead++;
+			Read& read = mReads[id];
+			read.onComplete = std::move(onComplete);
+			mStats.reads++;
+
+			// every read has at least one piece, so even empty reads complete through poll
+			char* out = static_cast<char*>(destination);
+			size_t done = 0;
+			do
+			{
+				size_t pieceSize = std::min<size_t>(sMaxPieceSize, size - done);
+				enqueue({ id, mFiles[file].handle, offset + done, out + done, pieceSize });
+				read.pendingPieces++;
+				done += pieceSize;
+			} while (done < size);
+
+			submit();
+		}
+
+		//! run the callbacks of the reads that have completed, blocking until at least one has if wait is true; returns the number of reads that completed
+		size_t poll(bool wait = false)
+		{
+			size_t before = mCompletedReads;
+
+#ifdef __linux__
+			if (mBackend == ReadBackend::IoUring)
+			{
+				submit();
+				reap(wait && mInFlight > 0);
+				submit();
+				return mCompletedReads - before;
+			}
+#endif
+
+			std::deque<std::pair<Piece, int64_t>> completed;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				if (wait)
+				{
+					mDone.wait(lock, [this]() { return !mCompleted.empty() || mInFlight == 0; });
+				}
+				std::swap(completed, mCompleted);
+			}
+
+			for (const auto& result : completed)
+			{
+				mInFlight--;
+				complete(result.first, result.second);
+			}
+
+			return mCompletedReads - before;
+		}
+
+		//! block until every read has completed and its callback has run
+		void wait()
+		{
+			while (!mReads.empty())
+			{
+				poll(true);
+			}
+		}
+
+		//! reads that haven't completed yet
+		size_t pending() const
+		{
+			return mReads.size();
+		}
+
+	private:
+#ifdef _WIN32
+		using Handle = HANDLE;
+#else
+		using Handle = int;
+#endif
+
+		struct File
+		{
+			Handle handle;
+			uint64_t size;
+		};
+
+		struct Read
+		{
+			std::function<void(bool)> onComplete;
+			uint32_t pendingPieces = 0;
+			bool failed = false;
+		};
+
+		struct Piece
+		{
+			uint64_t read;
+			Handle file;
+			uint64_t offset;
+			char* destination;
+			size_t size;
+		};
+
+		static void closeHandle(Handle handle)
+		{
+#ifdef _WIN32
+			CloseHandle(handle);
+#else
+			::close(handle);
+#endif
+		}
+
+		void enqueue(const Piece& piece)
+		{
+			mStats.pieces++;
+			mStats.bytes += piece.size;
+
+			if (mBackend == ReadBackend::ThreadPool)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mQueued.push_back(piece);
+					mInFlight++;
+					mStats.maxInFlight = std::max(mStats.maxInFlight, mInFlight);
+				}
+				mWork.notify_one();
+			}
+			else
+			{
+				mQueued.push_back(piece);
+			}
+		}
+
+		//! a piece has finished with result bytes read, or a negative error
+		void complete(const Piece& piece, int64_t result)
+		{
+			auto found = mReads.find(piece.read);
+			Read& read = found->second;
+
+			if (result > 0 && static_cast<size_t>(result) < piece.size)
+			{
+				// a short read: queue the rest
+				Piece rest = piece;
+				rest.offset += result;
+				rest.destination += result;
+				rest.size -= static_cast<size_t>(result);
+				mStats.pieces--;
+				mStats.bytes -= rest.size;
+				enqueue(rest);
+				return;
+			}
+
+			// reading nothing is an error unless nothing was asked for (the end of the file came early)
+			if (result < 0 || (result == 0 && piece.size > 0))
+			{
+				read.failed = true;
+			}
+
+			if (--read.pendingPieces == 0)
+			{
+				std::function<void(bool)> onComplete = std::move(read.onComplete);
+				bool ok = !read.failed;
+				mReads.erase(found);
+				mCompletedReads++;
+
+				if (onComplete)
+				{
+					onComplete(ok);
+				}
+			}
+		}
+
+		void readerLoop()
+		{
+			for (;;)
+			{
+				Piece piece;
+				{
+					std::unique_lock<std::mutex> lock(mMutex);
+					mWork.wait(lock, [this]() { return mStopping || !mQueued.empty(); });
+					if (mQueued.empty())
+					{
+						return;
+					}
+					piece = mQueued.front();
+					mQueued.pop_front();
+				}
+
+				int64_t result = readAt(piece);
+
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mCompleted.push_back({ piece, result });
+				}
+				mDone.notify_one();
+			}
+		}
+
+		static int64_t readAt(const Piece& piece)
+		{
+			if (piece.size == 0)
+			{
+				return 0;
+			}
+#ifdef _WIN32
+			// a synchronous handle reads at the offset given in the OVERLAPPED structure
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(piece.offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(piece.offset >> 32);
+			DWORD bytesRead = 0;
+			if (!ReadFile(piece.file, piece.destination, static_cast<DWORD>(piece.size), &bytesRead, &overlapped))
+			{
+				return -1;
+			}
+			return bytesRead;
+#else
+			return pread(piece.file, piece.destination, piece.size, static_cast<off_t>(piece.offset));
+#endif
+		}
+
+#ifdef __linux__
+		//! set up the submission and completion rings, returning false if io_uring isn't available
+		bool initIoUring()
+		{
+			io_uring_params params = {};
+			mRing = static_cast<int>(syscall(__NR_io_uring_setup, mQueueDepth, &params));
+			if (mRing < 0)
+			{
+				return false;
+			}
+
+			mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (singleMapping)
+			{
+				mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+			}
+
+			mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_SQ_RING);
+			mCqRing = singleMapping ? mSqRing : mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_CQ_RING);
+			mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			mSqes = static_cast<io_uring_sqe*>(mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_SQES));
+
+			if (mSqRing == MAP_FAILED || mCqRing == MAP_FAILED || mSqes == MAP_FAILED)
+			{
+				releaseIoUring();
+				return false;
+			}
+
+			char* sq = static_cast<char*>(mSqRing);
+			char* cq = static_cast<char*>(mCqRing);
+			mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			mSqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+			mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			mCqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			// the depth is what the kernel actually gave us, and every in-flight piece needs a slot for its iovec
+			mQueueDepth = params.sq_entries;
+			mSlots.resize(mQueueDepth);
+			for (uint32_t i = 0; i < mQueueDepth; ++i)
+			{
+				mFreeSlots.push_back(mQueueDepth - 1 - i);
+			}
+			return true;
+		}
+
+		//! unmap whichever of the rings were mapped and close the ring, whether it was set up completely or only in part
+		void releaseIoUring()
+		{
+			auto unmap = [](void* mapping, size_t size)
+			{
+				if (mapping && mapping != MAP_FAILED)
+				{
+					munmap(mapping, size);
+				}
+			};
+
+			unmap(mSqes, mSqesSize);
+			if (mCqRing != mSqRing)
+			{
+				unmap(mCqRing, mCqRingSize);
+			}
+			unmap(mSqRing, mSqRingSize);
+			mSqes = nullptr;
+			mCqRing = nullptr;
+			mSqRing = nullptr;
+
+			if (mRing >= 0)
+			{
+				::close(mRing);
+				mRing = -1;
+			}
+		}
+
+		//! move queued pieces into free submission slots and hand them to the kernel
+		void submit()
+		{
+			if (mBackend != ReadBackend::IoUring)
+			{
+				return;
+			}
+
+			unsigned tail = *mSqTail;
+			unsigned count = 0;
+
+			while (!mQueued.empty() && !mFreeSlots.empty())
+			{
+				uint32_t slot = mFreeSlots.back();
+				mFreeSlots.pop_back();
+
+				Slot& s = mSlots[slot];
+				s.piece = mQueued.front();
+				s.vector.iov_base = s.piece.destination;
+				s.vector.iov_len = s.piece.size;
+				mQueued.pop_front();
+
+				// READV rather than READ, which needs a newer kernel
+				unsigned index = tail & mSqMask;
+				io_uring_sqe& sqe = mSqes[index];
+				std::memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = IORING_OP_READV;
+				sqe.fd = s.piece.file;
+				sqe.off = s.piece.offset;
+				sqe.addr = reinterpret_cast<uint64_t>(&s.vector);
+				sqe.len = 1;
+				sqe.user_data = slot;
+				mSqArray[index] = index;
+
+				tail++;
+				count++;
+			}
+
+			if (count == 0)
+			{
+				return;
+			}
+
+			// the kernel must see the entries before it sees the new tail
+			__atomic_store_n(mSqTail, tail, __ATOMIC_RELEASE);
+			mInFlight += count;
+			mStats.maxInFlight = std::max(mStats.maxInFlight, mInFlight);
+
+			if (syscall(__NR_io_uring_enter, mRing, count, 0, 0, nullptr, 0) < 0)
+			{
+				throw std::runtime_error("Failed to submit reads to io_uring.");
+			}
+		}
+
+		//! collect finished pieces from the completion ring, waiting for at least one if wait is true
+		void reap(bool wait)
+		{
+			if (wait && syscall(__NR_io_uring_enter, mRing, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+			{
+				throw std::runtime_error("Failed to wait for io_uring completions.");
+			}
+
+			unsigned head = *mCqHead;
+			unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+
+			std::vector<std::pair<Piece, int64_t>> completed;
+			for (; head != tail; ++head)
+			{
+				const io_uring_cqe& cqe = mCqes[head & mCqMask];
+				uint32_t slot = static_cast<uint32_t>(cqe.user_data);
+				completed.push_back({ mSlots[slot].piece, cqe.res });
+				mFreeSlots.push_back(slot);
+			}
+
+			// hand the entries back to the kernel before running callbacks, which may queue more reads
+			__atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+			mInFlight -= static_cast<uint32_t>(completed.size());
+
+			for (const auto& result : completed)
+			{
+				complete(result.first, result.second);
+			}
+		}
+
+		struct Slot
+		{
+			Piece piece;
+			iovec vector;
+		};
+
+		int mRing = -1;
+		void* mSqRing = nullptr;
+		void* mCqRing = nullptr;
+		size_t mSqRingSize = 0;
+		size_t mCqRingSize = 0;
+		io_uring_sqe* mSqes = nullptr;
+		size_t mSqesSize = 0;
+		unsigned* mSqTail = nullptr;
+		unsigned mSqMask = 0;
+		unsigned* mSqArray = nullptr;
+		unsigned* mCqHead = nullptr;
+		unsigned* mCqTail = nullptr;
+		unsigned mCqMask = 0;
+		io_uring_cqe* mCqes = nullptr;
+		std::vector<Slot> mSlots;
+		std::vector<uint32_t> mFreeSlots;
+#else
+		void submit()
+		{
+		}
+#endif
+
+		ReadBackend mBackend = ReadBackend::ThreadPool;
+		uint32_t mQueueDepth;
+		std::vector<File> mFiles;
+		std::unordered_map<uint64_t, Read> mReads;
+		uint64_t mNextRead = 0;
+		uint64_t mCompletedReads = 0;
+		AsyncReaderStats mStats;
+
+		// io_uring: pieces waiting for a free slot; thread pool: pieces waiting for a thread (guarded by mMutex)
+		std::deque<Piece> mQueued;
+		uint32_t mInFlight = 0;
+
+		// thread pool only
+		std::mutex mMutex;
+		std::condition_variable mWork;
+		std::condition_variable mDone;
+		std::deque<std::pair<Piece, int64_t>> mCompleted;
+		std::vector<std::thread> mThreads;
+		bool mStopping = false;
+	};
+}
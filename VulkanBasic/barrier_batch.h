@@ -0,0 +1,317 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/*
+
+Every layout transition and every hand-off of a resource from one kind of access to another needs a
+pipeline barrier, and the cost of a barrier is mostly in the vkCmdPipelineBarrier call (and whatever the
+driver has to flush or wait for because of it), not in the number of barriers it carries. Recording one
+call per transition, or worse, one submission per transition, adds up quickly.
+
+A barrier batch collects image and buffer barriers with the stages and access types that the two usages
+actually need, and records them with as few calls as possible:
+
+	vk::BarrierBatch batch;
+	batch.image(image, VK_IMAGE_ASPECT_COLOR_BIT, vk::ResourceUsage::None, vk::ResourceUsage::TransferDst);
+	batch.buffer(buffer, 0, VK_WHOLE_SIZE, vk::ResourceUsage::TransferDst, vk::ResourceUsage::IndirectBuffer);
+	vk::BarrierStats recorded = batch.flush(commandBuffer);
+
+Barriers are grouped by their source and destination stages, with one vkCmdPipelineBarrier per pair.
+Merging every group into a single call would be even fewer calls, but each barrier would then wait for
+the stages of all the others: a transfer that only has to wait for a previous transfer would wait for
+fragment shading as well. Within a flush, the order of the groups doesn't matter, since none of the
+batch's barriers depend on each other.
+
+The counters add up what the batches record, along with the queue submissions, so that the number of
+barriers and submissions per frame can be tracked from one build to the next.
+
+*/
+
+namespace vk
+{
+	//! how a command (or a render graph pass) accesses a resource
+	enum class ResourceUsage
+	{
+		None,																			// not at all: contents are undefined
+		ColorAttachment,																// written (and possibly blended with) as a color attachment
+		DepthAttachment,																// depth tested and written
+		DepthAttachmentRead,															// depth tested, without writing
+		Sampled,																		// read by a fragment shader through a sampler
+		StorageRead,																	// read by a compute shader
+		StorageWrite,																	// written by a compute shader
+		TransferSrc,
+		TransferDst,
+		IndirectBuffer,																	// draw or dispatch parameters
+		Present																			// handed to the presentation engine
+	};
+
+	//! the pipeline stages, access types and image layout that go with a ResourceUsage
+	struct UsageAccess
+	{
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		bool write;
+		bool attachment;
+		VkImageUsageFlags imageUsage;
+		VkBufferUsageFlags bufferUsage;
+	};
+
+	inline UsageAccess usageAccess(ResourceUsage usage)
+	{
+		switch (usage)
+		{
+		case ResourceUsage::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 0 };
+		case ResourceUsage::DepthAttachment:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true, true, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0 };
+		case ResourceUsage::DepthAttachmentRead:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false, true, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0 };
+		case ResourceUsage::Sampled:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false, VK_IMAGE_USAGE_SAMPLED_BIT, VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT };
+		case ResourceUsage::StorageRead:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, false, false, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT };
+		case ResourceUsage::StorageWrite:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, true, false, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT };
+		case ResourceUsage::TransferSrc:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false, false, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT };
+		case ResourceUsage::TransferDst:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true, false, VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_BUFFER_USAGE_TRANSFER_DST_BIT };
+		case ResourceUsage::IndirectBuffer:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, false, false, 0, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT };
+		case ResourceUsage::Present:
+			// the semaphore that vkQueuePresentKHR waits for takes care of the memory dependency
+			return { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false, false, 0, 0 };
+		case ResourceUsage::None:
+		default:
+			return { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, false, false, 0, 0 };
+		}
+	}
+
+	//! the part of an access mask that writes: only writes have to be made available by a barrier
+	inline VkAccessFlags writeAccess(VkAccessFlags access)
+	{
+		return access & (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT);
+	}
+
+	//! a barrier that moves a whole image from one usage to another, for commands recorded outside of a render graph
+	inline VkImageMemoryBarrier imageBarrier(VkImage image, VkImageAspectFlags aspect, ResourceUsage from, ResourceUsage to)
+	{
+		UsageAccess src = usageAccess(from);
+		UsageAccess dst = usageAccess(to);
+
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = writeAccess(src.access);
+		barrier.dstAccessMask = dst.access;
+		barrier.oldLayout = src.layout;
+		barrier.newLayout = dst.layout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = aspect;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		return barrier;
+	}
+
+	//! a barrier that moves a range of a buffer from one usage to another
+	inline VkBufferMemoryBarrier bufferBarrier(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, ResourceUsage from, ResourceUsage to)
+	{
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = writeAccess(usageAccess(from).access);
+		barrier.dstAccessMask = usageAccess(to).access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+		return barrier;
+	}
+
+
+	//! what a barrier batch recorded
+	struct BarrierStats
+	{
+		uint64_t imageBarriers = 0;
+		uint64_t bufferBarriers = 0;
+		uint64_t batches = 0;															// vkCmdPipelineBarrier calls
+		uint64_t submissions = 0;														// vkQueueSubmit calls, only counted by BarrierCounters
+
+		BarrierStats& operator+=(const BarrierStats& other)
+		{
+			imageBarriers += other.imageBarriers;
+			bufferBarriers += other.bufferBarriers;
+			batches += other.batches;
+			submissions += other.submissions;
+			return *this;
+		}
+	};
+
+	class BarrierBatch
+	{
+	public:
+		//! move a whole image from one usage to another
+		void image(VkImage image, VkImageAspectFlags aspect, ResourceUsage from, ResourceUsage to)
+		{
+			this->image(imageBarrier(image, aspect, from, to), usageAccess(from).stages, usageAccess(to).stages);
+		}
+
+		void image(const VkImageMemoryBarrier& barrier, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+		{
+			group(srcStages, dstStages).images.push_back(barrier);
+		}
+
+		//! move a range of a buffer from one usage to another
+		void buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, ResourceUsage from, ResourceUsage to)
+		{
+			this->buffer(bufferBarrier(buffer, offset, size, from, to), usageAccess(from).stages, usageAccess(to).stages);
+		}
+
+		void buffer(const VkBufferMemoryBarrier& barrier, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+		{
+			group(srcStages, dstStages).buffers.push_back(barrier);
+		}
+
+		bool empty() const { return mGroups.empty(); }
+
+		//! what flush would record
+		BarrierStats stats() const
+		{
+			BarrierStats s;
+			for (const Group& g : mGroups)
+			{
+				s.imageBarriers += g.images.size();
+				s.bufferBarriers += g.buffers.size();
+				s.batches++;
+			}
+			return s;
+		}
+
+		//! record one vkCmdPipelineBarrier per pair of stages, and start over with an empty batch
+		BarrierStats flush(VkCommandBuffer commandBuffer)
+		{
+			BarrierStats s = stats();
+			for (const Group& g : mGroups)
+			{
+				vkCmdPipelineBarrier(commandBuffer,
+					g.srcStages,
+					g.dstStages,
+					0,
+					0, nullptr,
+					static_cast<uint32_t>(g.buffers.size()), g.buffers.data(),
+					static_cast<uint32_t>(g.images.size()), g.images.data());
+			}
+			mGroups.clear();
+			return s;
+		}
+
+	private:
+		struct Group
+		{
+			VkPipelineStageFlags srcStages;
+			VkPipelineStageFlags dstStages;
+			std::vector<VkImageMemoryBarrier> images;
+			std::vector<VkBufferMemoryBarrier> buffers;
+		};
+
+		Group& group(VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+		{
+			// a barrier needs at least one stage on either side: nothing to wait for is the top of the pipe, nothing waiting is the bottom
+			srcStages = srcStages != 0 ? srcStages : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+			dstStages = dstStages != 0 ? dstStages : VkPipelineStageFlags(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+			// there are only ever a handful of groups, so a linear search beats a map
+			for (Group& g : mGroups)
+			{
+				if (g.srcStages == srcStages && g.dstStages == dstStages)
+				{
+					return g;
+				}
+			}
+			mGroups.push_back({ srcStages, dstStages, {}, {} });
+			return mGroups.back();
+		}
+
+		std::vector<Group> mGroups;
+	};
+
+	//! the barriers and submissions of every frame, counted from any number of threads
+	class BarrierCounters
+	{
+	public:
+		void recorded(const BarrierStats& stats)
+		{
+			mImageBarriers += stats.imageBarriers;
+			mBufferBarriers += stats.bufferBarriers;
+			mBatches += stats.batches;
+		}
+
+		void submitted(uint64_t submissions = 1)
+		{
+			mSubmissions += submissions;
+		}
+
+		//! the counts since the previous call, which start over from zero
+		BarrierStats collect()
+		{
+			BarrierStats s;
+			s.imageBarriers = mImageBarriers.exchange(0);
+			s.bufferBarriers = mBufferBarriers.exchange(0);
+			s.batches = mBatches.exchange(0);
+			s.submissions = mSubmissions.exchange(0);
+			return s;
+		}
+
+		//! collect the counts of the frame that just ended, and add them to the totals
+		BarrierStats endFrame()
+		{
+			BarrierStats s = collect();
+			mTotal += s;
+			mFrames++;
+			mWorstBarriers = std::max<uint64_t>(mWorstBarriers, s.imageBarriers + s.bufferBarriers);
+			mWorstSubmissions = std::max<uint64_t>(mWorstSubmissions, s.submissions);
+			return s;
+		}
+
+		void report(std::ostream& out) const
+		{
+			double frames = mFrames > 0 ? static_cast<double>(mFrames) : 1.0;
+			out << "Barriers over " << mFrames << " frames: " << (mTotal.imageBarriers + mTotal.bufferBarriers) / frames << " barriers in " << mTotal.batches / frames
+				<< " vkCmdPipelineBarrier calls and " << mTotal.submissions / frames << " submissions per frame (worst frame " << mWorstBarriers << " barriers, "
+				<< mWorstSubmissions << " submissions)." << std::endl;
+		}
+
+	private:
+		std::atomic<uint64_t> mImageBarriers{ 0 };
+		std::atomic<uint64_t> mBufferBarriers{ 0 };
+		std::atomic<uint64_t> mBatches{ 0 };
+		std::atomic<uint64_t> mSubmissions{ 0 };
+
+		// only touched by the thread that ends frames
+		BarrierStats mTotal;
+		uint64_t mFrames = 0;
+		uint64_t mWorstBarriers = 0;
+		uint64_t mWorstSubmissions = 0;
+	};
+}
@@ -1,76 +1,222 @@
 #pragma once
 
+#include "host_allocator.h"
 #include "vulkan.h"
 
-#include <functional>
+#include <type_traits>
+#include <utility>
 
 /*
 
 Every Vulkan object needs to be explicitly destroyed with a function call when it is no longer needed.
-This class takes advantage of the RAII principle to manage the lifetime of Vulkan resources. As an example, 
-consider the case where we want to store a VkInstance object that should be destroyed with vkDestroyInstance. 
-We would write:
+These classes take advantage of the RAII principle to manage the lifetime of Vulkan resources. The destroy
+function is a template parameter, so it is called directly (and can be inlined) instead of going through a
+type-erased wrapper, and the handle that the object was created from is stored by value right next to it.
+As an example, consider the case where we want to store a VkBuffer object that should be destroyed with
+vkDestroyBuffer. We would write:
 
-	vk::Deleter<VkInstance> instance{vkDestroyInstance};
+	vk::DeviceHandle<VkBuffer, vkDestroyBuffer> buffer;		// or simply vk::Buffer, see the aliases below
+
+	vkCreateBuffer(device, &bufferInfo, vk::allocationCallbacks(), buffer.replace(device));
+
+replace() destroys whatever object the handle held before and returns a pointer that the vkCreateXXX function
+can write the new object into. On non-dispatchable handles, VkBuffer, VkImage, etc. may all be the same type
+(a 64-bit integer on 32-bit platforms), which is another reason why the destroy function has to be part of
+the handle's type rather than being deduced from the object type.
+
+The handles are move-only: moving one transfers ownership of the object, and the moved-from handle is left
+empty. This means that they can be stored in a std::vector and grow without destroying anything.
+
+Objects are destroyed with the process-wide allocation callbacks (see host_allocator.h), so they have to be
+created with vk::allocationCallbacks() as well.
 
 */
 
 namespace vk
 {
-	template<typename T>
-	class Deleter
+	//! owns an object that is destroyed with vkDestroyXXX(object, callbacks), i.e. VkInstance and VkDevice
+	template<typename T, void (VKAPI_PTR *Destroy)(T, const VkAllocationCallbacks*)>
+	class UniqueHandle
 	{
 	public:
-		Deleter() : Deleter([](T t) {}) {}
+		UniqueHandle() noexcept = default;
+
+		UniqueHandle(const UniqueHandle&) = delete;
+		UniqueHandle& operator=(const UniqueHandle&) = delete;
 
-		//! used for vkDestroyXXX(object, callbacks) variants
-		Deleter(std::function<void(T, VkAllocationCallbacks*)> deletef) 
+		UniqueHandle(UniqueHandle&& other) noexcept :
+			mObject(other.release())
 		{
-			mObject = VK_NULL_HANDLE;
-			mDeleter = [=](T obj) { deletef(obj, nullptr); };
 		}
 
-		//! used for vkDestroyXXX(instance, object, callbacks) variants
-		Deleter(const Deleter<VkInstance>& instance, std::function<void(VkInstance, T, VkAllocationCallbacks*)> deletef) 
+		UniqueHandle& operator=(UniqueHandle&& other) noexcept
 		{
-			mObject = VK_NULL_HANDLE;
-			mDeleter = [&instance, deletef](T obj) { deletef(instance, obj, nullptr); };
+			if (this != &other)
+			{
+				reset();
+				mObject = other.release();
+			}
+			return *this;
 		}
 
-		//! used for vkDestroyXXX(device, object, callbacks) variants
-		Deleter(const Deleter<VkDevice>& device, std::function<void(VkDevice, T, VkAllocationCallbacks*)> deletef) 
+		~UniqueHandle()
 		{
+			reset();
+		}
+
+		//! destroy the current object (if any) and return a pointer for a vkCreateXXX function to write a new object into
+		T* replace() noexcept
+		{
+			reset();
+			return &mObject;
+		}
+
+		//! destroy the current object (if any)
+		void reset() noexcept
+		{
+			if (mObject != VK_NULL_HANDLE)
+			{
+				Destroy(mObject, allocationCallbacks());
+			}
 			mObject = VK_NULL_HANDLE;
-			mDeleter = [&device, deletef](T obj) { deletef(device, obj, nullptr); };
 		}
 
-		~Deleter() 
+		//! give up ownership of the object without destroying it
+		T release() noexcept
 		{
-			cleanup();
+			T object = mObject;
+			mObject = VK_NULL_HANDLE;
+			return object;
 		}
 
-		T* operator &() 
+		T get() const noexcept
 		{
-			cleanup();
-			return &mObject;
+			return mObject;
 		}
 
-		operator T() const 
+		operator T() const noexcept
 		{
 			return mObject;
 		}
 
 	private:
-		T mObject;
-		std::function<void(T)> mDeleter;
+		T mObject = VK_NULL_HANDLE;
+	};
+
+	//! owns an object that is destroyed with vkDestroyXXX(parent, object, callbacks), where the parent is a VkInstance or VkDevice
+	template<typename Parent, typename T, void (VKAPI_PTR *Destroy)(Parent, T, const VkAllocationCallbacks*)>
+	class UniqueChildHandle
+	{
+	public:
+		UniqueChildHandle() noexcept = default;
+
+		UniqueChildHandle(Parent parent, T object) noexcept :
+			mParent(parent),
+			mObject(object)
+		{
+		}
+
+		UniqueChildHandle(const UniqueChildHandle&) = delete;
+		UniqueChildHandle& operator=(const UniqueChildHandle&) = delete;
+
+		UniqueChildHandle(UniqueChildHandle&& other) noexcept :
+			mParent(other.mParent),
+			mObject(other.release())
+		{
+		}
 
-		void cleanup()
+		UniqueChildHandle& operator=(UniqueChildHandle&& other) noexcept
+		{
+			if (this != &other)
+			{
+				reset();
+				mParent = other.mParent;
+				mObject = other.release();
+			}
+			return *this;
+		}
+
+		~UniqueChildHandle()
+		{
+			reset();
+		}
+
+		//! destroy the current object (if any) and return a pointer for a vkCreateXXX function to write a new object into, which will later be destroyed through the given parent
+		T* replace(Parent parent) noexcept
+		{
+			reset();
+			mParent = parent;
+			return &mObject;
+		}
+
+		//! destroy the current object (if any)
+		void reset() noexcept
 		{
 			if (mObject != VK_NULL_HANDLE)
 			{
-				mDeleter(mObject);
+				Destroy(mParent, mObject, allocationCallbacks());
 			}
 			mObject = VK_NULL_HANDLE;
 		}
+
+		//! give up ownership of the object without destroying it
+		T release() noexcept
+		{
+			T object = mObject;
+			mObject = VK_NULL_HANDLE;
+			return object;
+		}
+
+		T get() const noexcept
+		{
+			return mObject;
+		}
+
+		Parent parent() const noexcept
+		{
+			return mParent;
+		}
+
+		operator T() const noexcept
+		{
+			return mObject;
+		}
+
+	private:
+		Parent mParent = VK_NULL_HANDLE;
+		T mObject = VK_NULL_HANDLE;
 	};
-}
\ No newline at end of file
+
+	template<typename T, void (VKAPI_PTR *Destroy)(VkInstance, T, const VkAllocationCallbacks*)>
+	using InstanceHandle = UniqueChildHandle<VkInstance, T, Destroy>;
+
+	template<typename T, void (VKAPI_PTR *Destroy)(VkDevice, T, const VkAllocationCallbacks*)>
+	using DeviceHandle = UniqueChildHandle<VkDevice, T, Destroy>;
+
+	using Instance = UniqueHandle<VkInstance, vkDestroyInstance>;
+	using Device = UniqueHandle<VkDevice, vkDestroyDevice>;
+	using SurfaceKHR = InstanceHandle<VkSurfaceKHR, vkDestroySurfaceKHR>;
+	using SwapchainKHR = DeviceHandle<VkSwapchainKHR, vkDestroySwapchainKHR>;
+	using Buffer = DeviceHandle<VkBuffer, vkDestroyBuffer>;
+	using DeviceMemory = DeviceHandle<VkDeviceMemory, vkFreeMemory>;
+	using Image = DeviceHandle<VkImage, vkDestroyImage>;
+	using ImageView = DeviceHandle<VkImageView, vkDestroyImageView>;
+	using Sampler = DeviceHandle<VkSampler, vkDestroySampler>;
+	using RenderPass = DeviceHandle<VkRenderPass, vkDestroyRenderPass>;
+	using Framebuffer = DeviceHandle<VkFramebuffer, vkDestroyFramebuffer>;
+	using ShaderModule = DeviceHandle<VkShaderModule, vkDestroyShaderModule>;
+	using DescriptorSetLayout = DeviceHandle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>;
+	using DescriptorPool = DeviceHandle<VkDescriptorPool, vkDestroyDescriptorPool>;
+	using PipelineLayout = DeviceHandle<VkPipelineLayout, vkDestroyPipelineLayout>;
+	using PipelineCache = DeviceHandle<VkPipelineCache, vkDestroyPipelineCache>;
+	using Pipeline = DeviceHandle<VkPipeline, vkDestroyPipeline>;
+	using CommandPool = DeviceHandle<VkCommandPool, vkDestroyCommandPool>;
+	using Semaphore = DeviceHandle<VkSemaphore, vkDestroySemaphore>;
+	using Fence = DeviceHandle<VkFence, vkDestroyFence>;
+	using QueryPool = DeviceHandle<VkQueryPool, vkDestroyQueryPool>;
+
+	// nothing but the two handles: no allocations, no indirection, and moves that a std::vector can rely on
+	static_assert(sizeof(Device) == sizeof(VkDevice), "vk::UniqueHandle should be exactly as large as the handle it owns.");
+	static_assert(sizeof(Buffer) == sizeof(VkDevice) + sizeof(VkBuffer) || sizeof(void*) != 8, "vk::UniqueChildHandle should be the size of two pointers.");
+	static_assert(std::is_nothrow_move_constructible<Buffer>::value && std::is_nothrow_move_assignable<Buffer>::value, "vk::UniqueChildHandle moves should be noexcept.");
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "deleter.h"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+
+Destroying a Vulkan object that is still referenced by a command buffer the GPU hasn't finished executing is
+invalid, which is why replacing an object used to require a vkDeviceWaitIdle first. The deletion queue
+removes that stall: instead of destroying an object right away, it is retired along with the number of the
+last frame that could have used it. Once the application knows that this frame has completed on the GPU (by
+checking the frame's fence), it calls collect and every object retired at or before that frame is destroyed.
+
+	mDeletionQueue.retire(std::move(mGraphicsPipeline), mSubmittedFrame);
+	createGraphicsPipeline();												// mGraphicsPipeline is empty again, so nothing is destroyed here
+
+	...
+
+	mDeletionQueue.collect(mCompletedFrame);
+
+Entries hold nothing but the raw parent and object handles and a function pointer that knows how to destroy
+them, so retiring an object never allocates beyond the queue's own storage.
+
+*/
+
+namespace vk
+{
+	class DeletionQueue
+	{
+	public:
+		DeletionQueue() = default;
+		DeletionQueue(const DeletionQueue&) = delete;
+		DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+		//! the device must be idle by the time the queue is destroyed
+		~DeletionQueue()
+		{
+			flush();
+		}
+
+		//! take ownership of the object in handle (leaving it empty) and destroy it once frame has completed
+		template<typename Parent, typename T, void (VKAPI_PTR *Destroy)(Parent, T, const VkAllocationCallbacks*)>
+		void retire(UniqueChildHandle<Parent, T, Destroy>&& handle, uint64_t frame)
+		{
+			static_assert(sizeof(Parent) <= sizeof(uint64_t) && sizeof(T) <= sizeof(uint64_t), "Handles must fit into 64 bits.");
+
+			Parent parent = handle.parent();
+			T object = handle.release();
+			if (object == VK_NULL_HANDLE)
+			{
+				return;
+			}
+
+			Entry entry = {};
+			entry.frame = frame;
+			entry.destroy = &destroyThunk<Parent, T, Destroy>;
+			std::memcpy(&entry.parent, &parent, sizeof(parent));
+			std::memcpy(&entry.object, &object, sizeof(object));
+			mEntries.push_back(entry);
+		}
+
+		//! retire every handle in the vector and clear it
+		template<typename Handle>
+		void retire(std::vector<Handle>& handles, uint64_t frame)
+		{
+			for (auto& handle : handles)
+			{
+				retire(std::move(handle), frame);
+			}
+			handles.clear();
+		}
+
+		//! for anything that isn't a single handle, like command buffers that have to be freed back to their pool
+		void retire(std::function<void()> destroy, uint64_t frame)
+		{
+			mCallbacks.push_back({ frame, std::move(destroy) });
+		}
+
+		//! destroy everything that was retired at or before completedFrame
+		void collect(uint64_t completedFrame)
+		{
+			// frames complete in order, so entries are retired in (non-strictly) increasing frame order
+			while (!mEntries.empty() && mEntries.front().frame <= completedFrame)
+			{
+				const Entry& entry = mEntries.front();
+				entry.destroy(entry.parent, entry.object);
+				mEntries.pop_front();
+			}
+
+			while (!mCallbacks.empty() && mCallbacks.front().frame <= completedFrame)
+			{
+				mCallbacks.front().destroy();
+				mCallbacks.pop_front();
+			}
+		}
+
+		//! destroy everything right away: only valid once the device is idle
+		void flush()
+		{
+			collect(~uint64_t(0));
+		}
+
+		size_t size() const
+		{
+			return mEntries.size() + mCallbacks.size();
+		}
+
+	private:
+		struct Entry
+		{
+			uint64_t frame;
+			void (*destroy)(uint64_t parent, uint64_t object);
+			uint64_t parent;
+			uint64_t object;
+		};
+
+		struct Callback
+		{
+			uint64_t frame;
+			std::function<void()> destroy;
+		};
+
+		template<typename Parent, typename T, void (VKAPI_PTR *Destroy)(Parent, T, const VkAllocationCallbacks*)>
+		static void destroyThunk(uint64_t parentBits, uint64_t objectBits)
+		{
+			Parent parent;
+			T object;
+			std::memcpy(&parent, &parentBits, sizeof(parent));
+			std::memcpy(&object, &objectBits, sizeof(object));
+			Destroy(parent, object, allocationCallbacks());
+		}
+
+		std::deque<Entry> mEntries;
+		std::deque<Callback> mCallbacks;
+	};
+}
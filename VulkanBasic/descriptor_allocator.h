@@ -0,0 +1,484 @@
+#pragma once
+
+#include "deleter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+A descriptor pool has to be created with a fixed number of sets and descriptors of each type, which makes it
+awkward to allocate from when the number of sets isn't known up front. The descriptor allocator hides the
+pools: it describes a typical set as a list of descriptor counts per type, and creates pools that have room
+for a number of such sets whenever the current pool runs out. Every new pool holds twice as many sets as the
+one before (up to a maximum), so the number of pools grows only logarithmically with the number of sets.
+
+	vk::DescriptorAllocator allocator;
+	allocator.init(device, { { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 }, { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 } });
+	VkDescriptorSet set = allocator.allocate(layout);
+
+Sets that are only used by a single frame (transient sets) don't have to be freed one by one: retiring the
+allocator hands all of its pools that were used since the last call over to the given frame, and once
+that frame has completed, collect resets them in one call and they are reused for new allocations. This
+follows the same frame numbering as vk::DeletionQueue:
+
+	VkDescriptorSet set = transientAllocator.allocate(layout);
+	...
+	transientAllocator.retire(mSubmittedFrame);
+	...
+	transientAllocator.collect(mCompletedFrame);
+
+Persistent sets come from an allocator that is never retired. The descriptor set cache sits on top of such
+an allocator and returns the same set for identical layouts and bindings, so writing the same resources
+twice doesn't use up another set. Layouts are deduplicated the same way by the descriptor set layout cache,
+which creates them from a description (usually reflected from the shaders, see spirv_reflect.h) and owns them.
+
+*/
+
+namespace vk
+{
+	//! allocation counters of a descriptor allocator, for reporting
+	struct DescriptorAllocatorStats
+	{
+		uint64_t allocations = 0;													// sets allocated over the allocator's lifetime
+		uint32_t poolsCreated = 0;
+		uint32_t poolResets = 0;
+		uint32_t largestPoolSets = 0;												// the maximum number of sets of the largest pool created so far
+	};
+
+	class DescriptorAllocator
+	{
+	public:
+		DescriptorAllocator() = default;
+		DescriptorAllocator(const DescriptorAllocator&) = delete;
+		DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+		//! setSizes are the descriptor counts of a typical set: each pool has room for its number of sets times these counts
+		void init(VkDevice device, const std::vector<VkDescriptorPoolSize>& setSizes, uint32_t firstPoolSets = 4, uint32_t maxPoolSets = 4096, VkDescriptorPoolCreateFlags flags = 0)
+		{
+			mDevice = device;
+			mSetSizes = setSizes;
+			mNextPoolSets = std::max(firstPoolSets, 1u);
+			mMaxPoolSets = std::max(maxPoolSets, mNextPoolSets);
+			mFlags = flags;
+		}
+
+		//! allocate a set from the current pool, moving on to a recycled or new pool if it is full
+		VkDescriptorSet allocate(VkDescriptorSetLayout layout, const void* next = nullptr)
+		{
+			/*
+
+			Before VK_KHR_maintenance1, a pool that is out of room may fail with any error code, so every
+			failure on a pool that already holds sets is treated as the pool being full. A failure on a pool
+			that was just created or reset means that the set doesn't fit into a pool at all.
+
+			*/
+
+			for (int attempt = 0; attempt < 2; ++attempt)
+			{
+				if (!mCurrent || mCurrent->allocatedSets >= mCurrent->maxSets)
+				{
+					mCurrent = acquirePool();
+				}
+
+				VkDescriptorPool pool = mCurrent->pool;
+				VkDescriptorSetAllocateInfo allocInfo = {};
+				allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				allocInfo.pNext = next;
+				allocInfo.descriptorPool = pool;
+				allocInfo.descriptorSetCount = 1;
+				allocInfo.pSetLayouts = &layout;
+
+				VkDescriptorSet set = VK_NULL_HANDLE;
+				if (vkAllocateDescriptorSets(mDevice, &allocInfo, &set) == VK_SUCCESS)
+				{
+					mCurrent->allocatedSets++;
+					mStats.allocations++;
+					return set;
+				}
+
+				bool freshPool = mCurrent->allocatedSets == 0;
+				mCurrent->allocatedSets = mCurrent->maxSets;								// don't try this pool again until it has been reset
+				if (freshPool)
+				{
+					break;
+				}
+			}
+
+			throw std::runtime_error("Failed to allocate descriptor set: it doesn't fit into an empty descriptor pool.");
+		}
+
+		//! the sets allocated since the last call are only used by frame: their pools are reset once it has completed (see collect)
+		void retire(uint64_t frame)
+		{
+			for (Pool* pool : mInUse)
+			{
+				pool->frame = frame;
+				mRetired.push_back(pool);
+			}
+			mInUse.clear();
+			mCurrent = nullptr;
+		}
+
+		//! reset the pools of every frame up to and including completedFrame, which frees all sets allocated from them
+		void collect(uint64_t completedFrame)
+		{
+			// frames complete in order, and pools are retired in increasing frame order
+			while (!mRetired.empty() && mRetired.front()->frame <= completedFrame)
+			{
+				Pool* pool = mRetired.front();
+				mRetired.pop_front();
+
+				vkResetDescriptorPool(mDevice, pool->pool, 0);
+				pool->allocatedSets = 0;
+				mStats.poolResets++;
+				mFree.push_back(pool);
+			}
+		}
+
+		const DescriptorAllocatorStats& stats() const
+		{
+			return mStats;
+		}
+
+		//! the number of pools that exist, whether they are in use, waiting for a frame or free
+		size_t poolCount() const
+		{
+			return mPools.size();
+		}
+
+	private:
+		struct Pool
+		{
+			DescriptorPool pool;
+			uint32_t maxSets = 0;
+			uint32_t allocatedSets = 0;
+			uint64_t frame = 0;														// the frame it was retired with
+		};
+
+		Pool* acquirePool()
+		{
+			Pool* pool = nullptr;
+
+			if (!mFree.empty())
+			{
+				pool = mFree.back();
+				mFree.pop_back();
+			}
+			else
+			{
+				mPools.emplace_back(new Pool());
+				pool = mPools.back().get();
+				pool->maxSets = mNextPoolSets;
+
+				std::vector<VkDescriptorPoolSize> poolSizes = mSetSizes;
+				for (auto& poolSize : poolSizes)
+				{
+					poolSize.descriptorCount *= pool->maxSets;
+				}
+
+				VkDescriptorPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+				poolInfo.flags = mFlags;
+				poolInfo.maxSets = pool->maxSets;
+				poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+				poolInfo.pPoolSizes = poolSizes.data();
+
+				if (vkCreateDescriptorPool(mDevice, &poolInfo, allocationCallbacks(), pool->pool.replace(mDevice)) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create descriptor pool.");
+				}
+
+				mStats.poolsCreated++;
+				mStats.largestPoolSets = std::max(mStats.largestPoolSets, pool->maxSets);
+				mNextPoolSets = std::min(mNextPoolSets * 2, mMaxPoolSets);
+			}
+
+			mInUse.push_back(pool);
+			return pool;
+		}
+
+		VkDevice mDevice = VK_NULL_HANDLE;
+		std::vector<VkDescriptorPoolSize> mSetSizes;
+		uint32_t mNextPoolSets = 4;
+		uint32_t mMaxPoolSets = 4096;
+		VkDescriptorPoolCreateFlags mFlags = 0;
+
+		std::vector<std::unique_ptr<Pool>> mPools;									// owns every pool, the lists below only point into it
+		Pool* mCurrent = nullptr;
+		std::vector<Pool*> mInUse;													// allocated from since the last retire
+		std::deque<Pool*> mRetired;
+		std::vector<Pool*> mFree;
+		DescriptorAllocatorStats mStats;
+	};
+
+	//! everything a descriptor set layout is created from; binding flags (VK_EXT_descriptor_indexing) are either empty or one per binding
+	struct DescriptorSetLayoutDesc
+	{
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		VkDescriptorSetLayoutCreateFlags flags = 0;
+		std::vector<VkFlags> bindingFlags;
+	};
+
+	//! owns descriptor set layouts and returns the same layout for identical descriptions, so pipelines whose shaders declare the same set share it
+	class DescriptorSetLayoutCache
+	{
+	public:
+		DescriptorSetLayoutCache() = default;
+		DescriptorSetLayoutCache(const DescriptorSetLayoutCache&) = delete;
+		DescriptorSetLayoutCache& operator=(const DescriptorSetLayoutCache&) = delete;
+
+		VkDescriptorSetLayout get(VkDevice device, const DescriptorSetLayoutDesc& desc)
+		{
+			size_t key = hash(desc);
+
+			auto& candidates = mLayouts[key];
+			for (const auto& candidate : candidates)
+			{
+				if (equal(candidate.desc, desc))
+				{
+					mHits++;
+					return candidate.layout;
+				}
+			}
+
+			mMisses++;
+
+			VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layoutInfo.flags = desc.flags;
+			layoutInfo.bindingCount = static_cast<uint32_t>(desc.bindings.size());
+			layoutInfo.pBindings = desc.bindings.data();
+
+#ifdef VK_EXT_descriptor_indexing
+			VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+			bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+			bindingFlagsInfo.bindingCount = static_cast<uint32_t>(desc.bindingFlags.size());
+			bindingFlagsInfo.pBindingFlags = desc.bindingFlags.data();
+
+			if (!desc.bindingFlags.empty())
+			{
+				layoutInfo.pNext = &bindingFlagsInfo;
+			}
+#else
+			if (std::any_of(desc.bindingFlags.begin(), desc.bindingFlags.end(), [](VkFlags flags) { return flags != 0; }))
+			{
+				throw std::runtime_error("Descriptor binding flags require VK_EXT_descriptor_indexing.");
+			}
+#endif
+
+			Entry entry;
+			entry.desc = desc;
+			if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocationCallbacks(), entry.layout.replace(device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create descriptor set layout object.");
+			}
+
+			VkDescriptorSetLayout layout = entry.layout;
+			candidates.push_back(std::move(entry));
+			return layout;
+		}
+
+		//! destroy every layout: only valid once no pipeline layout or descriptor set that uses them is in use anymore
+		void clear()
+		{
+			mLayouts.clear();
+		}
+
+		uint64_t hits() const { return mHits; }
+		uint64_t misses() const { return mMisses; }
+
+	private:
+		struct Entry
+		{
+			DescriptorSetLayoutDesc desc;
+			vk::DescriptorSetLayout layout;
+		};
+
+		static size_t hash(const DescriptorSetLayoutDesc& desc)
+		{
+			size_t seed = std::hash<uint32_t>()(desc.flags);
+			auto combine = [&seed](uint32_t value)
+			{
+				seed ^= std::hash<uint32_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			};
+
+			for (const auto& binding : desc.bindings)
+			{
+				combine(binding.binding);
+				combine(static_cast<uint32_t>(binding.descriptorType));
+				combine(binding.descriptorCount);
+				combine(binding.stageFlags);
+			}
+
+			for (VkFlags flags : desc.bindingFlags)
+			{
+				combine(flags);
+			}
+
+			return seed;
+		}
+
+		static bool equal(const DescriptorSetLayoutDesc& a, const DescriptorSetLayoutDesc& b)
+		{
+			// immutable samplers are only compared by address
+			return a.flags == b.flags && a.bindingFlags == b.bindingFlags && a.bindings.size() == b.bindings.size() &&
+				std::equal(a.bindings.begin(), a.bindings.end(), b.bindings.begin(), [](const VkDescriptorSetLayoutBinding& x, const VkDescriptorSetLayoutBinding& y)
+				{
+					return x.binding == y.binding && x.descriptorType == y.descriptorType && x.descriptorCount == y.descriptorCount &&
+						x.stageFlags == y.stageFlags && x.pImmutableSamplers == y.pImmutableSamplers;
+				});
+		}
+
+		std::unordered_map<size_t, std::vector<Entry>> mLayouts;
+		uint64_t mHits = 0;
+		uint64_t mMisses = 0;
+	};
+
+	//! the resources bound to one binding of a descriptor set: either buffers or images, depending on the type
+	struct DescriptorBinding
+	{
+		uint32_t binding;
+		VkDescriptorType type;
+		std::vector<VkDescriptorBufferInfo> buffers;
+		std::vector<VkDescriptorImageInfo> images;
+	};
+
+	//! returns the same persistent descriptor set for the same layout and bindings, allocating and writing a new one only on a miss
+	class DescriptorSetCache
+	{
+	public:
+		explicit DescriptorSetCache(DescriptorAllocator& allocator) :
+			mAllocator(allocator)
+		{
+		}
+
+		DescriptorSetCache(const DescriptorSetCache&) = delete;
+		DescriptorSetCache& operator=(const DescriptorSetCache&) = delete;
+
+		VkDescriptorSet get(VkDevice device, VkDescriptorSetLayout layout, const std::vector<DescriptorBinding>& bindings)
+		{
+			size_t key = hash(layout, bindings);
+
+			// the hash only narrows the search down, a full comparison decides whether two sets really are the same
+			auto& candidates = mSets[key];
+			for (const auto& candidate : candidates)
+			{
+				if (candidate.layout == layout && equal(candidate.bindings, bindings))
+				{
+					mHits++;
+					return candidate.set;
+				}
+			}
+
+			mMisses++;
+			VkDescriptorSet set = mAllocator.allocate(layout);
+
+			std::vector<VkWriteDescriptorSet> writes;
+			for (const auto& binding : bindings)
+			{
+				VkWriteDescriptorSet write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = set;
+				write.dstBinding = binding.binding;
+				write.dstArrayElement = 0;
+				write.descriptorType = binding.type;
+				write.descriptorCount = static_cast<uint32_t>(binding.buffers.empty() ? binding.images.size() : binding.buffers.size());
+				write.pBufferInfo = binding.buffers.empty() ? nullptr : binding.buffers.data();
+				write.pImageInfo = binding.images.empty() ? nullptr : binding.images.data();
+
+				if (write.descriptorCount > 0)
+				{
+					writes.push_back(write);
+				}
+			}
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+			candidates.push_back({ layout, bindings, set });
+			return set;
+		}
+
+		uint64_t hits() const { return mHits; }
+		uint64_t misses() const { return mMisses; }
+
+	private:
+		struct Entry
+		{
+			VkDescriptorSetLayout layout;
+			std::vector<DescriptorBinding> bindings;
+			VkDescriptorSet set;
+		};
+
+		template<typename T>
+		static void combine(size_t& seed, const T& value)
+		{
+			seed ^= std::hash<T>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		}
+
+		template<typename Handle>
+		static void combineHandle(size_t& seed, Handle handle)
+		{
+			// non-dispatchable handles are pointers on 64-bit platforms and integers on 32-bit ones
+			uint64_t bits = 0;
+			std::memcpy(&bits, &handle, sizeof(handle));
+			combine(seed, bits);
+		}
+
+		static size_t hash(VkDescriptorSetLayout layout, const std::vector<DescriptorBinding>& bindings)
+		{
+			size_t seed = 0;
+			combineHandle(seed, layout);
+
+			for (const auto& binding : bindings)
+			{
+				combine(seed, binding.binding);
+				combine(seed, static_cast<uint32_t>(binding.type));
+
+				for (const auto& buffer : binding.buffers)
+				{
+					combineHandle(seed, buffer.buffer);
+					combine(seed, buffer.offset);
+					combine(seed, buffer.range);
+				}
+
+				for (const auto& image : binding.images)
+				{
+					combineHandle(seed, image.sampler);
+					combineHandle(seed, image.imageView);
+					combine(seed, static_cast<uint32_t>(image.imageLayout));
+				}
+			}
+
+			return seed;
+		}
+
+		static bool equal(const std::vector<DescriptorBinding>& a, const std::vector<DescriptorBinding>& b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const DescriptorBinding& x, const DescriptorBinding& y)
+			{
+				return x.binding == y.binding && x.type == y.type &&
+					x.buffers.size() == y.buffers.size() && x.images.size() == y.images.size() &&
+					std::equal(x.buffers.begin(), x.buffers.end(), y.buffers.begin(), [](const VkDescriptorBufferInfo& p, const VkDescriptorBufferInfo& q)
+					{
+						return p.buffer == q.buffer && p.offset == q.offset && p.range == q.range;
+					}) &&
+					std::equal(x.images.begin(), x.images.end(), y.images.begin(), [](const VkDescriptorImageInfo& p, const VkDescriptorImageInfo& q)
+					{
+						return p.sampler == q.sampler && p.imageView == q.imageView && p.imageLayout == q.imageLayout;
+					});
+			});
+		}
+
+		DescriptorAllocator& mAllocator;
+		std::unordered_map<size_t, std::vector<Entry>> mSets;
+		uint64_t mHits = 0;
+		uint64_t mMisses = 0;
+	};
+}
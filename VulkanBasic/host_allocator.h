@@ -0,0 +1,368 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/*
+
+Drivers allocate host memory for their own bookkeeping, and some of them allocate a lot of it, i.e. while
+compiling pipelines. Passing VkAllocationCallbacks to every vkCreateXXX, vkAllocateMemory and vkDestroyXXX
+call routes those allocations through the application, which is the only way to see them. The host
+allocator counts every allocation by its VkSystemAllocationScope (which tells how long the driver intends
+to keep it: for the duration of a command, or as long as an object, a cache, the device or the instance
+lives) and keeps track of the bytes that are live, the peak and the total:
+
+	vkCreateBuffer(device, &bufferInfo, vk::allocationCallbacks(), buffer.replace(device));
+	...
+	vk::hostAllocator().report(std::cout);
+
+Objects have to be destroyed with the same callbacks they were created with, which is why there is a single
+allocator for the whole process, and why the handles in deleter.h pass it to their destroy functions.
+
+Allocations with command scope only live until the command that made them returns. Optionally, they are
+taken from a bump arena that belongs to the calling thread: allocating is an increment, freeing is a
+no-op, and the arena starts over from the beginning whenever nothing in it is live anymore. Allocations
+that don't fit (or come from a thread whose arena is busy with a larger command) fall back to the heap.
+
+*/
+
+namespace vk
+{
+	//! counters for one VkSystemAllocationScope
+	struct HostScopeStats
+	{
+		uint64_t allocations = 0;
+		uint64_t reallocations = 0;
+		uint64_t frees = 0;
+		uint64_t arenaAllocations = 0;													// the part of allocations that came from the command arena
+		uint64_t liveBytes = 0;
+		uint64_t peakBytes = 0;
+		uint64_t totalBytes = 0;														// allocated over the whole run
+	};
+
+	class HostAllocator
+	{
+	public:
+		static const uint32_t sScopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+		HostAllocator()
+		{
+			mCallbacks.pUserData = this;
+			mCallbacks.pfnAllocation = &sAllocate;
+			mCallbacks.pfnReallocation = &sReallocate;
+			mCallbacks.pfnFree = &sFree;
+			mCallbacks.pfnInternalAllocation = &sInternalAllocation;
+			mCallbacks.pfnInternalFree = &sInternalFree;
+		}
+
+		HostAllocator(const HostAllocator&) = delete;
+		HostAllocator& operator=(const HostAllocator&) = delete;
+
+		const VkAllocationCallbacks* callbacks() const { return &mCallbacks; }
+
+		//! take command scope allocations from a per-thread arena of the given size: call this before the first Vulkan object is created
+		void enableCommandArena(size_t bytesPerThread)
+		{
+			mArenaSize = bytesPerThread;
+		}
+
+		HostScopeStats stats(VkSystemAllocationScope scope) const
+		{
+			const Counters& counters = mScopes[scope];
+			HostScopeStats stats;
+			stats.allocations = counters.allocations.load(std::memory_order_relaxed);
+			stats.reallocations = counters.reallocations.load(std::memory_order_relaxed);
+			stats.frees = counters.frees.load(std::memory_order_relaxed);
+			stats.arenaAllocations = counters.arenaAllocations.load(std::memory_order_relaxed);
+			stats.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+			stats.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+			stats.totalBytes = counters.totalBytes.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		uint64_t liveBytes() const { return mTotal.liveBytes.load(std::memory_order_relaxed); }
+		uint64_t peakBytes() const { return mTotal.peakBytes.load(std::memory_order_relaxed); }
+
+		//! the bytes that the calling thread has allocated through the callbacks so far, to attribute allocations to the work in between two calls
+		static uint64_t threadAllocatedBytes()
+		{
+			return threadBytes();
+		}
+
+		void report(std::ostream& out) const
+		{
+			const char* names[sScopeCount] = { "command", "object", "cache", "device", "instance" };
+
+			out << "Host memory allocated by the driver (live / peak / total):" << std::endl;
+			out << std::fixed << std::setprecision(1);
+			for (uint32_t scope = 0; scope < sScopeCount; ++scope)
+			{
+				HostScopeStats s = stats(static_cast<VkSystemAllocationScope>(scope));
+				out << "\t" << std::left << std::setw(9) << names[scope] << std::right << std::setw(10) << s.liveBytes / 1024.0 << " / " << std::setw(10) << s.peakBytes / 1024.0
+					<< " / " << std::setw(10) << s.totalBytes / 1024.0 << " KiB in " << s.allocations << " allocations, " << s.reallocations << " reallocations";
+				if (mArenaSize > 0 && scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND)
+				{
+					out << " (" << s.arenaAllocations << " from the arena)";
+				}
+				out << std::endl;
+			}
+
+			out << "\t" << std::left << std::setw(9) << "all" << std::right << std::setw(10) << liveBytes() / 1024.0 << " / " << std::setw(10) << peakBytes() / 1024.0
+				<< " / " << std::setw(10) << mTotal.totalBytes.load(std::memory_order_relaxed) / 1024.0 << " KiB" << std::endl;
+			out << "\tThe driver also reported " << mInternalLiveBytes.load(std::memory_order_relaxed) / 1024.0 << " KiB live (" << mInternalPeakBytes.load(std::memory_order_relaxed) / 1024.0
+				<< " KiB peak) of internal allocations that it makes on its own, i.e. executable memory." << std::endl;
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+	private:
+		struct Counters
+		{
+			std::atomic<uint64_t> allocations{ 0 };
+			std::atomic<uint64_t> reallocations{ 0 };
+			std::atomic<uint64_t> frees{ 0 };
+			std::atomic<uint64_t> arenaAllocations{ 0 };
+			std::atomic<uint64_t> liveBytes{ 0 };
+			std::atomic<uint64_t> peakBytes{ 0 };
+			std::atomic<uint64_t> totalBytes{ 0 };
+		};
+
+		//! a block that only its thread allocates from, and that starts over once nothing in it is live
+		struct Arena
+		{
+			explicit Arena(size_t size) :
+				memory(new char[size]),
+				capacity(size)
+			{
+			}
+
+			char* bump(size_t size)
+			{
+				// only the owning thread bumps, so once the count is zero nothing can make it non-zero behind our back
+				if (live.load(std::memory_order_acquire) == 0)
+				{
+					used = 0;
+				}
+				if (size > capacity - used)
+				{
+					return nullptr;
+				}
+
+				char* block = memory.get() + used;
+				used += size;
+				live.fetch_add(1, std::memory_order_relaxed);
+				return block;
+			}
+
+			std::unique_ptr<char[]> memory;
+			size_t capacity;
+			size_t used = 0;
+			std::atomic<uint32_t> live{ 0 };
+		};
+
+		//! stored right in front of every allocation
+		struct Header
+		{
+			char* base;																	// what was allocated, before aligning
+			size_t size;
+			Arena* arena;																// or nullptr if it came from the heap
+			uint32_t scope;
+		};
+
+		static uint64_t& threadBytes()
+		{
+			static thread_local uint64_t bytes = 0;
+			return bytes;
+		}
+
+		static Header* header(void* memory)
+		{
+			return reinterpret_cast<Header*>(memory) - 1;
+		}
+
+		static void raise(std::atomic<uint64_t>& peak, uint64_t value)
+		{
+			uint64_t current = peak.load(std::memory_order_relaxed);
+			while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		void recordAllocation(Counters& counters, size_t size)
+		{
+			counters.allocations.fetch_add(1, std::memory_order_relaxed);
+			counters.totalBytes.fetch_add(size, std::memory_order_relaxed);
+			raise(counters.peakBytes, counters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size);
+		}
+
+		void recordFree(Counters& counters, size_t size)
+		{
+			counters.frees.fetch_add(1, std::memory_order_relaxed);
+			counters.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		Arena* threadArena()
+		{
+			static thread_local Arena* arena = nullptr;
+			if (!arena)
+			{
+				// the arenas belong to the allocator, so a block that is freed on another thread after its owner has exited is still valid
+				std::lock_guard<std::mutex> lock(mArenasMutex);
+				mArenas.emplace_back(new Arena(mArenaSize));
+				arena = mArenas.back().get();
+			}
+			return arena;
+		}
+
+		void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope)
+		{
+			if (size == 0)
+			{
+				return nullptr;
+			}
+
+			// alignment is a power of two, and the header in front has to be aligned as well
+			alignment = std::max(alignment, alignof(Header));
+			size_t total = sizeof(Header) + alignment - 1 + size;
+
+			Arena* arena = nullptr;
+			char* base = nullptr;
+			if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && mArenaSize > 0)
+			{
+				arena = threadArena();
+				base = arena->bump(total);
+			}
+			if (!base)
+			{
+				arena = nullptr;
+				base = static_cast<char*>(std::malloc(total));
+				if (!base)
+				{
+					return nullptr;
+				}
+			}
+
+			uintptr_t address = (reinterpret_cast<uintptr_t>(base) + sizeof(Header) + alignment - 1) & ~uintptr_t(alignment - 1);
+			void* memory = reinterpret_cast<void*>(address);
+			Header* h = header(memory);
+			h->base = base;
+			h->size = size;
+			h->arena = arena;
+			h->scope = scope;
+
+			recordAllocation(mScopes[scope], size);
+			recordAllocation(mTotal, size);
+			if (arena)
+			{
+				mScopes[scope].arenaAllocations.fetch_add(1, std::memory_order_relaxed);
+			}
+			threadBytes() += size;
+
+			return memory;
+		}
+
+		void free(void* memory)
+		{
+			if (!memory)
+			{
+				return;
+			}
+
+			Header* h = header(memory);
+			recordFree(mScopes[h->scope], h->size);
+			recordFree(mTotal, h->size);
+
+			if (h->arena)
+			{
+				h->arena->live.fetch_sub(1, std::memory_order_release);
+			}
+			else
+			{
+				std::free(h->base);
+			}
+		}
+
+		void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+		{
+			if (!original)
+			{
+				return allocate(size, alignment, scope);
+			}
+			if (size == 0)
+			{
+				free(original);
+				return nullptr;
+			}
+
+			// the original must be left untouched if the new allocation fails
+			void* memory = allocate(size, alignment, scope);
+			if (memory)
+			{
+				std::memcpy(memory, original, std::min(size, header(original)->size));
+				free(original);
+				mScopes[scope].reallocations.fetch_add(1, std::memory_order_relaxed);
+			}
+			return memory;
+		}
+
+		static void* VKAPI_PTR sAllocate(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+		{
+			return static_cast<HostAllocator*>(userData)->allocate(size, alignment, scope);
+		}
+
+		static void* VKAPI_PTR sReallocate(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+		{
+			return static_cast<HostAllocator*>(userData)->reallocate(original, size, alignment, scope);
+		}
+
+		static void VKAPI_PTR sFree(void* userData, void* memory)
+		{
+			static_cast<HostAllocator*>(userData)->free(memory);
+		}
+
+		//! the driver allocated memory on its own and only tells us about it
+		static void VKAPI_PTR sInternalAllocation(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope)
+		{
+			HostAllocator* self = static_cast<HostAllocator*>(userData);
+			raise(self->mInternalPeakBytes, self->mInternalLiveBytes.fetch_add(size, std::memory_order_relaxed) + size);
+		}
+
+		static void VKAPI_PTR sInternalFree(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope)
+		{
+			static_cast<HostAllocator*>(userData)->mInternalLiveBytes.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		VkAllocationCallbacks mCallbacks = {};
+		std::array<Counters, sScopeCount> mScopes;
+		Counters mTotal;
+		std::atomic<uint64_t> mInternalLiveBytes{ 0 };
+		std::atomic<uint64_t> mInternalPeakBytes{ 0 };
+
+		size_t mArenaSize = 0;
+		std::mutex mArenasMutex;
+		std::vector<std::unique_ptr<Arena>> mArenas;
+	};
+
+	//! the allocator that every Vulkan object in the process is created and destroyed with
+	inline HostAllocator& hostAllocator()
+	{
+		static HostAllocator allocator;
+		return allocator;
+	}
+
+	inline const VkAllocationCallbacks* allocationCallbacks()
+	{
+		return hostAllocator().callbacks();
+	}
+}
@@ -0,0 +1,474 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+
+A small work-stealing job system. Every thread that takes part (the thread that created the job system,
+plus a number of worker threads) owns a Chase-Lev deque. A thread pushes new jobs onto the bottom of its
+own deque and pops them back off the bottom, which keeps recently created (and cache-warm) work on the
+same thread. When a thread runs out of work, it steals from the top of another thread's deque instead.
+
+Jobs are grouped with counters: each job that is started with a counter increments it, and decrements it
+once it has finished. Waiting on a counter never blocks the calling thread outright - it keeps running
+queued jobs until the counter reaches zero, so the main thread helps out instead of sitting idle:
+
+	jobs::JobSystem jobSystem{ 3 };
+	jobs::Counter counter;
+
+	jobSystem.run([]() { decodeSomething(); }, &counter);
+	jobSystem.run([]() { parseSomethingElse(); }, &counter);
+	jobSystem.wait(counter);
+
+*/
+
+namespace jobs
+{
+	//! tracks how many jobs of a group are still outstanding
+	class Counter
+	{
+	public:
+		Counter() = default;
+		Counter(const Counter&) = delete;
+		Counter& operator=(const Counter&) = delete;
+
+		bool done() const
+		{
+			return mPending.load(std::memory_order_acquire) == 0;
+		}
+
+	private:
+		friend class JobSystem;
+
+		std::atomic<uint32_t> mPending{ 0 };
+		std::mutex mErrorMutex;
+		std::exception_ptr mError;											// the first exception thrown by a job of this group
+	};
+
+	struct Job
+	{
+		std::function<void()> function;
+		Counter* counter;
+	};
+
+	//! a dynamic circular work-stealing deque (Chase and Lev, 2005): one owner pushes and pops at the bottom, any thread may steal from the top
+	class WorkStealingDeque
+	{
+	public:
+		explicit WorkStealingDeque(size_t capacity = 256)
+		{
+			mArrays.emplace_back(new Array(capacity));
+			mArray.store(mArrays.back().get(), std::memory_order_relaxed);
+		}
+
+		WorkStealingDeque(const WorkStealingDeque&) = delete;
+		WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+		//! only called by the owning thread
+		void push(Job* job)
+		{
+			int64_t bottom = mBottom.load(std::memory_order_relaxed);
+			int64_t top = mTop.load(std::memory_order_acquire);
+			Array* array = mArray.load(std::memory_order_relaxed);
+
+			if (bottom - top > array->mask)
+			{
+				array = grow(array, top, bottom);
+			}
+
+			array->put(bottom, job);
+			std::atomic_thread_fence(std::memory_order_release);
+			mBottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+
+		//! only called by the owning thread: takes the most recently pushed job
+		Job* pop()
+		{
+			int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+			Array* array = mArray.load(std::memory_order_relaxed);
+			mBottom.store(bottom, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t top = mTop.load(std::memory_order_relaxed);
+
+			if (top > bottom)
+			{
+				// the deque was already empty
+				mBottom.store(bottom + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			Job* job = array->get(bottom);
+
+			if (top == bottom)
+			{
+				// this is the last job, so we have to race any thieves for it
+				if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					job = nullptr;
+				}
+				mBottom.store(bottom + 1, std::memory_order_relaxed);
+			}
+
+			return job;
+		}
+
+		//! called by any thread other than the owner: takes the least recently pushed job
+		Job* steal()
+		{
+			int64_t top = mTop.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t bottom = mBottom.load(std::memory_order_acquire);
+
+			if (top >= bottom)
+			{
+				return nullptr;
+			}
+
+			Array* array = mArray.load(std::memory_order_acquire);
+			Job* job = array->get(top);
+
+			if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				// lost the race against the owner or another thief
+				return nullptr;
+			}
+
+			return job;
+		}
+
+	private:
+		struct Array
+		{
+			explicit Array(size_t capacity) :
+				mask(static_cast<int64_t>(capacity) - 1),
+				slots(new std::atomic<Job*>[capacity])
+			{
+			}
+
+			Job* get(int64_t i) const
+			{
+				return slots[i & mask].load(std::memory_order_relaxed);
+			}
+
+			void put(int64_t i, Job* job)
+			{
+				slots[i & mask].store(job, std::memory_order_relaxed);
+			}
+
+			int64_t mask;													// the capacity is always a power of two
+			std::unique_ptr<std::atomic<Job*>[]> slots;
+		};
+
+		Array* grow(Array* array, int64_t top, int64_t bottom)
+		{
+			// thieves may still be reading from the old array, so it is kept alive until the deque is destroyed
+			mArrays.emplace_back(new Array(static_cast<size_t>(array->mask + 1) * 2));
+			Array* grown = mArrays.back().get();
+
+			for (int64_t i = top; i < bottom; ++i)
+			{
+				grown->put(i, array->get(i));
+			}
+
+			mArray.store(grown, std::memory_order_release);
+			return grown;
+		}
+
+		// top and bottom are written by different threads, so keep them on separate cache lines
+		std::atomic<int64_t> mTop{ 0 };
+		char mPadding[64];
+		std::atomic<int64_t> mBottom{ 0 };
+		std::atomic<Array*> mArray;
+		std::vector<std::unique_ptr<Array>> mArrays;						// only touched by the owner
+	};
+
+	class JobSystem
+	{
+	public:
+		//! the thread that creates the job system becomes thread 0 and runs jobs whenever it waits on a counter
+		explicit JobSystem(uint32_t workerCount)
+		{
+			for (uint32_t i = 0; i <= workerCount; ++i)
+			{
+				mDeques.emplace_back(new WorkStealingDeque());
+			}
+
+			threadIndex() = 0;
+
+			for (uint32_t i = 1; i <= workerCount; ++i)
+			{
+				mWorkers.emplace_back([this, i]() { workerLoop(i); });
+			}
+		}
+
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+
+		~JobSystem()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mWakeMutex);
+				mStopping = true;
+			}
+			mWakeCondition.notify_all();
+
+			for (auto& worker : mWorkers)
+			{
+				worker.join();
+			}
+
+			// jobs that were still queued never run, but they (and their functions' captures) are freed
+			for (auto& deque : mDeques)
+			{
+				while (Job* job = deque->pop())
+				{
+					delete job;
+				}
+			}
+			for (Job* job : mExternalJobs)
+			{
+				delete job;
+			}
+		}
+
+		//! the number of threads that run jobs, including the thread that created the job system
+		uint32_t threadCount() const
+		{
+			return static_cast<uint32_t>(mDeques.size());
+		}
+
+		//! the index of the calling thread, from 0 to threadCount() - 1, or sExternalThread if it doesn't belong to the job system
+		static uint32_t currentThreadIndex()
+		{
+			return threadIndex();
+		}
+
+		//! queue a job: if a counter is given, it is incremented now and decremented once the job has finished
+		void run(std::function<void()> function, Counter* counter = nullptr)
+		{
+			if (counter)
+			{
+				counter->mPending.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			Job* job = new Job{ std::move(function), counter };
+			uint32_t index = currentThreadIndex();
+
+			if (index < mDeques.size())
+			{
+				mDeques[index]->push(job);
+			}
+			else
+			{
+				// only the owner of a deque may push onto it, so threads that don't belong to the job system use a locked queue
+				std::lock_guard<std::mutex> lock(mExternalMutex);
+				mExternalJobs.push_back(job);
+			}
+
+			mQueuedJobs.fetch_add(1, std::memory_order_release);
+
+			{
+				std::lock_guard<std::mutex> lock(mWakeMutex);
+			}
+			mWakeCondition.notify_one();
+		}
+
+		//! run queued jobs until the counter reaches zero, then rethrow the first exception that any of its jobs threw
+		void wait(Counter& counter)
+		{
+			uint32_t index = currentThreadIndex();
+
+			while (!counter.done())
+			{
+				// the job may wait itself and run further jobs, which are part of its time already
+				double nested = nestedJobMs();
+				auto start = std::chrono::steady_clock::now();
+				if (!runOne(index))
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				nestedJobMs() = nested + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			std::exception_ptr error;
+			{
+				std::lock_guard<std::mutex> lock(counter.mErrorMutex);
+				std::swap(error, counter.mError);
+			}
+
+			if (error)
+			{
+				std::rethrow_exception(error);
+			}
+		}
+
+		//! call function(i) for every i in [0, count) as separate jobs and wait for all of them
+		template<typename Function>
+		void parallelFor(size_t count, Function function)
+		{
+			Counter counter;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				run([&function, i]() { function(i); }, &counter);
+			}
+
+			wait(counter);
+		}
+
+		//! the time the calling thread has spent running other jobs while it waited on counters, so that callers can tell their own time apart from it
+		static double waitedJobMs()
+		{
+			return nestedJobMs();
+		}
+
+		static const uint32_t sExternalThread = ~0u;
+
+	private:
+		static uint32_t& threadIndex()
+		{
+			static thread_local uint32_t index = sExternalThread;
+			return index;
+		}
+
+		static double& nestedJobMs()
+		{
+			static thread_local double ms = 0.0;
+			return ms;
+		}
+
+		//! find a job (own deque first, then steal from the others) and run it, returning false if there was nothing to do
+		bool runOne(uint32_t index)
+		{
+			Job* job = nullptr;
+			uint32_t count = threadCount();
+
+			if (index < count)
+			{
+				job = mDeques[index]->pop();
+			}
+
+			for (uint32_t i = 1; i <= count && !job; ++i)
+			{
+				uint32_t victim = (index + i) % count;
+				if (victim != index)
+				{
+					job = mDeques[victim]->steal();
+				}
+			}
+
+			if (!job)
+			{
+				std::lock_guard<std::mutex> lock(mExternalMutex);
+				if (!mExternalJobs.empty())
+				{
+					job = mExternalJobs.front();
+					mExternalJobs.pop_front();
+				}
+			}
+
+			if (!job)
+			{
+				return false;
+			}
+
+			mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			execute(job);
+			return true;
+		}
+
+		void execute(Job* job)
+		{
+			Counter* counter = job->counter;
+
+			// exceptions are handed to whoever waits on the counter, instead of escaping from a worker thread (which would terminate the program)
+			try
+			{
+				job->function();
+			}
+			catch (...)
+			{
+				if (counter)
+				{
+					std::lock_guard<std::mutex> lock(counter->mErrorMutex);
+					if (!counter->mError)
+					{
+						counter->mError = std::current_exception();
+					}
+				}
+				else
+				{
+					// nobody waits for a job without a counter, so all that can be done is to report the exception and drop it
+					reportDropped(std::current_exception());
+				}
+			}
+
+			delete job;
+
+			if (counter)
+			{
+				counter->mPending.fetch_sub(1, std::memory_order_release);
+			}
+		}
+
+		static void reportDropped(std::exception_ptr error)
+		{
+			try
+			{
+				std::rethrow_exception(error);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "A job without a counter threw an exception: " << e.what() << std::endl;
+			}
+			catch (...)
+			{
+				std::cerr << "A job without a counter threw an exception." << std::endl;
+			}
+		}
+
+		void workerLoop(uint32_t index)
+		{
+			threadIndex() = index;
+
+			while (true)
+			{
+				if (runOne(index))
+				{
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(mWakeMutex);
+				mWakeCondition.wait(lock, [this]() { return mStopping || mQueuedJobs.load(std::memory_order_acquire) > 0; });
+
+				if (mStopping)
+				{
+					return;
+				}
+			}
+		}
+
+		std::vector<std::unique_ptr<WorkStealingDeque>> mDeques;			// indexed by thread index
+		std::vector<std::thread> mWorkers;
+
+		std::mutex mExternalMutex;
+		std::deque<Job*> mExternalJobs;
+
+		std::atomic<int64_t> mQueuedJobs{ 0 };								// may briefly dip below zero when a job is taken before its push is counted
+		std::mutex mWakeMutex;
+		std::condition_variable mWakeCondition;
+		bool mStopping = false;
+	};
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+
+A compressor and decompressor for the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+small enough to live next to the rest of the application. A block is a series of sequences, each of which
+is a run of literal bytes followed by a match: a copy of earlier output, given as an offset back and a
+length. Decompressing is nothing but byte copies, which is why it runs at several GB/s and is well suited
+to assets that are compressed once and loaded many times.
+
+	std::vector<uint8_t> compressed(lz4::compressBound(size));
+	compressed.resize(lz4::compress(data, size, compressed.data(), compressed.size()));
+	...
+	bool ok = lz4::decompress(compressed.data(), compressed.size(), destination, size);
+
+The compressor is a plain greedy one with a single hash table, which is fast but doesn't compress as well as
+the reference implementation's high compression mode. Its output is a valid LZ4 block either way.
+
+*/
+
+namespace lz4
+{
+	namespace detail
+	{
+		const size_t sMinMatch = 4;
+		const size_t sLastLiterals = 5;												// the last five bytes of a block are always literals
+		const size_t sMatchFindLimit = 12;											// and the last match starts at least twelve bytes before the end
+		const size_t sMaxOffset = 65535;
+		const uint32_t sHashBits = 12;
+
+		inline uint32_t read32(const uint8_t* p)
+		{
+			uint32_t value;
+			std::memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		inline uint32_t hash(uint32_t sequence)
+		{
+			return (sequence * 2654435761u) >> (32 - sHashBits);
+		}
+
+		//! lengths of 15 and more continue in extra bytes of 255 each, terminated by a byte below 255
+		inline uint8_t* writeLength(uint8_t* op, size_t length)
+		{
+			for (; length >= 255; length -= 255)
+			{
+				*op++ = 255;
+			}
+			*op++ = static_cast<uint8_t>(length);
+			return op;
+		}
+
+		inline uint8_t* writeSequence(uint8_t* op, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+		{
+			uint8_t* token = op++;
+			*token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+			if (literalLength >= 15)
+			{
+				op = writeLength(op, literalLength - 15);
+			}
+
+			std::memcpy(op, literals, literalLength);
+			op += literalLength;
+
+			// the last sequence of a block has no match
+			if (matchLength > 0)
+			{
+				*op++ = static_cast<uint8_t>(offset & 0xff);
+				*op++ = static_cast<uint8_t>(offset >> 8);
+
+				size_t length = matchLength - sMinMatch;
+				*token |= static_cast<uint8_t>(std::min<size_t>(length, 15));
+				if (length >= 15)
+				{
+					op = writeLength(op, length - 15);
+				}
+			}
+
+			return op;
+		}
+	}
+
+	//! the largest size that compressing size bytes can produce
+	inline size_t compressBound(size_t size)
+	{
+		return size + size / 255 + 16;
+	}
+
+	//! compress size bytes from source, returning the compressed size, or 0 if it doesn't fit into capacity bytes
+	inline size_t compress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity)
+	{
+		using namespace detail;
+
+		if (capacity < compressBound(size))
+		{
+			return 0;
+		}
+
+		// positions are stored plus one, so zero means empty
+		std::vector<uint32_t> table(size_t(1) << sHashBits, 0);
+
+		uint8_t* op = destination;
+		size_t anchor = 0;
+		size_t i = 0;
+
+		while (size >= sMatchFindLimit + 1 && i + sMatchFindLimit <= size)
+		{
+			uint32_t sequence = read32(source + i);
+			uint32_t& slot = table[hash(sequence)];
+			size_t candidate = slot;
+			slot = static_cast<uint32_t>(i + 1);
+
+			if (candidate == 0 || i - (candidate - 1) > sMaxOffset || read32(source + candidate - 1) != sequence)
+			{
+				++i;
+				continue;
+			}
+
+			size_t match = candidate - 1;
+			size_t length = sMinMatch;
+			while (i + length < size - sLastLiterals && source[match + length] == source[i + length])
+			{
+				++length;
+			}
+
+			op = writeSequence(op, source + anchor, i - anchor, i - match, length);
+			i += length;
+			anchor = i;
+		}
+
+		op = writeSequence(op, source + anchor, size - anchor, 0, 0);
+		return static_cast<size_t>(op - destination);
+	}
+
+	//! decompress a block into exactly size bytes, returning false if the block is malformed or doesn't decompress to that size
+	inline bool decompress(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size)
+	{
+		const uint8_t* ip = source;
+		const uint8_t* inputEnd = source + sourceSize;
+		uint8_t* op = destination;
+		uint8_t* outputEnd = destination + size;
+
+		auto readLength = [&](size_t& length) -> bool
+		{
+			uint8_t byte;
+			do
+			{
+				if (ip >= inputEnd)
+				{
+					return false;
+				}
+				byte = *ip++;
+				length += byte;
+			} while (byte == 255);
+			return true;
+		};
+
+		while (ip < inputEnd)
+		{
+			uint8_t token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !readLength(literalLength))
+			{
+				return false;
+			}
+
+			if (literalLength > size_t(inputEnd - ip) || literalLength > size_t(outputEnd - op))
+			{
+				return false;
+			}
+
+			std::memcpy(op, ip, literalLength);
+			ip += literalLength;
+			op += literalLength;
+
+			// the last sequence ends after its literals
+			if (ip == inputEnd)
+			{
+				break;
+			}
+
+			if (inputEnd - ip < 2)
+			{
+				return false;
+			}
+
+			size_t offset = ip[0] | (size_t(ip[1]) << 8);
+			ip += 2;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15 && !readLength(matchLength))
+			{
+				return false;
+			}
+			matchLength += detail::sMinMatch;
+
+			if (offset == 0 || offset > size_t(op - destination) || matchLength > size_t(outputEnd - op))
+			{
+				return false;
+			}
+
+			const uint8_t* match = op - offset;
+			if (offset >= matchLength)
+			{
+				std::memcpy(op, match, matchLength);
+				op += matchLength;
+			}
+			else
+			{
+				// the match overlaps the bytes it produces, i.e. a run of a repeated pattern
+				for (size_t i = 0; i < matchLength; ++i)
+				{
+					*op++ = match[i];
+				}
+			}
+		}
+
+		return op == outputEnd;
+	}
+}
@@ -21,6 +21,29 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+// mesh processing headers
+#include "mesh_simplifier.h"
+
+// threading and profiling headers
+#include "job_system.h"
+#include "profiler.h"
+#include "task_graph.h"
+
+// resource lifetime headers
+#include "asset_archive.h"
+#include "async_reader.h"
+#include "barrier_batch.h"
+#include "deletion_queue.h"
+#include "descriptor_allocator.h"
+#include "host_allocator.h"
+#include "mapped_file.h"
+#include "pipeline_registry.h"
+#include "query_profiler.h"
+#include "render_graph.h"
+#include "residency_manager.h"
+#include "spirv_reflect.h"
+#include "staging_ring.h"
+
 // systen
 #include <iostream>
 #include <stdexcept>
@@ -32,9 +55,28 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include <thread>
+#include <exception>
+#include <limits>
+#include <cstring>
+#include <mutex>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <cstdlib>
 
 const std::string MODEL_PATH = "models/chalet.obj";
-const std::string TEXTURE_PATH = "textures/chalet.jpg";
+const std::vector<std::string> TEXTURE_PATHS = { "textures/chalet.jpg", "textures/texture.jpg" };
+const std::string ASSET_ARCHIVE_PATH = "assets.vba";									// the default for --pack-assets and --bench-assets
+
+// fractions of the original triangle count for each generated level of detail (finest to coarsest)
+const std::vector<float> LOD_RATIOS = { 0.5f, 0.25f, 0.125f, 0.0625f };
+
+// no collapse may move the surface further than this (in object space units) - levels beyond it are not generated
+const float LOD_MAX_ERROR = 0.05f;
+
+// the largest simplification error, in pixels, that is allowed to show up on screen
+const float LOD_PIXEL_THRESHOLD = 1.0f;
 
 //! a struct for managing vertex data
 struct Vertex
@@ -116,9 +158,148 @@ namespace std
 	};
 }
 
-struct UniformBufferObject
+//! how buffer data gets into device local memory (see chooseUploadPath)
+enum class UploadPath
+{
+	Auto,																				// direct where a large device local heap is host visible, staged otherwise
+	Staged,																				// always copy through the staging ring
+	Direct																				// write into device local, host visible memory, falling back to staged if there is none
+};
+
+//! trade-offs between input latency, frame rate stability and power use
+enum class LatencyProfile
+{
+	LowestLatency,
+	VsyncThroughput,
+	PowerSaving
+};
+
+//! how a latency profile maps onto the swap chain and frame pacing
+struct LatencyPolicy
+{
+	const char* name;
+	std::vector<VkPresentModeKHR> presentModes;											// in order of preference, VK_PRESENT_MODE_FIFO_KHR is the fallback
+	uint32_t extraImages;																// swap chain images beyond the surface's minimum
+	uint32_t framesInFlight;															// how many frames the CPU may run ahead of the GPU
+	double defaultFrameLimit;															// frames per second, 0 for no limit
+
+	static LatencyPolicy get(LatencyProfile profile)
+	{
+		/*
+
+		1. Lowest latency: MAILBOX (or IMMEDIATE) never blocks on presentation and always shows the newest
+		   frame, and with a single frame in flight, the CPU never queues up work ahead of the GPU
+		2. Vsync throughput: FIFO with an extra swap chain image and two frames in flight, so the CPU and
+		   GPU can both stay busy and no vertical blank is missed because of a short stall
+		3. Power saving: FIFO with as few images as the surface allows, one frame in flight, and a frame
+		   limiter that keeps the GPU idle for part of every refresh interval
+
+		*/
+
+		switch (profile)
+		{
+		case LatencyProfile::LowestLatency:
+			return { "lowest-latency", { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR }, 1, 1, 0.0 };
+		case LatencyProfile::PowerSaving:
+			return { "power-saving", { VK_PRESENT_MODE_FIFO_KHR }, 0, 1, 30.0 };
+		case LatencyProfile::VsyncThroughput:
+		default:
+			return { "vsync-throughput", { VK_PRESENT_MODE_FIFO_KHR }, 1, 2, 0.0 };
+		}
+	}
+};
+
+//! variants of the main pipeline, selected by specialization constants in shader.frag
+enum class PipelineVariant
+{
+	Opaque,
+	AlphaTest,																			// discards fragments whose alpha is below one half
+	Untextured																			// the vertex color and material tint only
+};
+
+static const std::array<PipelineVariant, 3> PIPELINE_VARIANTS = { PipelineVariant::Opaque, PipelineVariant::AlphaTest, PipelineVariant::Untextured };
+
+static const char* pipelineVariantName(PipelineVariant variant)
+{
+	switch (variant)
+	{
+	case PipelineVariant::AlphaTest:
+		return "alpha-test";
+	case PipelineVariant::Untextured:
+		return "untextured";
+	case PipelineVariant::Opaque:
+	default:
+		return "opaque";
+	}
+}
+
+//! command line options that control how the application runs
+struct AppSettings
+{
+	uint32_t recordingThreads = std::max(1u, std::thread::hardware_concurrency());	// --record-threads N
+	uint32_t workerThreads = std::max(1u, std::thread::hardware_concurrency()) - 1;	// --worker-threads N, in addition to the main thread
+	bool benchmarkRecording = false;													// --bench-recording
+	LatencyProfile latencyProfile = LatencyProfile::VsyncThroughput;					// --latency-profile lowest-latency|vsync-throughput|power-saving
+	double frameLimit = -1.0;															// --frame-limit FPS, where 0 disables the limiter and a negative value uses the profile's default
+	bool benchmarkLatency = false;														// --bench-latency
+	uint32_t objectCount = 1;															// --objects N, drawn as a grid of copies of the model
+	PipelineVariant pipelineVariant = PipelineVariant::Opaque;							// --pipeline-variant opaque|alpha-test|untextured
+	std::string assetArchive;															// --archive PATH, load the assets from a packed archive instead of the loose files
+	std::string packArchive;															// --pack-assets [PATH], write the loose assets into an archive and exit
+	bool benchmarkAssets = false;														// --bench-assets, compare loading the loose files with loading the archive
+	uint32_t stagingRingSize = 32;														// --staging-size MiB, the size of the ring buffer that all uploads go through
+	UploadPath uploadPath = UploadPath::Auto;											// --upload-path auto|staged|direct
+	bool benchmarkUploads = false;														// --bench-uploads, compare staged and direct buffer uploads
+	uint32_t hostArenaSize = 0;															// --host-arena KiB, a per-thread arena for the driver's command scope allocations (0 disables it)
+	uint32_t memoryBudget = 0;															// --memory-budget MiB, limits the budget of device local heaps (0 uses the reported or estimated budget)
+	bool depthPrepass = false;															// --depth-prepass, lay down depth with a position-only pass before shading (toggled with P)
+	bool benchmarkPrepass = false;														// --bench-prepass, compare frames with and without the depth prepass at several object counts
+	bool queryStatistics = false;														// --query-stats, measure each pass with occlusion and pipeline statistics queries
+};
+
+//! per-draw parameters, delivered to the shaders as push constants (see createGraphicsPipeline)
+struct DrawConstants
 {
 	glm::mat4 model;
+	uint32_t materialIndex;
+};
+
+//! a single indexed draw recorded into a secondary command buffer
+struct DrawCommand
+{
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	DrawConstants constants;
+};
+
+//! a texture image along with its view: the pixels are only kept until they have been uploaded
+struct Texture
+{
+	stbi_uc* pixels = nullptr;
+	const assets::Entry* archiveEntry = nullptr;										// the pixels are extracted from the asset archive instead, straight into staging memory
+	std::vector<char> encoded;															// the file as read from the disk, until it has been decoded
+	std::unique_ptr<jobs::Counter> decoded;												// the decode job, while it may still be running
+	int width = 0;
+	int height = 0;
+	vk::Image image;
+	vk::DeviceMemory memory;
+	vk::ImageView view;
+	bool resident = false;																// whether the image exists: textures that don't fit the memory budget are drawn with the first one instead
+	vk::ResidencyManager::ResourceId residency = vk::ResidencyManager::sInvalidResource;
+};
+
+//! an entry of the material table, laid out to match the std430 storage buffer in shader.frag
+struct Material
+{
+	glm::vec4 tint;
+	uint32_t textureIndex;																// into the texture array at binding 1
+	uint32_t padding[3];
+};
+
+//! per-frame data: the uniform buffer holds one copy for each swap chain image, selected with a dynamic offset
+struct UniformBufferObject
+{
+	glm::mat4 world;																	// the rotation of the whole scene
 	glm::mat4 view;
 	glm::mat4 projection;
 };
@@ -128,11 +309,60 @@ class BasicApp
 
 public:
 
+BasicApp(const AppSettings& settings) :
+	mSettings(settings),
+	mJobs(settings.workerThreads)
+{
+	applyLatencyProfile(settings.latencyProfile);
+	mDepthPrepass = mDepthPrepassRequested = settings.depthPrepass && depthPrepassSupported();
+
+	// before any Vulkan object exists, since every one of them is created through the same callbacks
+	vk::hostAllocator().enableCommandArena(size_t(settings.hostArenaSize) * 1024);
+}
+
 void run()
 {
+	if (!mSettings.packArchive.empty())
+	{
+		packAssets(mSettings.packArchive);
+		return;
+	}
+
+	if (mSettings.benchmarkAssets)
+	{
+		benchmarkAssetLoading();
+		return;
+	}
+
+	if (!mSettings.assetArchive.empty())
+	{
+		mAssetArchive.reset(new assets::ArchiveReader(mSettings.assetArchive));
+		std::cout << "Loading assets from archive " << mSettings.assetArchive << " (" << mAssetArchive->entries().size() << " entries)." << std::endl;
+	}
+
 	initWindow();
 	initVulkan();
-	mainLoop();
+
+	if (mSettings.benchmarkRecording)
+	{
+		benchmarkCommandRecording();
+	}
+	else if (mSettings.benchmarkLatency)
+	{
+		benchmarkLatencyProfiles();
+	}
+	else if (mSettings.benchmarkUploads)
+	{
+		benchmarkUploadPaths();
+	}
+	else if (mSettings.benchmarkPrepass)
+	{
+		benchmarkDepthPrepass();
+	}
+	else
+	{
+		mainLoop();
+	}
 }
 
 ~BasicApp()
@@ -151,6 +381,8 @@ private:
 		
 		glfwSetWindowUserPointer(mWindow, this);
 		glfwSetWindowSizeCallback(mWindow, BasicApp::resize);
+		glfwSetWindowRefreshCallback(mWindow, BasicApp::refresh);
+		glfwSetKeyCallback(mWindow, BasicApp::keyboard);
 	}
 
 	static void resize(GLFWwindow* window, int width, int height)
@@ -163,71 +395,411 @@ private:
 		
 		*/
 
-		if (width == 0 || height == 0) return;
+		/*
+
+		A window that is being dragged to a new size produces a burst of size events, often several per
+		frame. Rebuilding the swap chain for each of them would throw away most of the work, so the callback
+		only records the latest size. The swap chain is recreated at most once per frame, at the start of
+		the next one (see renderFrame).
+
+		*/
+
+		BasicApp* app = reinterpret_cast<BasicApp*>(glfwGetWindowUserPointer(window));
+		app->mWindowWidth = width;
+		app->mWindowHeight = height;
+		app->mResizePending = true;
+		app->mResizeStats.events++;
+		app->mLastResizeEvent = std::chrono::high_resolution_clock::now();
+	}
+
+	static void refresh(GLFWwindow* window)
+	{
+		/*
+
+		On some platforms (notably Windows), glfwPollEvents doesn't return while the user drags the window
+		border, so the main loop stops. The window still asks to be redrawn during the drag, though, and
+		this happens in between frames, so we can render a frame from here.
+
+		*/
+
+		BasicApp* app = reinterpret_cast<BasicApp*>(glfwGetWindowUserPointer(window));
+		app->renderFrame();
+	}
+
+	static void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
+	{
+		// P toggles the depth prepass, which takes effect at the start of the next frame (see renderFrame)
 		BasicApp* app = reinterpret_cast<BasicApp*>(glfwGetWindowUserPointer(window));
-		app->recreateSwapChain();
+		if (key == GLFW_KEY_P && action == GLFW_PRESS && app->depthPrepassSupported())
+		{
+			app->mDepthPrepassRequested = !app->mDepthPrepassRequested;
+		}
 	}
 
 	void initVulkan()
 	{
-		createInstance();
-		setupDebugCallback();
-		createSurface();
-		pickPhysicalDevice();
-		createLogicalDevice();
-		createSwapChain();
-		createImageViews();
-		createRenderPass();
-		createDescriptorSetLayout();
-		createGraphicsPipeline();
-		createCommandPool();
-		createDepthResource();
-		createFramebuffers();
-		createTextureImage();
-		createTextureImageView();
-		createTextureSampler();
-		loadModel();
-		createVertexBuffer();
-		createIndexBuffer();
-		createUniformBuffer();
-		createDescriptorPool();
-		createDescriptorSet();
-		createCommandBuffers();
-		createSemaphores();
+		/*
+
+		Startup is expressed as a graph of stages: every create* function lists the stages whose results it
+		uses, and the task graph starts it as soon as those have finished. Decoding the texture and parsing
+		the model don't need any Vulkan objects, so they run right away, alongside instance and device
+		creation. Pipeline creation doesn't depend on any uploads, so it overlaps with the texture and buffer
+		uploads. Each stage is timed, and the critical path - the chain of dependent stages that the total
+		startup time can't get below - is printed at the end.
+
+		Stages that record and submit single-time commands (layout transitions and copies) can now run on
+		different threads at the same time, see beginSingleTimeCommands.
+
+		*/
+
+		using Stage = jobs::TaskGraph::StageId;
+		jobs::TaskGraph graph;
+
+		auto add = [&](const char* name, void (BasicApp::*stage)(), const std::vector<Stage>& dependencies)
+		{
+			return graph.add(name, [this, stage]() { (this->*stage)(); }, dependencies);
+		};
+
+		Stage textureDecoded = add("decodeTextureImage", &BasicApp::decodeTextureImage, {});
+		Stage modelLoaded = add("loadModel", &BasicApp::loadModel, {});
+		Stage instance = add("createInstance", &BasicApp::createInstance, {});
+		add("setupDebugCallback", &BasicApp::setupDebugCallback, { instance });
+		Stage surface = add("createSurface", &BasicApp::createSurface, { instance });
+		Stage physicalDevice = add("pickPhysicalDevice", &BasicApp::pickPhysicalDevice, { surface });
+		Stage device = add("createLogicalDevice", &BasicApp::createLogicalDevice, { physicalDevice });
+		Stage swapChain = add("createSwapChain", &BasicApp::createSwapChain, { device });
+		Stage imageViews = add("createImageViews", &BasicApp::createImageViews, { swapChain });
+		Stage renderGraph = add("createRenderGraph", &BasicApp::createRenderGraph, { imageViews });
+		Stage descriptorSetLayout = add("createDescriptorSetLayout", &BasicApp::createDescriptorSetLayout, { device });
+		Stage pipeline = add("createGraphicsPipeline", &BasicApp::createGraphicsPipeline, { renderGraph, descriptorSetLayout });
+		Stage commandPool = add("createCommandPool", &BasicApp::createCommandPool, { device });
+		Stage stagingRing = add("createStagingRing", &BasicApp::createStagingRing, { device });
+		Stage texture = add("createTextureImage", &BasicApp::createTextureImage, { textureDecoded, commandPool, stagingRing });
+		Stage textureView = add("createTextureImageView", &BasicApp::createTextureImageView, { texture });
+		Stage sampler = add("createTextureSampler", &BasicApp::createTextureSampler, { device });
+		Stage vertexBuffer = add("createVertexBuffer", &BasicApp::createVertexBuffer, { modelLoaded, commandPool, stagingRing });
+		Stage indexBuffer = add("createIndexBuffer", &BasicApp::createIndexBuffer, { modelLoaded, commandPool, stagingRing });
+		Stage positionBuffer = add("createPositionBuffer", &BasicApp::createPositionBuffer, { modelLoaded, commandPool, stagingRing });
+		Stage uniformBuffer = add("createUniformBuffer", &BasicApp::createUniformBuffer, { device });
+		Stage materialBuffer = add("createMaterialBuffer", &BasicApp::createMaterialBuffer, { commandPool, stagingRing });
+		Stage descriptorPool = add("createDescriptorPool", &BasicApp::createDescriptorPool, { device });
+		Stage descriptorSet = add("createDescriptorSet", &BasicApp::createDescriptorSet, { descriptorPool, descriptorSetLayout, uniformBuffer, materialBuffer, textureView, sampler });
+		add("createCommandBuffers", &BasicApp::createCommandBuffers, { renderGraph, pipeline, descriptorSet, vertexBuffer, indexBuffer, positionBuffer });
+		add("createSemaphores", &BasicApp::createSemaphores, { device });
+
+		graph.run(mJobs);
+
+		std::cout << "Startup breakdown (" << mJobs.threadCount() << " job system threads):" << std::endl;
+		graph.report(std::cout);
+		mStagingRing.report(std::cout);
+		vk::hostAllocator().report(std::cout);
+		mRenderGraph.report(std::cout);
+		mResidency.report(std::cout);
+
+		vk::BarrierStats startupBarriers = mBarrierCounters.collect();
+		std::cout << "Startup recorded " << startupBarriers.imageBarriers + startupBarriers.bufferBarriers << " barriers in " << startupBarriers.batches
+			<< " vkCmdPipelineBarrier calls, with " << startupBarriers.submissions << " submissions." << std::endl;
+
+		// from here on, only the main thread allocates device memory, so allocations may evict textures (see allocateMemory)
+		mEvictionAllowed = true;
 	}
 
 	void mainLoop()
 	{
 		while (!glfwWindowShouldClose(mWindow))
 		{
-			glfwPollEvents();
+			// there is nothing to draw into while the window is minimized, so sleep until something happens
+			if (mWindowWidth == 0 || mWindowHeight == 0)
+			{
+				glfwWaitEvents();
+			}
+			else
+			{
+				glfwPollEvents();
+			}
 
-			updateUniformBuffer();
-			drawFrame();
+			renderFrame();
 		}
 
 		// all operations in drawFrame are asynchronous, so we need to wait for the logical device to finish operations before cleaning up resources 
 		vkDeviceWaitIdle(mDevice);
+
+		std::cout << "Resizing: " << mResizeStats.events << " size events handled with " << mResizeStats.recreations << " swap chain recreations, worst frame time while resizing " 
+			<< mResizeStats.worstFrameMs << " ms (worst recreation " << mResizeStats.worstRecreationMs << " ms)." << std::endl;
+
+		std::cout << "Frame pacing:" << std::endl;
+		reportLatency();
+
+		reportDescriptorAllocators();
+
+		mPipelineRegistry.waitForPrepared();
+		mPipelineRegistry.report(std::cout);
+		vk::hostAllocator().report(std::cout);
+		mRenderGraph.report(std::cout);
+		mResidency.report(std::cout);
+		mBarrierCounters.report(std::cout);
+		mQueries.report(std::cout, uint64_t(mSwapChainExtent.width) * mSwapChainExtent.height);
+	}
+
+	//! print how many descriptor sets and pools the allocators have created
+	void reportDescriptorAllocators()
+	{
+		auto report = [](const char* name, const vk::DescriptorAllocator& allocator)
+		{
+			const vk::DescriptorAllocatorStats& stats = allocator.stats();
+			std::cout << "\t" << name << ": " << stats.allocations << " sets allocated from " << stats.poolsCreated << " pools (largest holds "
+				<< stats.largestPoolSets << " sets), " << stats.poolResets << " pool resets" << std::endl;
+		};
+
+		std::cout << "Descriptors:" << std::endl;
+		report("persistent", mDescriptorAllocator);
+		std::cout << "\tset cache: " << mDescriptorSetCache.hits() << " hits, " << mDescriptorSetCache.misses() << " misses" << std::endl;
+		std::cout << "\tlayout cache: " << mDescriptorSetLayoutCache.hits() << " hits, " << mDescriptorSetLayoutCache.misses() << " misses" << std::endl;
+	}
+
+	//! select the present mode, swap chain image count, frames in flight and frame limit of a latency profile (the swap chain has to be recreated for it to take effect)
+	void applyLatencyProfile(LatencyProfile profile)
+	{
+		mLatencyPolicy = LatencyPolicy::get(profile);
+		mFrameLimit = mSettings.frameLimit >= 0.0 ? mSettings.frameLimit : mLatencyPolicy.defaultFrameLimit;
+		mPresentIntervals.reset();
+		mQueueLatencies.reset();
+		mLastPresent = {};
+		mNextFrameDeadline = {};
+	}
+
+	//! print the present-to-present intervals and the time that submitted frames spent on the GPU queue
+	void reportLatency()
+	{
+		double fps = mPresentIntervals.mean() > 0.0 ? 1000.0 / mPresentIntervals.mean() : 0.0;
+
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << "\t" << std::left << std::setw(18) << mLatencyPolicy.name << std::right
+			<< " present interval " << mPresentIntervals.mean() << " ms (" << mPresentIntervals.min() << " - " << mPresentIntervals.max() << " ms, " << fps << " fps)"
+			<< ", queue latency " << mQueueLatencies.mean() << " ms (worst " << mQueueLatencies.max() << " ms)"
+			<< ", " << mSwapChainImages.size() << " images, " << mLatencyPolicy.framesInFlight << " frame(s) in flight";
+		if (mFrameLimit > 0.0)
+		{
+			std::cout << ", limited to " << mFrameLimit << " fps";
+		}
+		std::cout << std::endl;
+		std::cout.unsetf(std::ios_base::floatfield);
+	}
+
+	//! run every latency profile for a fixed number of frames and compare their frame pacing
+	void benchmarkLatencyProfiles()
+	{
+		/*
+
+		The queue latency is measured from the submission of a frame until the CPU notices that its fence
+		is signaled, so it's an upper bound of the time the frame spent waiting for and executing on the
+		GPU. Added to the present interval times the number of queued swap chain images, it gives a rough
+		idea of how long it takes for the result of an input to show up on the screen.
+
+		*/
+
+		const uint32_t frames = 300;
+		const LatencyProfile profiles[] = { LatencyProfile::LowestLatency, LatencyProfile::VsyncThroughput, LatencyProfile::PowerSaving };
+
+		std::cout << "Frame pacing over " << frames << " frames per latency profile:" << std::endl;
+
+		for (LatencyProfile profile : profiles)
+		{
+			applyLatencyProfile(profile);
+			recreateSwapChain();
+			createSemaphores();
+
+			for (uint32_t i = 0; i < frames && !glfwWindowShouldClose(mWindow); ++i)
+			{
+				glfwPollEvents();
+				renderFrame();
+			}
+
+			vkDeviceWaitIdle(mDevice);
+			collectCompletedFrames();
+			reportLatency();
+		}
+	}
+
+	//! render the same scenes with and without the depth prepass and compare their frame pacing
+	void benchmarkDepthPrepass()
+	{
+		/*
+
+		The scenes differ in the number of objects, which is what makes the overdraw (and the number of
+		vertices the prepass has to transform a second time) grow. Frames are only as fast as presentation
+		allows, so the latency profile should leave the frame rate unlocked (--latency-profile lowest-latency)
+		for the numbers to mean something; the queue latency is the closer of the two to the GPU time.
+
+		*/
+
+		const uint32_t frames = 300;
+		const uint32_t objectCounts[] = { 1, 16, 256, 1024 };
+
+		std::cout << "Depth prepass over " << frames << " frames per scene:" << std::endl;
+
+		uint32_t objectCount = mSettings.objectCount;
+		for (uint32_t objects : objectCounts)
+		{
+			mSettings.objectCount = objects;
+			for (bool prepass : { false, true })
+			{
+				if (prepass && !depthPrepassSupported())
+				{
+					continue;
+				}
+				setDepthPrepass(prepass);
+				applyLatencyProfile(mSettings.latencyProfile);
+				mQueries.reset();
+
+				for (uint32_t i = 0; i < frames && !glfwWindowShouldClose(mWindow); ++i)
+				{
+					glfwPollEvents();
+					renderFrame();
+				}
+
+				vkDeviceWaitIdle(mDevice);
+				collectCompletedFrames();
+				std::cout << "\t" << objects << " objects, " << (prepass ? "with" : "without") << " prepass:" << std::endl;
+				reportLatency();
+				mQueries.report(std::cout, uint64_t(mSwapChainExtent.width) * mSwapChainExtent.height);
+			}
+		}
+
+		mSettings.objectCount = objectCount;
+	}
+
+	//! the frame boundary: apply a pending resize, then update and draw the next frame
+	void renderFrame()
+	{
+		if (mWindowWidth == 0 || mWindowHeight == 0)
+		{
+			return;
+		}
+
+		if (mResizePending)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			mResizePending = false;
+			recreateSwapChain();
+
+			double recreationMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			mResizeStats.recreations++;
+			mResizeStats.worstRecreationMs = std::max(mResizeStats.worstRecreationMs, recreationMs);
+		}
+
+		if (mDepthPrepassRequested != mDepthPrepass)
+		{
+			setDepthPrepass(mDepthPrepassRequested);
+		}
+
+		updateLodSelection();
+		updateResidency();
+		drawFrame();
+		mBarrierCounters.endFrame();
+		limitFrameRate();
+
+		// frames that end shortly after a size event are considered part of the resize
+		auto now = std::chrono::high_resolution_clock::now();
+		if (mResizeStats.events > 0 && now - mLastResizeEvent < std::chrono::milliseconds(500))
+		{
+			double frameMs = std::chrono::duration<double, std::milli>(now - mLastFrameEnd).count();
+			mResizeStats.worstFrameMs = std::max(mResizeStats.worstFrameMs, frameMs);
+		}
+		mLastFrameEnd = now;
+	}
+
+	//! keep the CPU from starting the next frame before the frame limit allows it
+	void limitFrameRate()
+	{
+		if (mFrameLimit <= 0.0)
+		{
+			return;
+		}
+
+		/*
+
+		Sleeping is cheap but imprecise (the scheduler may wake us up a millisecond or more too late), so
+		we sleep until shortly before the deadline and spin for the rest. If the frame took longer than
+		its budget, the deadline starts over from now instead of trying to catch up with a burst of frames.
+
+		*/
+
+		auto now = std::chrono::high_resolution_clock::now();
+		auto budget = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(1.0 / mFrameLimit));
+
+		if (mNextFrameDeadline <= now)
+		{
+			mNextFrameDeadline = now + budget;
+			return;
+		}
+
+		const auto spinTime = std::chrono::milliseconds(2);
+		if (mNextFrameDeadline - now > spinTime)
+		{
+			std::this_thread::sleep_for(mNextFrameDeadline - now - spinTime);
+		}
+		while (std::chrono::high_resolution_clock::now() < mNextFrameDeadline)
+		{
+			std::this_thread::yield();
+		}
+
+		mNextFrameDeadline += budget;
 	}
 
-	void updateUniformBuffer()
+	//! write the per-frame uniforms into the copy that belongs to the given swap chain image
+	void updateUniformBuffer(uint32_t imageIndex)
 	{
+		/*
+
+		The uniform buffer is host visible and stays mapped, so updating it is a plain memcpy instead of a
+		staging copy that has to wait for the queue. The copy that the acquired image's command buffers read
+		from may still be in use by the last frame that rendered to an image with the same index (possibly
+		of an older swap chain), so we wait for that frame first. With the latency profile's limit on frames
+		in flight, it has almost always completed already.
+
+		*/
+
 		static auto startTime = std::chrono::high_resolution_clock::now();
 		auto currentTime = std::chrono::high_resolution_clock::now();
 		float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
 
 		UniformBufferObject ubo = {};
-		ubo.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.projection = glm::perspective(glm::radians(45.0f), mSwapChainExtent.width / static_cast<float>(mSwapChainExtent.height), 0.1f, 10.0f);
+		ubo.world = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		ubo.view = glm::lookAt(mEyePosition, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		ubo.projection = glm::perspective(mFieldOfView, mSwapChainExtent.width / static_cast<float>(mSwapChainExtent.height), 0.1f, 10.0f);
 		ubo.projection[1][1] *= -1;
 
-		void* data;
-		vkMapMemory(mDevice, mUniformStagingBufferMemory, 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(mDevice, mUniformStagingBufferMemory);
+		waitForFrame(mUniformRegionFrames[imageIndex]);
+		memcpy(mUniformData + imageIndex * mUniformRegionSize, &ubo, sizeof(ubo));
+		mUniformRegionFrames[imageIndex] = mSubmittedFrame + 1;
+	}
+
+	//! choose the level of detail for the model based on how large its simplification error would appear on screen
+	void updateLodSelection()
+	{
+		/*
+
+		The model rotates around the origin, so its bounding sphere is centered there. The closest point of
+		the sphere gives the most conservative distance, which we use to project each level's error into
+		pixels. The command buffers reference a single index range, so they are re-recorded whenever the
+		selected level changes.
+
+		*/
+
+		float distance = glm::length(mEyePosition) - mModelBoundingRadius;
+		float projectionScale = mSwapChainExtent.height / (2.0f * std::tan(mFieldOfView * 0.5f));
+
+		size_t lod = mesh::selectLod(mModelLods, distance, projectionScale, LOD_PIXEL_THRESHOLD);
+		if (lod != mCurrentLod)
+		{
+			std::cout << "Switching model from LOD " << mCurrentLod << " to LOD " << lod << " (" << mModelLods[lod].indexCount / 3 << " triangles)." << std::endl;
 
-		copyBuffer(mUniformStagingBuffer, mUniformBuffer, sizeof(ubo));
+			mCurrentLod = lod;
+
+			// the pre-recorded command buffers may still be executing, but createCommandBuffers retires them instead of freeing them
+			createCommandBuffers();
+		}
 	}
 
 	//! a struct for determining which queue families a physical device supports
@@ -313,12 +885,12 @@ private:
 		in Vulkan follow is:
 
 			1. Pointer to struct with creation info
-			2. Pointer to custom allocator callbacks (always nullptr in this application)
+			2. Pointer to custom allocator callbacks (vk::allocationCallbacks(), see host_allocator.h)
 			3. Pointer to the variable that stores the handle to the new object
 
 		*/
 
-		if(vkCreateInstance(&createInfo, nullptr, &mInstance) != VK_SUCCESS) // returns a VkResult
+		if(vkCreateInstance(&createInfo, vk::allocationCallbacks(), mInstance.replace()) != VK_SUCCESS) // returns a VkResult
 		{
 			throw std::runtime_error("Failed to create VkInstance.");
 		}
@@ -391,6 +963,18 @@ private:
 			extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 		}
 
+#ifdef VK_EXT_descriptor_indexing
+		// querying descriptor indexing support on a Vulkan 1.0 instance goes through vkGetPhysicalDeviceFeatures2KHR (see chooseTextureSlots)
+		for (const auto& extension : getAvailableExtensions())
+		{
+			if (std::strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+			{
+				extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+				mPhysicalDeviceProperties2 = true;
+			}
+		}
+#endif
+
 		return extensions;
 	}
 
@@ -444,7 +1028,7 @@ private:
 		createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
 		createInfo.pfnCallback = (PFN_vkDebugReportCallbackEXT)sDebugCallback;
 
-		if (CreateDebugReportCallbackEXT(mInstance, &createInfo, nullptr, &mCallback) != VK_SUCCESS) 
+		if (CreateDebugReportCallbackEXT(mInstance, &createInfo, vk::allocationCallbacks(), mCallback.replace(mInstance)) != VK_SUCCESS) 
 		{
 			throw std::runtime_error("Failed to setup debug callback.");
 		}
@@ -471,7 +1055,7 @@ private:
 	}
 
 	//! explicitly loads a function from a Vulkan extension for destroying a VkDebugReportCallbackEXT object
-	static void DestroyDebugReportCallbackEXT(
+	static void VKAPI_CALL DestroyDebugReportCallbackEXT(
 		VkInstance instance,
 		VkDebugReportCallbackEXT callback,
 		const VkAllocationCallbacks* pAllocator
@@ -511,7 +1095,7 @@ private:
 		
 		*/
 		
-		if (glfwCreateWindowSurface(mInstance, mWindow, nullptr, &mSurface) != VK_SUCCESS)
+		if (glfwCreateWindowSurface(mInstance, mWindow, vk::allocationCallbacks(), mSurface.replace(mInstance)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create window surface.");
 		}
@@ -562,42 +1146,136 @@ private:
 		VkPhysicalDeviceProperties deviceProperties;
 		vkGetPhysicalDeviceProperties(mPhysicalDevice, &deviceProperties);
 		std::cout << "Sucessfully selected physical device: " << deviceProperties.deviceName << std::endl;
+
+		chooseTextureSlots();
 	}
 
-	//! check if the specified physical device supports all of the requested extensions
-	bool checkDeviceExtensionSupport(VkPhysicalDevice device)
+	//! decide how many textures the descriptor set can hold, and whether they can be bound bindlessly
+	void chooseTextureSlots()
 	{
 		/*
 
-		In Vulkan the swap chain is the infrastructure that gives you images to render to that can be
-		presented to the screen afterwards. It is essentially a queue of images that are waiting to
-		be presented to the screen. Our application will acquire an image to draw to and then return
-		it to the queue. The general purpose of the swap chain is to synchronize the presentation of
-		images with the refresh rate of the screen.
+		All textures live in a single array of combined image samplers, and each material stores an index
+		into it, so drawing with a different texture only takes a different push constant instead of
+		another descriptor set. 
 
-		Not all graphics cards are capable of presenting images directly to a screen for various reasons
-		(i.e. a GPU that is designed for servers that don't have any display outputs). Since image
-		presentation is heavily tied into the window system and the surfaces associated with windows,
-		it is not actually part of the Vulkan core. This functionality exists as part of the VK_KHR_swapchain
-		device extension.
+		Without VK_EXT_descriptor_indexing, every element of the array has to contain a valid descriptor
+		before the set is used and the array is limited by maxPerStageDescriptorSamplers, so we settle for
+		a fixed number of slots and fill the unused ones with the first texture. With the extension, the
+		array may be partially bound and updated while the set is in use (update after bind), which raises
+		the limits considerably: thousands of textures can be added as they're loaded.
 
 		*/
 
-		uint32_t extensionCount;
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		const uint32_t fallbackSlots = 64;
 
-		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
 
-		std::set<std::string> requiredExtensions(mDeviceExtensions.begin(), mDeviceExtensions.end());
+		mBindlessTextures = false;
+		mTextureSlotCount = std::min({ fallbackSlots, properties.limits.maxPerStageDescriptorSamplers, properties.limits.maxPerStageDescriptorSampledImages });
 
-		std::cout << "Available extensions: " << std::endl;
-		for (const auto& extension : availableExtensions)
+#ifdef VK_EXT_descriptor_indexing
+		const uint32_t bindlessSlots = 4096;
+
+		if (mPhysicalDeviceProperties2 &&
+			isDeviceExtensionAvailable(mPhysicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+			isDeviceExtensionAvailable(mPhysicalDevice, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
 		{
-			std::cout << "\t" << extension.extensionName << std::endl;
+			auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(mInstance, "vkGetPhysicalDeviceFeatures2KHR");
+			auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(mInstance, "vkGetPhysicalDeviceProperties2KHR");
+
+			VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+			indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+			VkPhysicalDeviceFeatures2KHR features = {};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features.pNext = &indexingFeatures;
+
+			VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+			indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+			VkPhysicalDeviceProperties2KHR properties2 = {};
+			properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+			properties2.pNext = &indexingProperties;
+
+			if (getFeatures2 && getProperties2)
+			{
+				getFeatures2(mPhysicalDevice, &features);
+				getProperties2(mPhysicalDevice, &properties2);
 
-			// check off (erase) each extension that we know is available
-			requiredExtensions.erase(extension.extensionName);
+				if (indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind)
+				{
+					mBindlessTextures = true;
+					mTextureSlotCount = std::min({ bindlessSlots,
+						indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+						indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+						indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+						indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
+				}
+			}
+		}
+#endif
+
+		if (mTextureSlotCount < TEXTURE_PATHS.size())
+		{
+			throw std::runtime_error("The device can't bind as many textures as the scene uses.");
+		}
+
+		std::cout << "Using " << mTextureSlotCount << (mBindlessTextures ? " bindless" : " fixed") << " texture slots." << std::endl;
+	}
+
+	//! check if a single device extension is supported, without printing the whole list like checkDeviceExtensionSupport
+	bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* name)
+	{
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+		for (const auto& extension : availableExtensions)
+		{
+			if (std::strcmp(extension.extensionName, name) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//! check if the specified physical device supports all of the requested extensions
+	bool checkDeviceExtensionSupport(VkPhysicalDevice device)
+	{
+		/*
+
+		In Vulkan the swap chain is the infrastructure that gives you images to render to that can be
+		presented to the screen afterwards. It is essentially a queue of images that are waiting to
+		be presented to the screen. Our application will acquire an image to draw to and then return
+		it to the queue. The general purpose of the swap chain is to synchronize the presentation of
+		images with the refresh rate of the screen.
+
+		Not all graphics cards are capable of presenting images directly to a screen for various reasons
+		(i.e. a GPU that is designed for servers that don't have any display outputs). Since image
+		presentation is heavily tied into the window system and the surfaces associated with windows,
+		it is not actually part of the Vulkan core. This functionality exists as part of the VK_KHR_swapchain
+		device extension.
+
+		*/
+
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+		std::set<std::string> requiredExtensions(mDeviceExtensions.begin(), mDeviceExtensions.end());
+
+		std::cout << "Available extensions: " << std::endl;
+		for (const auto& extension : availableExtensions)
+		{
+			std::cout << "\t" << extension.extensionName << std::endl;
+
+			// check off (erase) each extension that we know is available
+			requiredExtensions.erase(extension.extensionName);
 		}
 
 		// if requiredExtensions is empty, that means we have support for all of the requested extensions
@@ -648,7 +1326,12 @@ private:
 			swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 		}
 
-		return indices.isComplete() && extensionsSupported && swapChainAdequate;
+		// the fragment shader indexes the texture array with the material's texture index
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+		bool textureArraysIndexable = supportedFeatures.shaderSampledImageArrayDynamicIndexing == VK_TRUE;
+
+		return indices.isComplete() && extensionsSupported && swapChainAdequate && textureArraysIndexable;
 	}
 
 	//! determine which queue families the specified physical device supports
@@ -757,6 +1440,19 @@ private:
 		}
 
 		VkPhysicalDeviceFeatures deviceFeatures = {};
+		deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;	// checked in isDeviceSuitable
+
+		// the queries that measure each pass are active while the secondary command buffers execute, which needs inheritedQueries
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+		bool queries = mSettings.queryStatistics && supportedFeatures.inheritedQueries == VK_TRUE;
+		deviceFeatures.inheritedQueries = queries;
+		deviceFeatures.pipelineStatisticsQuery = queries && supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+		deviceFeatures.occlusionQueryPrecise = queries && supportedFeatures.occlusionQueryPrecise == VK_TRUE;
+		if (mSettings.queryStatistics && !queries)
+		{
+			std::cout << "The device doesn't support inherited queries, so the passes aren't measured." << std::endl;
+		}
 
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -765,8 +1461,34 @@ private:
 		createInfo.pEnabledFeatures = &deviceFeatures;
 		
 		// enable the requested extensions (we check that they exist on this system in checkDeviceExtensionSupport)
-		createInfo.enabledExtensionCount = mDeviceExtensions.size();
-		createInfo.ppEnabledExtensionNames = mDeviceExtensions.data();
+		std::vector<const char*> extensions = mDeviceExtensions;
+
+#ifdef VK_EXT_descriptor_indexing
+		// only the descriptor indexing features that the texture array relies on (see chooseTextureSlots)
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+
+		if (mBindlessTextures)
+		{
+			extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+			extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+			createInfo.pNext = &indexingFeatures;
+		}
+#endif
+
+#ifdef VK_EXT_memory_budget
+		// the heap budgets are queried through vkGetPhysicalDeviceMemoryProperties2KHR (see refreshMemoryBudget)
+		mMemoryBudgetExtension = mPhysicalDeviceProperties2 && isDeviceExtensionAvailable(mPhysicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		if (mMemoryBudgetExtension)
+		{
+			extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+#endif
+
+		createInfo.enabledExtensionCount = extensions.size();
+		createInfo.ppEnabledExtensionNames = extensions.data();
 		
 		if (mEnableValidationLayers)
 		{
@@ -778,7 +1500,7 @@ private:
 			createInfo.enabledLayerCount = 0;
 		}
 
-		if (vkCreateDevice(mPhysicalDevice, &createInfo, nullptr, &mDevice) != VK_SUCCESS)
+		if (vkCreateDevice(mPhysicalDevice, &createInfo, vk::allocationCallbacks(), mDevice.replace()) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create logical device.");
 		}
@@ -787,6 +1509,14 @@ private:
 		// the index is 0 because we are only using one queue from each family
 		vkGetDeviceQueue(mDevice, indices.graphicsFamily, 0, &mGraphicsQueue);
 		vkGetDeviceQueue(mDevice, indices.presentFamily, 0, &mPresentQueue);
+
+		mPipelineRegistry.init(mDevice, &mJobs);
+		if (queries)
+		{
+			mQueries.init(mDevice, deviceFeatures.pipelineStatisticsQuery == VK_TRUE, deviceFeatures.occlusionQueryPrecise == VK_TRUE, sMaxSwapChainImages);
+		}
+		chooseUploadPath();
+		initResidency();
 	}
 
 	//! checks whether the swap chain is compatible with our window surface
@@ -907,12 +1637,13 @@ private:
 		
 		*/
 
-		for (const auto& availablePresentMode : availablePresentModes)
+		// the latency profile lists the modes it prefers, in order
+		for (VkPresentModeKHR preferredPresentMode : mLatencyPolicy.presentModes)
 		{
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+			if (std::find(availablePresentModes.begin(), availablePresentModes.end(), preferredPresentMode) != availablePresentModes.end())
 			{
-				std::cout << "Found swap chain present mode: VK_PRESENT_MODE_MAILBOX_KHR." << std::endl;
-				return availablePresentMode;
+				std::cout << "Found swap chain present mode " << preferredPresentMode << " for the " << mLatencyPolicy.name << " profile." << std::endl;
+				return preferredPresentMode;
 			}
 		}
 
@@ -942,7 +1673,7 @@ private:
 		}
 		else
 		{
-			VkExtent2D actualExtent = { mWidth, mHeight };
+			VkExtent2D actualExtent = { static_cast<uint32_t>(mWindowWidth), static_cast<uint32_t>(mWindowHeight) };
 			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
 			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
 			return actualExtent;
@@ -986,8 +1717,16 @@ private:
 		auto presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 		auto extent = chooseSwapExtent(swapChainSupport.capabilities);
 
+		/*
+
+		More images let the application render ahead of the display, which smooths out frame times but
+		adds a refresh interval of latency for each image that is waiting to be shown. The latency profile
+		decides how many images beyond the minimum we ask for.
+
+		*/
+
 		// a value of 0 for maxImageCount means that there is no limit besides memory requirements, which is why we have this check
-		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		uint32_t imageCount = std::min(swapChainSupport.capabilities.minImageCount + mLatencyPolicy.extraImages, uint32_t(sMaxSwapChainImages));
 		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
 		{
 			imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -1031,16 +1770,33 @@ private:
 
 		// create the new swap chain
 		VkSwapchainKHR newSwapChain;
-		if (vkCreateSwapchainKHR(mDevice, &createInfo, nullptr, &newSwapChain) != VK_SUCCESS)
+		if (vkCreateSwapchainKHR(mDevice, &createInfo, vk::allocationCallbacks(), &newSwapChain) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create swap chain.");
 		}
-		*&mSwapChain = newSwapChain;
+
+		/*
+
+		Passing the old swap chain as oldSwapchain retires it: no more images can be acquired from it, but
+		images that were already acquired can still be presented, and the presentation engine may still be
+		reading from them. Frames in flight may also still render into them. Fences only tell us when
+		rendering has finished, not presentation, so the old swap chain is kept alive until one more frame
+		(the first one on the new swap chain) has completed, by which point its last present has been
+		processed as well.
+
+		*/
+
+		mDeletionQueue.retire(std::move(mSwapChain), mSubmittedFrame + 1);
+		mSwapChain = vk::SwapchainKHR{ mDevice, newSwapChain };
 
 		std::cout << "Successfully created swap chain object with " << imageCount << " images." << std::endl;
 
 		// retrieve the images from the swap chain and store them as a member variable
 		vkGetSwapchainImagesKHR(mDevice, mSwapChain, &imageCount, nullptr);
+		if (imageCount > sMaxSwapChainImages)
+		{
+			throw std::runtime_error("The swap chain has more images than the uniform buffer has room for.");
+		}
 		mSwapChainImages.resize(imageCount);
 		vkGetSwapchainImagesKHR(mDevice, mSwapChain, &imageCount, mSwapChainImages.data());
 
@@ -1065,7 +1821,7 @@ private:
 		*/
 		
 		// resize the list of image views and define the deleter function
-		mSwapChainImageViews.resize(mSwapChainImages.size(), vk::Deleter<VkImageView>{ mDevice, vkDestroyImageView });
+		mSwapChainImageViews.resize(mSwapChainImages.size());
 
 		// now, iterate over all of the swap chain images
 		for (uint32_t i = 0; i < mSwapChainImages.size(); ++i)
@@ -1079,65 +1835,157 @@ private:
 	//! create a descriptor set layout to describe the types of resources that are going to be accessed by the graphics pipeline
 	void createDescriptorSetLayout()
 	{
-		// uniform buffer object
-		VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-		uboLayoutBinding.binding = 0;
-		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		uboLayoutBinding.descriptorCount = 1;
-		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;	// the shader stage(s) that will reference this descriptor (could use VK_SHADER_STAGE_ALL_GRAPHICS)
-		uboLayoutBinding.pImmutableSamplers = nullptr;				// optional
+		/*
+
+		Rather than describing every binding by hand (and keeping that description in sync with the shaders),
+		the layout is reflected from the SPIR-V of all pipeline stages: spirv::reflect lists the descriptors,
+		push constants and vertex inputs each module declares, and spirv::mergeStages combines the stages into
+		the bindings of each set and a single push constant range. A few things can't be read from the SPIR-V
+		and are applied on top:
+
+		- whether a uniform buffer is dynamic (the offset is given when binding the set), which is a property
+		  of how the application binds it rather than of the shader
+		- the value of specialization constants that size descriptor arrays (the texture array in shader.frag)
+		- the binding flags of VK_EXT_descriptor_indexing
+
+		*/
+
+		io::MappedFile vertexCode = mapFile("shaders/vert.spv");
+		io::MappedFile fragmentCode = mapFile("shaders/frag.spv");
+		spirv::ShaderReflection vertex = spirv::reflect(vertexCode.data(), vertexCode.size());
+		spirv::ShaderReflection fragment = spirv::reflect(fragmentCode.data(), fragmentCode.size());
+		spirv::PipelineReflection pipeline = spirv::mergeStages({ vertex, fragment });
+
+		validateVertexInputs(vertex);
+
+		if (pipeline.sets.size() != 1 || pipeline.sets.begin()->first != 0)
+		{
+			throw std::runtime_error("The shaders are expected to use descriptor set 0 only.");
+		}
+
+		vk::DescriptorSetLayoutDesc desc;
+
+		for (const spirv::Binding& binding : pipeline.sets.begin()->second)
+		{
+			VkDescriptorSetLayoutBinding layoutBinding = {};
+			layoutBinding.binding = binding.binding;
+			layoutBinding.descriptorType = binding.type;
+			layoutBinding.descriptorCount = binding.count;
+			layoutBinding.stageFlags = binding.stages;	// the shader stage(s) that reference this descriptor
+			layoutBinding.pImmutableSamplers = nullptr;
+
+			VkFlags bindingFlags = 0;
+
+			// uniform buffer object: the offset into the buffer is given when the set is bound (see updateUniformBuffer)
+			if (binding.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			{
+				layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			}
+
+			// an array of combined image samplers that holds every texture (see chooseTextureSlots)
+			if (binding.countSpecId == 0)
+			{
+				layoutBinding.descriptorCount = mTextureSlotCount;
+
+#ifdef VK_EXT_descriptor_indexing
+				// the texture array doesn't have to be filled completely, and may be written to while the set is in use
+				if (mBindlessTextures)
+				{
+					bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+				}
+#endif
+			}
+			else if (binding.countSpecId != spirv::Binding::sNoSpecId || binding.count == 0)
+			{
+				throw std::runtime_error("Binding " + binding.name + " has a size that the application doesn't know how to choose.");
+			}
+
+			desc.bindings.push_back(layoutBinding);
+			desc.bindingFlags.push_back(bindingFlags);
+		}
+
+#ifdef VK_EXT_descriptor_indexing
+		if (mBindlessTextures)
+		{
+			desc.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		}
+		else
+#endif
+		{
+			desc.bindingFlags.clear();
+		}
+
+		// the per-draw data in DrawConstants has to cover every push constant the shaders read
+		if (pipeline.pushConstants.offset + pipeline.pushConstants.size > sizeof(DrawConstants))
+		{
+			throw std::runtime_error("The shaders declare more push constants than DrawConstants holds.");
+		}
 
-		// combined image sampler object
-		VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-		samplerLayoutBinding.binding = 1;
-		samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		samplerLayoutBinding.descriptorCount = 1;
-		samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-		samplerLayoutBinding.pImmutableSamplers = nullptr;
+		mPushConstantRange = pipeline.pushConstants;
+		mDescriptorSetLayout = mDescriptorSetLayoutCache.get(mDevice, desc);
 
-		// both bindings
-		std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
+		std::cout << "Reflected " << desc.bindings.size() << " descriptor bindings and " << mPushConstantRange.size << " bytes of push constants from the shaders." << std::endl;
+	}
 
-		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutInfo.bindingCount = bindings.size();
-		layoutInfo.pBindings = bindings.data();
+	//! check that the vertex shader's inputs match the attributes that Vertex provides
+	void validateVertexInputs(const spirv::ShaderReflection& vertex)
+	{
+		auto attributeDescriptions = Vertex::getAttributeDescriptions();
 
-		if (vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mDescriptorSetLayout) != VK_SUCCESS)
+		for (const spirv::VertexInput& input : vertex.inputs)
 		{
-			throw std::runtime_error("Failed to create descriptor set layout object.");
+			auto attribute = std::find_if(attributeDescriptions.begin(), attributeDescriptions.end(), [&](const VkVertexInputAttributeDescription& description)
+			{
+				return description.location == input.location;
+			});
+
+			if (attribute == attributeDescriptions.end())
+			{
+				throw std::runtime_error("The vertex shader input " + input.name + " (location " + std::to_string(input.location) + ") isn't provided by Vertex.");
+			}
+			if (attribute->format != input.format)
+			{
+				throw std::runtime_error("The vertex shader input " + input.name + " (location " + std::to_string(input.location) + ") doesn't match the format of its Vertex attribute.");
+			}
 		}
 	}
 
-	//! create a descriptor pool, from which we can allocate descriptor sets
+	//! set up the descriptor allocator, which creates descriptor pools as they are needed
 	void createDescriptorPool()
 	{
 		/*
 
 		Descriptor sets can't be created directly, they must be allocated from a pool like command
-		buffers. A descriptor set specifies a VkBuffer resource to bind to the uniform buffer
-		descriptor.
-
-		*/
+		buffers. Instead of a single pool that is sized for exactly the sets we know about, descriptor
+		sets come from a vk::DescriptorAllocator, which creates (ever larger) pools whenever it runs out.
+		A pool is sized for a number of sets that each look like the one described here.
 
-		std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;			// ubo
-		poolSizes[0].descriptorCount = 1;
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;	// sampler
-		poolSizes[1].descriptorCount = 1;
+		The allocator backs the descriptor set cache and is never reset. Sets that are only used by a single
+		frame would come from an allocator of their own, retired with the frame and collected once it has
+		completed (see vk::DescriptorAllocator::retire), but nothing is allocated per frame yet.
 
-		VkDescriptorPoolCreateInfo poolInfo = {};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = poolSizes.size();
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = 1;
+		*/
 
-		if (vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+		std::vector<VkDescriptorPoolSize> setSizes(3);
+		setSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;	// ubo
+		setSizes[0].descriptorCount = 1;
+		setSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;	// texture array
+		setSizes[1].descriptorCount = mTextureSlotCount;
+		setSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;			// material table
+		setSizes[2].descriptorCount = 1;
+
+		VkDescriptorPoolCreateFlags flags = 0;
+#ifdef VK_EXT_descriptor_indexing
+		if (mBindlessTextures)
 		{
-			throw std::runtime_error("Failed to create descriptor pool.");
+			flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
 		}
+#endif
 
-		std::cout << "Successfully created descriptor pool object." << std::endl;
+		// sets with the texture array are large, so their pools start small
+		mDescriptorAllocator.init(mDevice, setSizes, 1, 64, flags);
+
+		std::cout << "Successfully set up the descriptor allocator." << std::endl;
 	}
 
 	//! create a descriptor set 
@@ -1155,59 +2003,43 @@ private:
 		set layout and the sequence of set layouts that can be used by resource variables in shaders
 		within a pipeline is specified in a pipeline layout.
 
+		The set is looked up in the descriptor set cache by its layout and bindings: asking for the same
+		resources again returns the same set, and only a new combination allocates and writes another one.
+
 		*/
 
-		VkDescriptorSetLayout layouts[] = { mDescriptorSetLayout };
-		VkDescriptorSetAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = mDescriptorPool;
-		allocInfo.descriptorSetCount = 1;
-		allocInfo.pSetLayouts = layouts;
+		// configure the descriptor for the ubo: the range covers a single copy, and the dynamic offset picks which one
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = mUniformBuffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = sizeof(UniformBufferObject);
 
-		if (vkAllocateDescriptorSets(mDevice, &allocInfo, &mDescriptorSet) != VK_SUCCESS)
+		// configure the descriptors for the texture array: without partially bound descriptors, the unused slots repeat the first texture,
+		// and so do the slots of textures that aren't resident (see updateResidency)
+		size_t writtenSlots = mBindlessTextures ? mTextures.size() : mTextureSlotCount;
+		std::vector<VkDescriptorImageInfo> imageInfos(writtenSlots);
+		for (size_t i = 0; i < writtenSlots; ++i)
 		{
-			throw std::runtime_error("Failed to allocated descriptor set.");
+			imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfos[i].imageView = mTextures[i < mTextures.size() && mTextures[i].resident ? i : 0].view;
+			imageInfos[i].sampler = mTextureSampler;
 		}
 
-		std::cout << "Successfully allocated descriptor set." << std::endl;
+		// configure the descriptor for the material table
+		VkDescriptorBufferInfo materialInfo = {};
+		materialInfo.buffer = mMaterialBuffer;
+		materialInfo.offset = 0;
+		materialInfo.range = VK_WHOLE_SIZE;
 
-		// configure the descriptor for the ubo
-		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = mUniformBuffer;
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
+		std::vector<vk::DescriptorBinding> bindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, { bufferInfo }, {} },
+			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, {}, imageInfos },
+			{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, { materialInfo }, {} }
+		};
+
+		mDescriptorSet = mDescriptorSetCache.get(mDevice, mDescriptorSetLayout, bindings);
 
-		// configure the descriptor for the sampler
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = mTextureImageView;
-		imageInfo.sampler = mTextureSampler;
-
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-
-		// ubo
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = mDescriptorSet;
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
-		descriptorWrites[0].pImageInfo = nullptr;		// optional
-		descriptorWrites[0].pTexelBufferView = nullptr;	// optional
-
-		// sampler
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = mDescriptorSet;
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pBufferInfo = nullptr;
-		descriptorWrites[1].pImageInfo = &imageInfo;	// optional
-		descriptorWrites[1].pTexelBufferView = nullptr;	// optional
-
-		vkUpdateDescriptorSets(mDevice, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+		std::cout << "Successfully allocated descriptor set." << std::endl;
 	}
 
 	//! sets up a rendering pipeline by creating shader modules and specifying viewport, scissor, blend, rasterizer, and multisampling settings
@@ -1249,192 +2081,144 @@ private:
 		contains the global color blending settings. In our case, we only have one framebuffer.
 
 		You can use uniform values in shaders, but they need to be specified during pipeline creation by creating a
-		VkPipelineLayout object. Even though we won't be using one for now, we will still create an empty object
-		for demonstration purposes.
-
-		*/
-
-		auto vertShaderCode = readFile("shaders/vert.spv");
-		auto fragShaderCode = readFile("shaders/frag.spv");
+		VkPipelineLayout object.
 
-		vk::Deleter<VkShaderModule> vertShaderModule{ mDevice, vkDestroyShaderModule };
-		vk::Deleter<VkShaderModule> fragShaderModule{ mDevice, vkDestroyShaderModule };
+		All of this state is described by a vk::PipelineKey (see pipelineKey), and the pipeline itself comes from
+		the pipeline registry, which creates every distinct key only once. Variants of the pipeline only differ
+		in a few fields of the key, i.e. the specialization constants that turn on alpha testing in shader.frag.
 
-		createShaderModule(vertShaderCode, vertShaderModule);
-		createShaderModule(fragShaderCode, fragShaderModule);
+		*/
 
-		VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfo.module = vertShaderModule;
-		vertShaderStageInfo.pName = "main"; // the function to invoke (main is standard)
+		// the shader modules are shared by every variant, and kept around since variants are created lazily
+		if (mVertShaderModule.get() == VK_NULL_HANDLE)
+		{
+			createShaderModule(mapFile("shaders/vert.spv").span(), mVertShaderModule);
+			createShaderModule(mapFile("shaders/frag.spv").span(), mFragShaderModule);
+		}
 
-		VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfo.module = fragShaderModule;
-		fragShaderStageInfo.pName = "main"; // the function to invoke (main is standard)
+		/*
 
-		// an array of the two pipeline structs
-		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+		Push constants are a small block of data (at least 128 bytes are guaranteed) that is recorded
+		straight into the command buffer with vkCmdPushConstants. They are the cheapest way to hand each
+		draw its own parameters: no descriptor set has to be allocated, written or bound per object, so any
+		number of objects can be drawn after binding a single descriptor set once.
 
-		// describe the vertex data
-		auto bindingDescription = Vertex::getBindingDescription();
-		auto attributeDescriptions = Vertex::getAttributeDescriptions();
-		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-		// describe what type of geometry will be drawn
-		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-		// specify the viewport
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)mSwapChainExtent.width;
-		viewport.height = (float)mSwapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-
-		// draw the entire framebuffer, so specify a scissor rectangle that covers it entirely
-		VkRect2D scissor = {};
-		scissor.offset = { 0, 0 };
-		scissor.extent = mSwapChainExtent;
-
-		// now, combine the viewport and scissor rectangles into a viewport state
-		VkPipelineViewportStateCreateInfo viewportState = {};
-		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewportState.viewportCount = 1;
-		viewportState.pViewports = &viewport;
-		viewportState.scissorCount = 1;
-		viewportState.pScissors = &scissor;
-
-		// configure the rasterizer
-		VkPipelineRasterizationStateCreateInfo rasterizer = {};
-		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterizer.depthClampEnable = VK_FALSE; // fragments beyond the near and far planes are clamped as opposed to discarded if this is true
-		rasterizer.rasterizerDiscardEnable = VK_FALSE; // disables output to any framebuffer if this is true
-		rasterizer.polygonMode = VK_POLYGON_MODE_FILL; // how fragments are generated for geometry
-		rasterizer.lineWidth = 1.0f; // the thickness of lines in terms of number of fragments
-		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT; // the type of face culling to use
-		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE; // the vertex order for faces to be considered front-facing
-		rasterizer.depthBiasClamp;
-		rasterizer.depthBiasConstantFactor = 0.0f; // optional
-		rasterizer.depthBiasClamp = 0.0f; // optional
-		rasterizer.depthBiasSlopeFactor = 0.0f; // optional
-
-		// for now, we will not use multisampling
-		VkPipelineMultisampleStateCreateInfo multisampling = {};
-		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisampling.minSampleShading = 1.0f; // optional
-		multisampling.pSampleMask = nullptr; // optional
-		multisampling.alphaToCoverageEnable = VK_FALSE; // optional
-		multisampling.alphaToOneEnable = VK_FALSE; // optional
-
-		// normally, we might have to configure depth and/or stencil buffers here, but we will set them to nullptrs for now...
-
-		// setup color blending
-		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachment.blendEnable = VK_FALSE; // since this is false, the new color from the fragment shader is passed through unmodified
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // optional
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // optional
-		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // optional
-		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // optional
-		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // optional
-		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // optional
+		*/
 
-		/*
-		
-		Alpha blending could be enabled like so:
-
-		colorBlendAttachment.blendEnable = VK_TRUE;
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-		*/
-
-		// set blend constants that you can use as blend factors in the aforementioned calculations
-		VkPipelineColorBlendStateCreateInfo colorBlending = {};
-		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		colorBlending.logicOpEnable = VK_FALSE;
-		colorBlending.logicOp = VK_LOGIC_OP_COPY; // optional
-		colorBlending.attachmentCount = 1;
-		colorBlending.pAttachments = &colorBlendAttachment;
-		colorBlending.blendConstants[0] = 0.0f; // optional
-		colorBlending.blendConstants[1] = 0.0f; // optional
-		colorBlending.blendConstants[2] = 0.0f; // optional
-		colorBlending.blendConstants[3] = 0.0f; // optional
+		static_assert(sizeof(DrawConstants) <= 128, "Push constants larger than 128 bytes aren't supported by every device.");
 
+		// the push constant range was reflected from the shaders in createDescriptorSetLayout
 		// setup pipeline layout, which controls access to descriptor sets and push constants
 		VkDescriptorSetLayout setLayouts[] = { mDescriptorSetLayout };
 		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		pipelineLayoutInfo.setLayoutCount = 1;
 		pipelineLayoutInfo.pSetLayouts = setLayouts;
-		pipelineLayoutInfo.pushConstantRangeCount = 0;
-		pipelineLayoutInfo.pPushConstantRanges = 0;
+		pipelineLayoutInfo.pushConstantRangeCount = mPushConstantRange.size > 0 ? 1 : 0;
+		pipelineLayoutInfo.pPushConstantRanges = &mPushConstantRange;
 
-		if (vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
+		if (vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, vk::allocationCallbacks(), mPipelineLayout.replace(mDevice)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to created pipeline layout.");
 		}
 
-		// configure depth and stencil testing
-		VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depthStencil.depthTestEnable = VK_TRUE;
-		depthStencil.depthWriteEnable = VK_TRUE;
-		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-		depthStencil.depthBoundsTestEnable = VK_FALSE;	// used for optional depth bounds test
-		depthStencil.minDepthBounds = 0.0f;				// optional (see above)
-		depthStencil.maxDepthBounds = 1.0f;				// optional (see above)
-		depthStencil.stencilTestEnable = VK_FALSE;
-		depthStencil.front = {};						// optional (not using stencil test)
-		depthStencil.back = {};							// optional (not using stencil test)
-
-		// create the graphics pipeline 
-		VkGraphicsPipelineCreateInfo pipelineInfo = {};
-		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineInfo.stageCount = 2;
-		pipelineInfo.pStages = shaderStages;
-		pipelineInfo.pVertexInputState = &vertexInputInfo;
-		pipelineInfo.pInputAssemblyState = &inputAssembly;
-		pipelineInfo.pViewportState = &viewportState;
-		pipelineInfo.pRasterizationState = &rasterizer;
-		pipelineInfo.pMultisampleState = &multisampling;
-		pipelineInfo.pDepthStencilState = &depthStencil;	// depth and stencil test (configured above)
-		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.pDynamicState = nullptr;				// optional
-		pipelineInfo.layout = mPipelineLayout;				// handle (rather than struct pointer)
-		pipelineInfo.renderPass = mRenderPass;				// handle to render pass (created prior to this function call)
-		pipelineInfo.subpass = 0;
-		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;	// Vulkan allows you to create a new graphics pipeline by deriving it from an existing pipeline: null for now
-		pipelineInfo.basePipelineIndex = -1;
-
-		if (vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mGraphicsPipeline) != VK_SUCCESS) 
-		{
-			throw std::runtime_error("Failed to create graphics pipeline.");
+		// the selected variant is needed for the first frame, the others are compiled on worker threads in the meantime
+		mGraphicsPipeline = mPipelineRegistry.get(pipelineKey(mSettings.pipelineVariant));
+
+		// the depth-only pipeline has no fragment shader at all, and its vertex shader is only loaded once the prepass is first used
+		if (mDepthPrepass)
+		{
+			if (mDepthShaderModule.get() == VK_NULL_HANDLE)
+			{
+				createShaderModule(mapFile("shaders/depth.spv").span(), mDepthShaderModule);
+			}
+			mDepthPipeline = mPipelineRegistry.get(depthPipelineKey());
 		}
-		
+		else
+		{
+			mDepthPipeline = VK_NULL_HANDLE;
+		}
+
+		for (PipelineVariant variant : PIPELINE_VARIANTS)
+		{
+			mPipelineRegistry.prepare(pipelineKey(variant));
+		}
+
 		std::cout << "Successfully created graphics pipeline object." << std::endl;
 	}
 
-	//! create a render pass object for use in the graphics pipeline
-	void createRenderPass()
+	//! the pipeline state of a variant of the main pipeline
+	vk::PipelineKey pipelineKey(PipelineVariant variant) const
+	{
+		vk::PipelineKey key;
+		key.name = pipelineVariantName(variant);
+
+		key.vertexShader = mVertShaderModule;
+		key.fragmentShader = mFragShaderModule;
+
+		// see the constant_id declarations in shader.frag: the size of the texture array matches mTextureSlotCount
+		key.specialization = {
+			{ 0, mTextureSlotCount },
+			{ 1, uint32_t(variant == PipelineVariant::AlphaTest) },
+			{ 2, uint32_t(variant == PipelineVariant::Untextured) }
+		};
+
+		// describe the vertex data
+		auto attributeDescriptions = Vertex::getAttributeDescriptions();
+		key.vertexBindings = { Vertex::getBindingDescription() };
+		key.vertexAttributes.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+
+		// the rasterizer and blending defaults of vk::PipelineKey are what every variant uses so far; after the depth prepass, the
+		// depth buffer already holds the nearest surface, so only the fragments that are exactly at that depth are shaded
+		if (mDepthPrepass)
+		{
+			key.depthWrite = VK_FALSE;
+			key.depthCompare = VK_COMPARE_OP_EQUAL;
+		}
+
+		key.layout = mPipelineLayout;
+		key.renderPass = mRenderGraph.renderPass(mMainPass);
+		key.subpass = 0;
+		return key;
+	}
+
+	//! the pipeline state of the depth prepass: positions only, no fragment shader and no color attachments
+	vk::PipelineKey depthPipelineKey() const
+	{
+		vk::PipelineKey key;
+		key.name = "depth prepass";
+
+		key.vertexShader = mDepthShaderModule;
+		key.fragmentShader = VK_NULL_HANDLE;
+
+		VkVertexInputBindingDescription binding = {};
+		binding.binding = 0;
+		binding.stride = sizeof(glm::vec3);
+		binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		key.vertexBindings = { binding };
+
+		VkVertexInputAttributeDescription position = {};
+		position.binding = 0;
+		position.location = 0;
+		position.format = VK_FORMAT_R32G32B32_SFLOAT;
+		position.offset = 0;
+		key.vertexAttributes = { position };
+
+		key.colorAttachments = 0;
+		key.layout = mPipelineLayout;																// shared, so the same descriptor set and push constants apply
+		key.renderPass = mRenderGraph.renderPass(mPrepass);
+		key.subpass = 0;
+		return key;
+	}
+
+	//! alpha testing discards fragments, which a prepass without a fragment shader can't: those pixels would keep the depth of the discarded surface
+	bool depthPrepassSupported() const
+	{
+		return mSettings.pipelineVariant != PipelineVariant::AlphaTest;
+	}
+
+	//! describe the passes of a frame and the images they use, and create the render passes, attachments and framebuffers from that
+	void createRenderGraph()
 	{
 		/*
 		
@@ -1475,106 +2259,127 @@ private:
 		that depend on the contents of framebuffers in previous passes, for example a sequence of post-processing
 		effects that are applied one after another. For now, we stick to one subpass.
 
+		Rather than filling in these structures by hand, the frame is described as a render graph (see
+		render_graph.h): each pass declares the images it reads and writes, and the graph derives the render
+		passes, their load and store ops and layouts, the framebuffers and the barriers between passes from
+		that. The swap chain image is imported into the graph, ending up in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		while the depth buffer is created by the graph. Without the depth prepass it's cleared when the main
+		pass begins and never stored, so the graph backs it with lazily allocated memory where possible (see
+		vk::TransientAttachments); with the prepass, its contents are stored by one render pass and loaded by
+		the next, so it gets plain device local memory.
+
 		*/
-		
-		// color attachment
-		VkAttachmentDescription colorAttachment = {};
-		colorAttachment.format = mSwapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; 
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-		// every subpass references one or more of the attachments that we've described using the structure in the previous sections
-		// the index of the attachment in this array is directly referenced from the fragment shader with the layout directive
-		VkAttachmentReference colorAttachmentRef = {};
-		colorAttachmentRef.attachment = 0; // our array consists of a single VkAttachmentDescription so the index is 0
-		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		// depth attachment
-		VkAttachmentDescription depthAttachment = {};
-		depthAttachment.format = findDepthFormat();
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;							// we don't plan on using the depth information after drawing has finished
-		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;	// the layout will not change during rendering, so initial and final are the same
-		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference depthAttachmentReference = {};
-		depthAttachmentReference.attachment = 1;
-		depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		// describe the subpass
-		VkSubpassDescription subPass = {};
-		subPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;	// Vulkan may support compute subpasses in the future...
-		subPass.colorAttachmentCount = 1;								// note that we can use multiple color attachments but only one depth attachment
-		subPass.pColorAttachments = &colorAttachmentRef;
-		subPass.pDepthStencilAttachment = &depthAttachmentReference;
-
-		// describe subpass dependencies
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;					// the implicit subpass before or after the render pass depending on whether it is specified in srcSubpass or dstSubpass
-		dependency.dstSubpass = 0;										// our subpass, which is the first and only one
-		dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;			// we need to wait for the swap chain to finish reading from the image before we can access it
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-		// create the render pass object with both attachments
-		std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
-		VkRenderPassCreateInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = attachments.size();
-		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subPass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
-
-		if (vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &mRenderPass) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create render pass.");
+
+		VkFormat depthFormat = findDepthFormat();
+		VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+		if (depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT || depthFormat == VK_FORMAT_D24_UNORM_S8_UINT)
+		{
+			depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
 		}
-		
-		std::cout << "Successfully created the render pass object." << std::endl;
+
+		// the acquire semaphore is waited for at the color attachment output stage (see drawFrame)
+		mBackbuffer = mRenderGraph.importImage("swap chain image", mSwapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vk::ResourceUsage::Present);
+		mDepth = mRenderGraph.createImage("depth", depthFormat, depthAspect);
+
+		VkClearValue clearColor = {};
+		clearColor.color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		VkClearValue clearDepth = {};
+		clearDepth.depthStencil = { 1.0f, 0 };
+
+		// the draws come from the secondary command buffers recorded in createCommandBuffers
+		auto executeSecondary = [this](const std::vector<std::vector<VkCommandBuffer>>& commandBuffers)
+		{
+			return [this, &commandBuffers](const vk::RenderGraph::PassContext& context)
+			{
+				std::vector<VkCommandBuffer> secondaryCommandBuffers;
+				for (size_t thread = 0; thread < mSecondaryThreadCount; ++thread)
+				{
+					secondaryCommandBuffers.push_back(commandBuffers[thread][context.variant]);
+				}
+				vkCmdExecuteCommands(context.commandBuffer, secondaryCommandBuffers.size(), secondaryCommandBuffers.data());
+			};
+		};
+
+		/*
+
+		With the depth prepass, the depth buffer is filled by a pass of its own first, which only runs the
+		vertex shader (on positions alone) and the depth test. The main pass then loads that depth buffer
+		read-only and tests against it for equality, so the fragment shader runs once per pixel no matter
+		how many surfaces overlap it. Whether this pays off depends on the scene: it saves fragment shading
+		where there's overdraw, and costs a second pass over the geometry everywhere.
+
+		*/
+
+		if (mDepthPrepass)
+		{
+			mPrepass = mRenderGraph.addPass("depth prepass")
+				.clear(mDepth, vk::ResourceUsage::DepthAttachment, clearDepth)
+				.contents(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+				.record(executeSecondary(mPrepassCommandBuffers));
+
+			mMainPass = mRenderGraph.addPass("main")
+				.clear(mBackbuffer, vk::ResourceUsage::ColorAttachment, clearColor)
+				.read(mDepth, vk::ResourceUsage::DepthAttachmentRead)
+				.contents(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+				.record(executeSecondary(mSecondaryCommandBuffers));
+		}
+		else
+		{
+			mMainPass = mRenderGraph.addPass("main")
+				.clear(mBackbuffer, vk::ResourceUsage::ColorAttachment, clearColor)
+				.clear(mDepth, vk::ResourceUsage::DepthAttachment, clearDepth)
+				.contents(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+				.record(executeSecondary(mSecondaryCommandBuffers));
+		}
+
+		mRenderGraph.compile(mDevice);
+		createRenderGraphResources();
+
+		std::cout << "Successfully compiled the render graph." << std::endl;
 	}
 
-	//! helper function for loading SPIR-V binary data
-	static std::vector<char> readFile(const std::string& filename)
+	//! create the attachments and framebuffers that depend on the swap chain images and their size
+	void createRenderGraphResources()
 	{
-		// ate: start reading the file at the beginning so that we can use the read position to determine the size of the file for buffer allocation
-		// binary: read the file as a binary file (avoid text transformations)
-		std::ifstream file(filename, std::ios::ate | std::ios::binary);
-		if (!file.is_open())
+		// one framebuffer per swap chain image, since the color attachment is a different image for each of them
+		std::vector<VkImageView> views(mSwapChainImageViews.begin(), mSwapChainImageViews.end());
+		mRenderGraph.setImportedImages(mBackbuffer, mSwapChainImages, views);
+		mRenderGraph.createResources(mPhysicalDevice, mSwapChainExtent);
+
+		// the previous attachments (if the swap chain is being recreated) have been retired
+		for (vk::ResidencyManager::ResourceId id : mTransientResidency)
 		{
-			throw std::runtime_error("Failed to open file " + filename);
+			mResidency.untrack(id);
 		}
+		mTransientResidency.clear();
+		for (const vk::Allocation& allocation : mRenderGraph.transients().allocations())
+		{
+			mTransientResidency.push_back(mResidency.track("transient attachments", allocation, false));
+		}
+	}
+
+	//! helper function for loading SPIR-V binaries, models and textures
+	static io::MappedFile mapFile(const std::string& filename, io::AccessHint hint = io::AccessHint::Sequential)
+	{
+		/*
 
-		// determine file size
-		size_t fileSize = (size_t)file.tellg();
-		std::vector<char> buffer(fileSize);
+		Rather than reading the file into a buffer, it is mapped into memory: the returned object hands out
+		a read-only span over the file's pages, which shader module creation, the reflection and the image
+		and model parsers consume in place. The mapping lasts as long as the io::MappedFile, so the span must
+		not outlive it.
 
-		// seek back to the beginning and read all of the bytes at once
-		file.seekg(0);
-		file.read(buffer.data(), fileSize);
+		*/
 
-		// close the file and return the bytes
-		file.close();
+		io::MappedFile file(filename, hint);
 
-		std::stringstream ss;
-		ss << fileSize;
-		
-		std::cout << "Successfully loaded file " << filename << " with " << ss.str() << " bytes." << std::endl;
+		std::cout << "Successfully mapped file " << filename << " with " << file.size() << " bytes." << std::endl;
 
-		return buffer;
+		return file;
 	}
 
 	//! create a shader module
-	void createShaderModule(const std::vector<char>& code, vk::Deleter<VkShaderModule>& shaderModule)
+	void createShaderModule(io::ByteSpan code, vk::ShaderModule& shaderModule)
 	{
 		/*
 		
@@ -1585,56 +2390,15 @@ private:
 
 		VkShaderModuleCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		createInfo.pCode = (uint32_t*)code.data();
+		createInfo.codeSize = code.size;
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data);	// mapped files are page aligned, which is more than the four bytes SPIR-V needs
 
-		if (vkCreateShaderModule(mDevice, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+		if (vkCreateShaderModule(mDevice, &createInfo, vk::allocationCallbacks(), shaderModule.replace(mDevice)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create shader module.");
 		}
 	}
 
-	//! create framebuffer objects
-	void createFramebuffers()
-	{
-		/*
-		
-		The attachments specified during render pass creation are bound by wrapping them into a VkFramebuffer
-		object. A framebuffer object references all of the VkImageView objects that represent the attachments.
-		In our case, that will only be a single attachment: the color attachment. However, the image that we have
-		to use as an attachment depends on which image the swap chain returns when we retrieve one for 
-		presentation. That means we have to create a framebuffer for all of the images in the swap chain and use 
-		the one that corresponds to the retrieved image at drawing time.
-		
-		*/
-		
-		mSwapChainFramebuffers.resize(mSwapChainImageViews.size(), vk::Deleter<VkFramebuffer>{ mDevice, vkDestroyFramebuffer });
-
-		// iterate through the image views and create framebuffers from them
-		for (size_t i = 0; i < mSwapChainImageViews.size(); ++i)
-		{
-			// the color attachment differs for every swap chain image, but the same depth image can be used
-			// this is because we are only running a single subpass at a time, due to our semaphores
-			std::array<VkImageView, 2> attachments = { mSwapChainImageViews[i], mDepthImageView };
-
-			VkFramebufferCreateInfo framebufferInfo = {};
-			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = mRenderPass;
-			framebufferInfo.attachmentCount = attachments.size();
-			framebufferInfo.pAttachments = attachments.data();
-			framebufferInfo.width = mSwapChainExtent.width;
-			framebufferInfo.height = mSwapChainExtent.height;
-			framebufferInfo.layers = 1;
-
-			if (vkCreateFramebuffer(mDevice, &framebufferInfo, nullptr, &mSwapChainFramebuffers[i]) != VK_SUCCESS)
-			{
-				throw std::runtime_error("Failed to create framebuffer.");
-			}
-		}
-
-		std::cout << "Successfully created all framebuffer objects." << std::endl;
-	}
-
 	//! create a command pool, which manages and allocates command buffers
 	void createCommandPool()
 	{
@@ -1662,41 +2426,82 @@ private:
 
 		*/
 
+		createRecordingCommandPools();
+
 		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(mPhysicalDevice); 
 
 		VkCommandPoolCreateInfo poolInfo = {};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-		poolInfo.flags = 0; // optional
 
-		if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mCommandPool) != VK_SUCCESS)
+		/*
+
+		The same goes for single-time commands: startup stages on different threads record their layout
+		transitions and copies at the same time, so every thread of the job system allocates them from a
+		pool of its own. These command buffers are short-lived, which is what VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
+		is meant for.
+
+		*/
+
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		mSingleTimeCommandPools.resize(mJobs.threadCount());
+
+		for (auto& singleTimeCommandPool : mSingleTimeCommandPools)
 		{
-			throw std::runtime_error("Failed to create command pool.");
+			if (vkCreateCommandPool(mDevice, &poolInfo, vk::allocationCallbacks(), singleTimeCommandPool.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create single-time command pool.");
+			}
 		}
 
-		std::cout << "Successfully created command pool object." << std::endl;
+		std::cout << "Successfully created command pool object, " << mThreadCommandPools.size() << " recording thread command pools and " 
+			<< mSingleTimeCommandPools.size() << " single-time command pools." << std::endl;
 	}
 
-	//! create an image that will be used as a depth attachment during rendering
-	void createDepthResource()
+	//! create the pools that the per-frame primary and secondary command buffers are allocated from
+	void createRecordingCommandPools()
 	{
-		VkFormat depthFormat = findDepthFormat();
+		/*
 
-		// call our helper functions for creating an image and image view
-		createImage(mSwapChainExtent.width, 
-			mSwapChainExtent.height,
-			depthFormat, 
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-			mDepthImage, 
-			mDepthImageMemory);
+		Command buffers that the GPU may still be executing can be neither freed nor reset. Rather than waiting
+		for them, every re-recording starts out with fresh pools: the old pools (and with them, all of the
+		command buffers that were allocated from them) are handed to the deletion queue, which destroys them
+		once the last frame that submitted them has completed.
+
+		*/
+
+		mDeletionQueue.retire(std::move(mCommandPool), mSubmittedFrame);
+		mDeletionQueue.retire(mThreadCommandPools, mSubmittedFrame);
+
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(mPhysicalDevice); 
 
-		createImageView(mDepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, mDepthImageView);
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+		poolInfo.flags = 0; // optional
 
-		// we could do this in the render pass, but it only needs to happen once, so we use a pipeline barrier instead
-		// we can use VK_IMAGE_LAYOUT_UNDEFINED as the initial layout because there is no existing image data that matters
-		transitionImageLayout(mDepthImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		if (vkCreateCommandPool(mDevice, &poolInfo, vk::allocationCallbacks(), mCommandPool.replace(mDevice)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create command pool.");
+		}
+
+		/*
+
+		Command pools are externally synchronized, so every thread that records secondary command buffers
+		gets a pool of its own. These are always reset as a whole before re-recording (see
+		recordSecondaryCommandBuffers), so the pools don't need VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT.
+
+		*/
+
+		mThreadCommandPools.resize(mSettings.recordingThreads);
+
+		for (auto& threadCommandPool : mThreadCommandPools)
+		{
+			if (vkCreateCommandPool(mDevice, &poolInfo, vk::allocationCallbacks(), threadCommandPool.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create recording thread command pool.");
+			}
+		}
 	}
 
 	//! select a format with a depth component that supports usage as a depth attachment
@@ -1739,72 +2544,229 @@ private:
 		throw std::runtime_error("Failed to find supported format.");
 	}
 
-	//! create an image from a STB image
-	void createTextureImage()
+	//! start decoding the texture files into CPU memory: this doesn't touch any Vulkan objects, so it can run on any thread
+	void decodeTextureImage()
 	{
-		int texWidth, texHeight, texChannels;
-		stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		std::cout << "Loaded STB image file, resolution: " << texWidth << " x " << texHeight << std::endl;
+		mTextures.resize(TEXTURE_PATHS.size());
 
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
-		
-		if (!pixels)
+		// textures in the archive are already decoded: they are extracted straight into staging memory by uploadTexture
+		if (mAssetArchive)
 		{
-			throw std::runtime_error("Failed to load STB image file.");
+			for (size_t i = 0; i < mTextures.size(); ++i)
+			{
+				const assets::Entry* entry = findArchiveEntry(TEXTURE_PATHS[i], assets::EntryType::Texture);
+				if (entry->metadata[2] != VK_FORMAT_R8G8B8A8_UNORM || entry->size != uint64_t(entry->metadata[0]) * entry->metadata[1] * 4)
+				{
+					throw std::runtime_error("Texture " + TEXTURE_PATHS[i] + " in the asset archive isn't in the expected format.");
+				}
+
+				mTextures[i].archiveEntry = entry;
+				mTextures[i].width = static_cast<int>(entry->metadata[0]);
+				mTextures[i].height = static_cast<int>(entry->metadata[1]);
+			}
+			return;
 		}
 
-		vk::Deleter<VkImage> stagingImage{ mDevice, vkDestroyImage };
-		vk::Deleter<VkDeviceMemory> stagingImageMemory{ mDevice, vkFreeMemory };
+		/*
+
+		All of the files are read at once, so the disk always has a queue of requests to work on, and each
+		one is decoded by a job as soon as its bytes have arrived, while the others are still being read.
+		This only waits for the reads: the decodes keep running after it returns, and createTextureImage
+		uploads every texture as soon as its own decode has finished (see waitForTextureDecode).
 
-		// create staging image and memory
-		createImage(texWidth, 
-			texHeight, 
-			VK_FORMAT_R8G8B8A8_UNORM, 
-			VK_IMAGE_TILING_LINEAR, 
-			VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-			stagingImage, 
-			stagingImageMemory);
+		*/
 
-		// transfer pixel data from CPU to GPU (host visible) memory
-		void* data;
-		vkMapMemory(mDevice, stagingImageMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, (size_t)imageSize);
-		vkUnmapMemory(mDevice, stagingImageMemory);
+		io::AsyncReader reader;
+		for (size_t i = 0; i < mTextures.size(); ++i)
+		{
+			Texture& texture = mTextures[i];
+			texture.decoded.reset(new jobs::Counter());
+
+			io::AsyncReader::FileId file = reader.open(TEXTURE_PATHS[i]);
+			texture.encoded.resize(static_cast<size_t>(reader.size(file)));
+
+			reader.read(file, 0, texture.encoded.size(), texture.encoded.data(), [this, i](bool ok)
+			{
+				// a failed read is reported by the decode job, so the error reaches whoever waits for the texture
+				mJobs.run([this, i, ok]()
+				{
+					Texture& texture = mTextures[i];
+					if (!ok)
+					{
+						throw std::runtime_error("Failed to read STB image file " + TEXTURE_PATHS[i] + ".");
+					}
+
+					int texChannels;
+					texture.pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(texture.encoded.data()), static_cast<int>(texture.encoded.size()), &texture.width, &texture.height, &texChannels, STBI_rgb_alpha);
+					std::vector<char>().swap(texture.encoded);
+
+					if (!texture.pixels)
+					{
+						throw std::runtime_error("Failed to load STB image file " + TEXTURE_PATHS[i] + ".");
+					}
+				}, mTextures[i].decoded.get());
+			});
+		}
+		reader.wait();
+	}
+
+	//! wait until a texture's pixels have been decoded, rethrowing the error if they couldn't be
+	void waitForTextureDecode(Texture& texture)
+	{
+		if (texture.decoded)
+		{
+			mJobs.wait(*texture.decoded);
+			texture.decoded.reset();
+		}
+	}
+
+	void waitForTextureDecodes()
+	{
+		for (Texture& texture : mTextures)
+		{
+			waitForTextureDecode(texture);
+		}
+	}
 
-		std::cout << "Successfully loaded STB image data into host visible (staging) memory." << std::endl;
+	//! upload the decoded textures (see decodeTextureImage) into device local images
+	void createTextureImage()
+	{
+		uint32_t heap = memoryAllocation(findMemoryType(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), 0).heap;
+
+		// uploading the first texture overlaps with decoding the rest
+		for (size_t i = 0; i < mTextures.size(); ++i)
+		{
+			Texture& texture = mTextures[i];
+			waitForTextureDecode(texture);
+			std::cout << "Loaded STB image file " << TEXTURE_PATHS[i] << ", resolution: " << texture.width << " x " << texture.height << std::endl;
+
+			// the first texture stands in for the ones that aren't resident, so it is always uploaded; the rest are streamable
+			if (i > 0 && !mResidency.fits(heap, VkDeviceSize(texture.width) * texture.height * 4))
+			{
+				std::cout << "Skipping " << TEXTURE_PATHS[i] << ", which doesn't fit into the memory budget." << std::endl;
+				releaseTexturePixels(texture);
+				continue;
+			}
+
+			vk::Allocation allocation = uploadTexture(texture);
+			texture.resident = true;
+			texture.residency = mResidency.track(TEXTURE_PATHS[i], allocation, i > 0, [this, i]() { evictTexture(i); });
+		}
+	}
+
+	//! free the CPU-side copy of a texture's pixels
+	void releaseTexturePixels(Texture& texture)
+	{
+		if (texture.pixels)
+		{
+			stbi_image_free(texture.pixels);
+		}
+		texture.pixels = nullptr;
+		texture.archiveEntry = nullptr;
+	}
+
+	//! upload a single decoded texture into a device local image and free its pixels
+	vk::Allocation uploadTexture(Texture& texture)
+	{
+		uint32_t texWidth = static_cast<uint32_t>(texture.width);
+		uint32_t texHeight = static_cast<uint32_t>(texture.height);
+		stbi_uc* pixels = texture.pixels;
 
 		// create final image and memory 
-		createImage(texWidth, 
+		vk::Allocation allocation = createImage(texWidth, 
 			texHeight,
 			VK_FORMAT_R8G8B8A8_UNORM,
 			VK_IMAGE_TILING_OPTIMAL,
 			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, // we want to be able to sample texels from it in the shader
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			mTextureImage,
-			mTextureImageMemory);
+			texture.image,
+			texture.memory);
+
+		/*
+
+		The pixels go through the staging ring in bands of rows, each as large as a single allocation allows,
+		so textures larger than the ring take several copies. Textures in the archive are decompressed
+		straight into the ring rather than into memory of their own first.
+
+		The layout transitions are recorded into the same command buffers as the copies: the one that prepares
+		the image for copying in front of the first band, and the one that makes it readable by the fragment
+		shader after the last. A texture that fits into a single band is uploaded with a single submission.
+
+		*/
+
+		VkDeviceSize rowSize = VkDeviceSize(texWidth) * 4;
+		uint32_t bandRows = static_cast<uint32_t>(std::min<VkDeviceSize>(mStagingRing.maxAllocation() / rowSize, texHeight));
+		if (bandRows == 0)
+		{
+			throw std::runtime_error("A row of the texture doesn't fit into the staging ring, see --staging-size.");
+		}
+
+		for (uint32_t row = 0; row < texHeight; row += bandRows)
+		{
+			uint32_t rows = std::min(bandRows, texHeight - row);
+			VkDeviceSize bandSize = rowSize * rows;
+
+			// buffer to image copies need an offset that is a multiple of 4 and of the texel size
+			vk::StagingRing::Region region = mStagingRing.allocate(bandSize, 16);
+			if (texture.archiveEntry)
+			{
+				// on this thread alone: waiting for jobs would run other jobs, whose uploads may wait for this region to be submitted
+				mAssetArchive->extract(*texture.archiveEntry, rowSize * row, bandSize, region.data);
+			}
+			else
+			{
+				memcpy(region.data, pixels + rowSize * row, (size_t)bandSize);
+			}
+
+			VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+			// prepare the image for a copy operation by transitioning its layout (the previous contents are discarded, since the copies overwrite every texel)
+			vk::BarrierBatch barriers;
+			if (row == 0)
+			{
+				barriers.image(texture.image, VK_IMAGE_ASPECT_COLOR_BIT, vk::ResourceUsage::None, vk::ResourceUsage::TransferDst);
+				mBarrierCounters.recorded(barriers.flush(commandBuffer));
+			}
+
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.bufferOffset = region.offset;
+			copyRegion.bufferRowLength = 0;								// tightly packed
+			copyRegion.bufferImageHeight = 0;
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.mipLevel = 0;
+			copyRegion.imageSubresource.baseArrayLayer = 0;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageOffset = { 0, static_cast<int32_t>(row), 0 };
+			copyRegion.imageExtent = { texWidth, rows, 1 };
+
+			vkCmdCopyBufferToImage(commandBuffer, region.buffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+			// to enable sampling from the newly created texture image, we need to do one more layout transition
+			if (row + rows == texHeight)
+			{
+				barriers.image(texture.image, VK_IMAGE_ASPECT_COLOR_BIT, vk::ResourceUsage::TransferDst, vk::ResourceUsage::Sampled);
+				mBarrierCounters.recorded(barriers.flush(commandBuffer));
+			}
 
-		// prepare the images for a copy operation by transitioning their layouts 
-		transitionImageLayout(stagingImage, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-		transitionImageLayout(mTextureImage, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		copyImage(stagingImage, mTextureImage, texWidth, texHeight);
+			endSingleTimeCommands(commandBuffer, &region);
+		}
 
-		// to enable sampling from the newly created texture image, we need to do one more layout transition
-		transitionImageLayout(mTextureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		std::cout << "Successfully uploaded STB image data through the staging ring." << std::endl;
 
 		// free the CPU-side memory
-		stbi_image_free(pixels);
+		releaseTexturePixels(texture);
+		return allocation;
 	}
 	
-	//! a helper function for creating an image and its associated memory
-	void createImage(uint32_t width,
+	//! a helper function for creating an image and its associated memory, returning where the memory was allocated
+	vk::Allocation createImage(uint32_t width,
 		uint32_t height,
 		VkFormat format,
 		VkImageTiling tiling,
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
-		vk::Deleter<VkImage>& image,
-		vk::Deleter<VkDeviceMemory>& imageMemory)
+		vk::Image& image,
+		vk::DeviceMemory& imageMemory)
 	{
 		VkImageCreateInfo imageInfo = {};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1822,7 +2784,7 @@ private:
 		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;					// related to multisampling (only relevant for images that will be used as attachments)
 		imageInfo.flags = 0;										// optional
 
-		if (vkCreateImage(mDevice, &imageInfo, nullptr, &image) != VK_SUCCESS)
+		if (vkCreateImage(mDevice, &imageInfo, vk::allocationCallbacks(), image.replace(mDevice)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create image.");
 		}
@@ -1830,132 +2792,34 @@ private:
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(mDevice, image, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-		if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+		vk::Allocation allocation = allocateMemory(memRequirements, properties, imageMemory);
+		if (allocation.size == 0)
 		{
 			throw std::runtime_error("Failed to allocation image memory.");
 		}
 
 		vkBindImageMemory(mDevice, image, imageMemory, 0);
+		return allocation;
 	}
 
-	//! a helper function for transitioning between two image layouts
-	void transitionImageLayout(VkImage image,
-		VkImageLayout oldLayout,
-		VkImageLayout newLayout)
+	//! create the image views that grant access to the texture images
+	void createTextureImageView()
 	{
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-		// transitioning image layouts requires synchronization: for this, we use a type of pipeline barrier
-		VkImageMemoryBarrier barrier = {};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.oldLayout = oldLayout;
-		barrier.newLayout = newLayout;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; // we aren't using the barrier to transfer queue family ownership, but this field is still required
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.image = image;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = 1;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
-
-		// select the right subresource aspect mask
-		if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-		{
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-		}
-		else
-		{
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		}
-		
-		// we need to set our srcAccessMask and dstAccessMask based on the transitions we intend to handle
-		// 1. preinitialized -> transfer source: transfer reads should wait on host writes
-		// 2. preinitialized -> transfer destination: transfer writes should wait on host writes
-		// 3. transfer destination -> shader reading: shader reads should wait on transfer writes
-		if (oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) 
-		{
-			barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) 
-		{
-			barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) 
-		{
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+		for (Texture& texture : mTextures)
 		{
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		}
-		else 
-		{
-			throw std::invalid_argument("Unsupported image layout transition.");
+			if (texture.resident)
+			{
+				createImageView(texture.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, texture.view);
+			}
 		}
-
-		vkCmdPipelineBarrier(commandBuffer,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, // the pipeline stage in which operations will wait on the barrier: we want it to happen immediately
-			0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
-	}
-
-	//! a helper function for copying data between two images
-	void copyImage(VkImage srcImage,
-		VkImage dstImage,
-		uint32_t width,
-		uint32_t height)
-	{
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-		VkImageSubresourceLayers subResource = {};
-		subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		subResource.baseArrayLayer = 0;
-		subResource.mipLevel = 0;
-		subResource.layerCount = 1;
-
-		VkImageCopy region = {};
-		region.srcSubresource = subResource;
-		region.dstSubresource = subResource;
-		region.srcOffset = { 0, 0, 0 };
-		region.dstOffset = { 0, 0, 0 };
-		region.extent.width = width;
-		region.extent.height = height;
-		region.extent.depth = 1;
-
-		vkCmdCopyImage(commandBuffer,
-			srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1, &region);
-
-		endSingleTimeCommands(commandBuffer);
-	}
-
-	//! create an image view that grants access to the texture image
-	void createTextureImageView()
-	{
-		createImageView(mTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mTextureImageView);
-		std::cout << "Successfully created texture image view for STB image." << std::endl;
+		std::cout << "Successfully created " << mTextures.size() << " texture image views." << std::endl;
 	}
 
 	//! a helper function for creating an image view from an image
 	void createImageView(VkImage image,
 		VkFormat format,
 		VkImageAspectFlags aspectFlags,
-		vk::Deleter<VkImageView>& imageView)
+		vk::ImageView& imageView)
 	{
 		VkImageViewCreateInfo viewInfo = {};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1968,7 +2832,7 @@ private:
 		viewInfo.subresourceRange.baseArrayLayer = 0;
 		viewInfo.subresourceRange.layerCount = 1;
 
-		if (vkCreateImageView(mDevice, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		if (vkCreateImageView(mDevice, &viewInfo, vk::allocationCallbacks(), imageView.replace(mDevice)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create texture image view.");
 		}
@@ -1997,7 +2861,7 @@ private:
 		samplerInfo.minLod = 0.0f;
 		samplerInfo.maxLod = 0.0f;
 		
-		if (vkCreateSampler(mDevice, &samplerInfo, nullptr, &mTextureSampler) != VK_SUCCESS)
+		if (vkCreateSampler(mDevice, &samplerInfo, vk::allocationCallbacks(), mTextureSampler.replace(mDevice)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create texture sampler.");
 		}
@@ -2008,12 +2872,23 @@ private:
 	//! loads an obj model from the tinyobjloader library
 	void loadModel()
 	{
+		if (mAssetArchive)
+		{
+			loadModelFromArchive();
+			return;
+		}
+
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
 		std::string err;
 
-		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str()))
+		// the parser reads from a stream that points at the mapped file; the model's materials aren't used, so no material reader is given
+		io::MappedFile file = mapFile(MODEL_PATH);
+		io::SpanStreamBuffer buffer(file.span());
+		std::istream stream(&buffer);
+
+		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &stream))
 		{
 			throw std::runtime_error(err);
 		}
@@ -2050,14 +2925,229 @@ private:
 		}
 
 		std::cout << "Successfully loaded obj model from tinyobjloader with " << mModelVertices.size() << " vertices." << std::endl;
+
+		for (const auto& vertex : mModelVertices)
+		{
+			mModelBoundingRadius = std::max(mModelBoundingRadius, glm::length(vertex.position));
+		}
+
+		generateModelLods();
 	}
 
-	//! a helper function for abstracting buffer creation
-	void createBuffer(VkDeviceSize size, 
+	//! simplify the loaded model into a chain of levels of detail that share its vertex buffer
+	void generateModelLods()
+	{
+		/*
+
+		Each level of detail is a range of the index buffer: the original indices come first, followed by the 
+		indices of every simplified level. All levels reference the same vertices, so the vertex buffer does 
+		not grow.
+
+		*/
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto levels = mesh::buildLodChain(mModelVertices, mModelIndices, LOD_RATIOS, LOD_MAX_ERROR);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		mModelLods.clear();
+		mModelLods.push_back({ 0, static_cast<uint32_t>(mModelIndices.size()), 0.0f });
+
+		for (const auto& level : levels)
+		{
+			mModelLods.push_back({ static_cast<uint32_t>(mModelIndices.size()), static_cast<uint32_t>(level.indices.size()), level.error });
+			mModelIndices.insert(mModelIndices.end(), level.indices.begin(), level.indices.end());
+		}
+
+		std::cout << "Generated " << levels.size() << " simplified levels of detail in " 
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms:" << std::endl;
+		for (size_t i = 0; i < mModelLods.size(); ++i)
+		{
+			std::cout << "\tLOD " << i << ": " << mModelLods[i].indexCount / 3 << " triangles, error " << mModelLods[i].error << std::endl;
+		}
+	}
+
+	//! the entry of an asset in the archive, throwing if it's missing or of the wrong type
+	const assets::Entry* findArchiveEntry(const std::string& name, assets::EntryType type) const
+	{
+		const assets::Entry* entry = mAssetArchive->find(name);
+		if (!entry || entry->type != type)
+		{
+			throw std::runtime_error("The asset archive doesn't contain " + name + ".");
+		}
+		return entry;
+	}
+
+	//! load the vertices, indices and levels of detail that packAssets stored, so neither the OBJ parser nor the simplifier has to run
+	void loadModelFromArchive()
+	{
+		const assets::Entry* vertices = findArchiveEntry("models/vertices", assets::EntryType::Vertices);
+		const assets::Entry* indices = findArchiveEntry("models/indices", assets::EntryType::Indices);
+		const assets::Entry* lods = findArchiveEntry("models/lods", assets::EntryType::Blob);
+
+		if (vertices->metadata[0] != sizeof(Vertex) || indices->metadata[0] != sizeof(uint32_t) || lods->size % sizeof(mesh::Lod) != 0)
+		{
+			throw std::runtime_error("The model in the asset archive doesn't match the vertex and index layout of the application.");
+		}
+
+		mModelVertices.resize(vertices->size / sizeof(Vertex));
+		mModelIndices.resize(indices->size / sizeof(uint32_t));
+		mModelLods.resize(lods->size / sizeof(mesh::Lod));
+
+		// the chunks of each entry are decompressed in parallel, right into the vectors
+		std::vector<const assets::Entry*> entries = { vertices, indices, lods };
+		std::vector<char*> destinations = { reinterpret_cast<char*>(mModelVertices.data()), reinterpret_cast<char*>(mModelIndices.data()), reinterpret_cast<char*>(mModelLods.data()) };
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			mAssetArchive->extract(*entries[i], destinations[i], &mJobs);
+		}
+
+		std::memcpy(&mModelBoundingRadius, &vertices->metadata[1], sizeof(float));
+
+		std::cout << "Successfully loaded model from the asset archive with " << mModelVertices.size() << " vertices and " << mModelLods.size() << " levels of detail." << std::endl;
+	}
+
+	//! load the loose assets the way the application normally does, and write them into an archive in the form they are uploaded in
+	void packAssets(const std::string& path)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		loadModel();
+		decodeTextureImage();
+		waitForTextureDecodes();
+
+		assets::ArchiveWriter writer;
+
+		// the bounding radius goes along with the vertices, the levels of detail are stored so the simplifier doesn't have to run again
+		uint32_t radiusBits;
+		std::memcpy(&radiusBits, &mModelBoundingRadius, sizeof(float));
+		writer.add("models/vertices", assets::EntryType::Vertices, mModelVertices.data(), mModelVertices.size() * sizeof(Vertex), { sizeof(Vertex), radiusBits, 0, 0 });
+		writer.add("models/indices", assets::EntryType::Indices, mModelIndices.data(), mModelIndices.size() * sizeof(uint32_t), { sizeof(uint32_t), 0, 0, 0 });
+		writer.add("models/lods", assets::EntryType::Blob, mModelLods.data(), mModelLods.size() * sizeof(mesh::Lod));
+
+		uint64_t looseSize = 0;
+		for (size_t i = 0; i < mTextures.size(); ++i)
+		{
+			Texture& texture = mTextures[i];
+			uint32_t width = static_cast<uint32_t>(texture.width);
+			uint32_t height = static_cast<uint32_t>(texture.height);
+			writer.add(TEXTURE_PATHS[i], assets::EntryType::Texture, texture.pixels, size_t(width) * height * 4, { width, height, VK_FORMAT_R8G8B8A8_UNORM, 0 });
+
+			looseSize += io::MappedFile(TEXTURE_PATHS[i]).size();
+			stbi_image_free(texture.pixels);
+			texture.pixels = nullptr;
+		}
+		looseSize += io::MappedFile(MODEL_PATH).size();
+
+		uint64_t archiveSize = writer.write(path, &mJobs);
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Packed " << TEXTURE_PATHS.size() + 3 << " assets into " << path << ": " << archiveSize / 1024 << " KiB (the loose files take "
+			<< looseSize / 1024 << " KiB) in " << ms << " ms." << std::endl;
+	}
+
+	//! compare loading the loose files with extracting the archive, each with a cold and a warm file cache
+	void benchmarkAssetLoading()
+	{
+		/*
+
+		Both ways end with the same data in memory: decoded pixels, vertices, indices and levels of detail.
+		The loose files have to be parsed, decoded and simplified; the archive only has to be decompressed,
+		with every chunk of every entry as a separate job. Decompressing goes into one heap allocation laid
+		out the way a staging buffer would be, which stands in for mapped staging memory since this runs
+		without a device.
+
+		Cold runs ask the operating system to drop the files from its cache first. Where that isn't possible
+		(see io::evictFromFileCache), the cold numbers are really warm ones, which the report points out.
+
+		*/
+
+		const std::string archivePath = mSettings.assetArchive.empty() ? ASSET_ARCHIVE_PATH : mSettings.assetArchive;
+		const uint32_t runs = 5;
+
+		std::vector<std::string> looseFiles = TEXTURE_PATHS;
+		looseFiles.push_back(MODEL_PATH);
+
+		auto loadLoose = [this]()
+		{
+			mModelVertices.clear();
+			mModelIndices.clear();
+			loadModel();
+			decodeTextureImage();
+			waitForTextureDecodes();
+			for (Texture& texture : mTextures)
+			{
+				stbi_image_free(texture.pixels);
+				texture.pixels = nullptr;
+			}
+		};
+
+		std::vector<char> staging;
+		auto loadArchive = [&]()
+		{
+			assets::ArchiveReader archive(archivePath);
+			std::vector<const assets::Entry*> entries;
+			for (const auto& entry : archive.entries())
+			{
+				entries.push_back(&entry);
+			}
+
+			uint64_t size;
+			std::vector<uint64_t> offsets = assets::ArchiveReader::layout(entries, size);
+			staging.resize(size);
+			archive.extract(entries, offsets, staging.data(), &mJobs);
+		};
+
+		struct Case
+		{
+			const char* name;
+			bool archive;
+			bool cold;
+		};
+		const Case cases[] = { { "loose files, cold cache", false, true }, { "loose files, warm cache", false, false },
+			{ "archive, cold cache", true, true }, { "archive, warm cache", true, false } };
+
+		bool evicted = true;
+		std::vector<profiler::RunningStats> results(4);
+
+		for (size_t c = 0; c < 4; ++c)
+		{
+			for (uint32_t run = 0; run < runs; ++run)
+			{
+				if (cases[c].cold)
+				{
+					for (const auto& file : cases[c].archive ? std::vector<std::string>{ archivePath } : looseFiles)
+					{
+						evicted = io::evictFromFileCache(file) && evicted;
+					}
+				}
+
+				auto start = std::chrono::high_resolution_clock::now();
+				cases[c].archive ? loadArchive() : loadLoose();
+				results[c].add(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+			}
+		}
+
+		std::cout << "Asset loading over " << runs << " runs each (" << mJobs.threadCount() << " job system threads, " << staging.size() / 1024 << " KiB extracted from the archive):" << std::endl;
+		std::cout << std::fixed << std::setprecision(2);
+		for (size_t c = 0; c < 4; ++c)
+		{
+			std::cout << "\t" << std::left << std::setw(24) << cases[c].name << std::right << " mean " << std::setw(9) << results[c].mean() << " ms, min "
+				<< std::setw(9) << results[c].min() << " ms, max " << std::setw(9) << results[c].max() << " ms" << std::endl;
+		}
+		std::cout.unsetf(std::ios_base::floatfield);
+
+		if (!evicted)
+		{
+			std::cout << "\tThe file cache couldn't be dropped on this platform, so the cold cache runs were warm as well." << std::endl;
+		}
+	}
+
+	//! a helper function for abstracting buffer creation, returning where the memory was allocated
+	vk::Allocation createBuffer(VkDeviceSize size, 
 		VkBufferUsageFlags usage, 
 		VkMemoryPropertyFlags properties,
-		vk::Deleter<VkBuffer>& buffer, 
-		vk::Deleter<VkDeviceMemory>& bufferMemory)
+		vk::Buffer& buffer, 
+		vk::DeviceMemory& bufferMemory)
 	{
 		/*
 
@@ -2082,7 +3172,7 @@ private:
 		bufferInfo.usage = usage;
 		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-		if (vkCreateBuffer(mDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		if (vkCreateBuffer(mDevice, &bufferInfo, vk::allocationCallbacks(), buffer.replace(mDevice)) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create buffer object.");
 		}
@@ -2091,12 +3181,8 @@ private:
 		VkMemoryRequirements memRequirements;
 		vkGetBufferMemoryRequirements(mDevice, buffer, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-		
-		if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+		vk::Allocation allocation = allocateMemory(memRequirements, properties, bufferMemory);
+		if (allocation.size == 0)
 		{
 			throw std::runtime_error("Failed to allocate buffer memory.");
 		}
@@ -2105,6 +3191,48 @@ private:
 
 		// associate this memory with the buffer
 		vkBindBufferMemory(mDevice, buffer, bufferMemory, 0); // if the offset is non-zero, then it is required to be divisible by memRequirements.alignment
+		return allocation;
+	}
+
+	//! allocate memory for an image or buffer, evicting textures to make room in its heap once startup is over; returns an empty allocation on failure
+	vk::Allocation allocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, vk::DeviceMemory& memory)
+	{
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = requirements.size;
+		allocInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+
+		vk::Allocation allocation = memoryAllocation(allocInfo.memoryTypeIndex, requirements.size);
+		if (mEvictionAllowed)
+		{
+			mResidency.makeRoom(allocation.heap, allocation.size);
+		}
+
+		VkResult result = vkAllocateMemory(mDevice, &allocInfo, vk::allocationCallbacks(), memory.replace(mDevice));
+
+		// the budget was too optimistic (or another process took the memory): evict as much as the allocation needs and try once more
+		if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && mEvictionAllowed && mResidency.evictBytes(allocation.heap, allocation.size))
+		{
+			// the evicted textures are retired at the last submitted frame, so waiting for that frame (and no more) releases their memory;
+			// if it had already completed, nothing is waited for, and the collection picks up what was just retired
+			waitForFrame(mSubmittedFrame);
+			collectCompletedFrames();
+			result = vkAllocateMemory(mDevice, &allocInfo, vk::allocationCallbacks(), memory.replace(mDevice));
+		}
+
+		return result == VK_SUCCESS ? allocation : vk::Allocation();
+	}
+
+	//! the heap that a memory type belongs to, along with the size of an allocation from it
+	vk::Allocation memoryAllocation(uint32_t memoryType, VkDeviceSize size)
+	{
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
+
+		vk::Allocation allocation;
+		allocation.heap = memProperties.memoryTypes[memoryType].heapIndex;
+		allocation.size = size;
+		return allocation;
 	}
 
 	//! create a GPU-side buffer to hold the specified vertex data
@@ -2123,30 +3251,9 @@ private:
 		
 		VkDeviceSize bufferSize = sizeof(mModelVertices[0]) * mModelVertices.size();
 
-		// create a staging buffer
-		vk::Deleter<VkBuffer> stagingBuffer{ mDevice, vkDestroyBuffer };
-		vk::Deleter<VkDeviceMemory> stagingBufferMemory{ mDevice, vkFreeMemory };
-		createBuffer(bufferSize,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT, // buffer can be used as the source in a memory transfer operation
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer,
-			stagingBufferMemory);
-
-		// copy CPU-side vertex data into the staging buffer
-		void* data;
-		vkMapMemory(mDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, mModelVertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(mDevice, stagingBufferMemory);
-
-		// create a vertex buffer
-		createBuffer(bufferSize,
-			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // buffer can be used as the destination in a memory transfer operation
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			mVertexBuffer,
-			mVertexBufferMemory);
-
-		// copy data between buffers
-		copyBuffer(stagingBuffer, mVertexBuffer, bufferSize);
+		// create a vertex buffer and copy the CPU-side vertex data into it
+		vk::Allocation allocation = createDeviceLocalBuffer(mModelVertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, mVertexBuffer, mVertexBufferMemory);
+		mResidency.track("vertex buffer", allocation, false);
 	}
 	
 	//! create a GPU-side buffer to hold the specified vertex indices
@@ -2154,63 +3261,289 @@ private:
 	{
 		VkDeviceSize bufferSize = sizeof(mModelIndices[0]) * mModelIndices.size();
 
-		// create a staging buffer
-		vk::Deleter<VkBuffer> stagingBuffer{ mDevice, vkDestroyBuffer };
-		vk::Deleter<VkDeviceMemory> stagingBufferMemory{ mDevice, vkFreeMemory };
-		createBuffer(bufferSize,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer,
-			stagingBufferMemory);
+		// create an index buffer and copy the CPU-side index data into it
+		vk::Allocation allocation = createDeviceLocalBuffer(mModelIndices.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, mIndexBuffer, mIndexBufferMemory);
+		mResidency.track("index buffer", allocation, false);
+	}
 
-		// copy CPU-side vertex data into the staging buffer
-		void* data;
-		vkMapMemory(mDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, mModelIndices.data(), (size_t)bufferSize);
-		vkUnmapMemory(mDevice, stagingBufferMemory);
+	//! create a second vertex buffer that only holds the positions, for the depth prepass
+	void createPositionBuffer()
+	{
+		/*
 
-		// create a vertex buffer
-		createBuffer(bufferSize,
-			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			mIndexBuffer,
-			mIndexBufferMemory);
+		The depth prepass only needs the position of every vertex. Reading them out of the interleaved
+		vertex buffer would fetch the color and texture coordinates along with them (a position is 12 of
+		every 32 bytes), so the positions are copied into a tightly packed stream of their own. The same
+		index buffer and the same LOD ranges index both streams. The buffer is created whether or not
+		the prepass is enabled, so that switching it on at runtime doesn't have to upload anything.
+
+		*/
+
+		std::vector<glm::vec3> positions(mModelVertices.size());
+		for (size_t i = 0; i < mModelVertices.size(); ++i)
+		{
+			positions[i] = mModelVertices[i].position;
+		}
+
+		VkDeviceSize bufferSize = sizeof(positions[0]) * positions.size();
+		vk::Allocation allocation = createDeviceLocalBuffer(positions.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, mPositionBuffer, mPositionBufferMemory);
+		mResidency.track("position buffer", allocation, false);
+	}
+
+	//! create the material table: a device local storage buffer that the fragment shader indexes with the draw's material index
+	void createMaterialBuffer()
+	{
+		/*
+
+		Materials cycle through the loaded textures with a few different tints. The first material uses the
+		first texture without a tint, so a single object looks the same as it always has.
+
+		*/
+
+		const glm::vec4 tints[] = { glm::vec4(1.0f), glm::vec4(1.0f, 0.6f, 0.6f, 1.0f), glm::vec4(0.6f, 1.0f, 0.6f, 1.0f), glm::vec4(0.6f, 0.6f, 1.0f, 1.0f) };
+		const size_t materialCount = 8;
 
-		// copy data between buffers
-		copyBuffer(stagingBuffer, mIndexBuffer, bufferSize);
+		mMaterials.resize(materialCount);
+		for (size_t i = 0; i < materialCount; ++i)
+		{
+			mMaterials[i] = {};
+			mMaterials[i].tint = tints[i % 4];
+			mMaterials[i].textureIndex = static_cast<uint32_t>(i % TEXTURE_PATHS.size());
+		}
+
+		VkDeviceSize bufferSize = sizeof(Material) * mMaterials.size();
+
+		vk::Allocation allocation = createDeviceLocalBuffer(mMaterials.data(), bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mMaterialBuffer, mMaterialBufferMemory);
+		mResidency.track("material buffer", allocation, false);
 	}
 
-	//! create a GPU-side buffer to hold shader uniforms
+	//! create a persistently mapped buffer to hold one copy of the shader uniforms per swap chain image
 	void createUniformBuffer()
 	{
-		VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+		/*
 
-		createBuffer(bufferSize, 
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-			mUniformStagingBuffer, 
-			mUniformStagingBufferMemory);
+		Every copy starts at a multiple of minUniformBufferOffsetAlignment, since that is a requirement for
+		dynamic offsets. The buffer has room for sMaxSwapChainImages copies, so it doesn't have to be
+		reallocated (and the descriptor set rewritten while frames are still using it) when the swap chain
+		is recreated with a different number of images.
 
-		createBuffer(bufferSize, 
-			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
+		*/
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+
+		VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+		mUniformRegionSize = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+		// with direct uploads, the shaders read the uniforms from device local memory rather than over the bus; they are only ever written with memcpy, never read back
+		VkMemoryPropertyFlags uniformProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		if (mDirectUpload)
+		{
+			uniformProperties |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		}
+
+		vk::Allocation allocation = createBuffer(mUniformRegionSize * sMaxSwapChainImages, 
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
+			uniformProperties, 
 			mUniformBuffer, 
 			mUniformBufferMemory);
+		mResidency.track("uniform buffer", allocation, false);
+
+		// the memory stays mapped until it is freed
+		void* data;
+		vkMapMemory(mDevice, mUniformBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+		mUniformData = static_cast<char*>(data);
 	}
 
-	//! creates a temporary command buffer for copying data between two buffers
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+	//! create the ring buffer that every upload copies its data through (see uploadBuffer and uploadTexture)
+	void createStagingRing()
 	{
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		mStagingRing.init(mDevice, mPhysicalDevice, VkDeviceSize(mSettings.stagingRingSize) * 1024 * 1024);
+		mResidency.track("staging ring", memoryAllocation(mStagingRing.memoryType(), mStagingRing.memorySize()), false);
+	}
+
+	/*
+
+	On integrated GPUs and software implementations, all memory is device local and host visible at the same
+	time, and on discrete GPUs with resizable BAR enabled the whole of VRAM can be mapped. Copying through a
+	staging buffer there only adds work: the data can be written straight into the memory the GPU reads it
+	from. Without resizable BAR, discrete GPUs usually still expose a small (256 MiB) device local, host visible
+	heap, which is too scarce to put whole buffers into, so the direct path is only chosen automatically if
+	that heap is as large as the largest device local heap.
+
+	*/
+
+	//! decide whether buffers are written directly into device local memory, see UploadPath
+	void chooseUploadPath()
+	{
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
+
+		VkDeviceSize largestDeviceLocalHeap = 0;
+		for (uint32_t i = 0; i < memProperties.memoryHeapCount; ++i)
+		{
+			if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			{
+				largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, memProperties.memoryHeaps[i].size);
+			}
+		}
+
+		const VkMemoryPropertyFlags direct = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		mDirectUploadAvailable = tryFindMemoryType(~0u, direct, mDirectUploadMemoryType);
 
-		// copy command
-		VkBufferCopy copyRegion = {};
-		copyRegion.srcOffset = 0; // optional
-		copyRegion.dstOffset = 0; // optional
-		copyRegion.size = size;
-		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+		VkDeviceSize directHeap = mDirectUploadAvailable ? memProperties.memoryHeaps[memProperties.memoryTypes[mDirectUploadMemoryType].heapIndex].size : 0;
+		bool largeHeap = mDirectUploadAvailable && directHeap >= largestDeviceLocalHeap;
 
-		endSingleTimeCommands(commandBuffer);
+		mDirectUpload = mSettings.uploadPath == UploadPath::Direct ? mDirectUploadAvailable : mSettings.uploadPath == UploadPath::Auto && largeHeap;
+
+		if (mDirectUpload)
+		{
+			std::cout << "Buffers are written directly into device local memory (memory type " << mDirectUploadMemoryType << ", heap of "
+				<< directHeap / (1024 * 1024) << " MiB)." << std::endl;
+		}
+		else
+		{
+			std::cout << "Buffers are uploaded through the staging ring" << (mDirectUploadAvailable ? "" : " (no memory type is both device local and host visible)") << "." << std::endl;
+		}
+	}
+
+	//! create a device local buffer that holds a copy of size bytes of data, written in place or uploaded through the staging ring (see chooseUploadPath)
+	vk::Allocation createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, vk::Buffer& buffer, vk::DeviceMemory& bufferMemory)
+	{
+		vk::Allocation allocation;
+		if (mDirectUpload)
+		{
+			allocation = createBuffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+			writeMappedMemory(bufferMemory, data, size);
+		}
+		else
+		{
+			allocation = createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+			uploadBuffer(data, size, buffer);
+		}
+		return allocation;
+	}
+
+	/*
+
+	Every allocation that outlives startup is tracked by the residency manager, against the budget of the
+	heap it comes from. The textures (except the first, which stands in for the others) are streamable:
+	when a heap goes over its budget, the ones that were drawn least recently are evicted and the materials
+	that use them fall back to the first texture. The model's vertex and index buffers hold every level of
+	detail of the only mesh in the scene, which every draw uses, so they are tracked but never evicted.
+
+	With VK_EXT_memory_budget, the driver reports the budget and usage of each heap, including what other
+	processes and the driver itself have allocated; they are refreshed every sMemoryBudgetInterval frames.
+	Without it, the budget is 80% of each heap, and the usage is what has been tracked. --memory-budget
+	limits the budget of device local heaps further, to see how the scene degrades when it doesn't fit.
+
+	*/
+
+	void initResidency()
+	{
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
+
+		mResidency.init(memProperties, 0.8, VkDeviceSize(mSettings.memoryBudget) * 1024 * 1024);
+		refreshMemoryBudget();
+	}
+
+	//! query the budget and usage of every heap, if VK_EXT_memory_budget is enabled
+	void refreshMemoryBudget()
+	{
+#ifdef VK_EXT_memory_budget
+		if (!mMemoryBudgetExtension)
+		{
+			return;
+		}
+
+		auto getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(mInstance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+		if (!getMemoryProperties2)
+		{
+			return;
+		}
+
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2KHR memProperties = {};
+		memProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		memProperties.pNext = &budget;
+
+		getMemoryProperties2(mPhysicalDevice, &memProperties);
+		mResidency.setReportedBudget(budget.heapBudget, budget.heapUsage);
+#endif
+	}
+
+	//! mark the textures that the next frame samples as used, and evict the least recently used ones while a heap is over its budget
+	void updateResidency()
+	{
+		uint64_t frame = mSubmittedFrame + 1;
+		for (uint32_t index : mUsedTextures)
+		{
+			mResidency.touch(mTextures[index].residency, frame);
+		}
+
+		if (frame % sMemoryBudgetInterval == 0)
+		{
+			refreshMemoryBudget();
+		}
+		mResidency.evictOverBudget();
+
+		// the frames that are in flight keep the evicted textures alive, but the next one has to be recorded without them
+		if (mTexturesEvicted)
+		{
+			mTexturesEvicted = false;
+			createDescriptorSet();
+			createCommandBuffers();
+		}
+	}
+
+	//! called by the residency manager: retire a texture's image, so that its materials are drawn with the first texture instead
+	void evictTexture(size_t index)
+	{
+		Texture& texture = mTextures[index];
+		std::cout << "Evicting " << TEXTURE_PATHS[index] << " to stay within the memory budget." << std::endl;
+
+		mDeletionQueue.retire(std::move(texture.view), mSubmittedFrame);
+		mDeletionQueue.retire(std::move(texture.image), mSubmittedFrame);
+		mDeletionQueue.retire(std::move(texture.memory), mSubmittedFrame);
+		texture.resident = false;
+		texture.residency = vk::ResidencyManager::sInvalidResource;
+		mTexturesEvicted = true;
+	}
+
+	//! copy data into host coherent memory: the writes are visible to the device by the time the next submission executes
+	void writeMappedMemory(VkDeviceMemory memory, const void* data, VkDeviceSize size)
+	{
+		// memory that is device local as well as host visible is usually write-combined: one sequential memcpy is the fastest way to fill it
+		void* mapped;
+		vkMapMemory(mDevice, memory, 0, size, 0, &mapped);
+		memcpy(mapped, data, (size_t)size);
+		vkUnmapMemory(mDevice, memory);
+	}
+
+	//! copy size bytes from CPU memory into a buffer, through the staging ring: uploads larger than maxAllocation are split into several copies
+	void uploadBuffer(const void* source, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0)
+	{
+		const char* bytes = static_cast<const char*>(source);
+		for (VkDeviceSize done = 0; done < size;)
+		{
+			VkDeviceSize chunk = std::min(size - done, mStagingRing.maxAllocation());
+			vk::StagingRing::Region region = mStagingRing.allocate(chunk);
+			memcpy(region.data, bytes + done, (size_t)chunk);
+
+			VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+			// copy command
+			VkBufferCopy copyRegion = {};
+			copyRegion.srcOffset = region.offset;
+			copyRegion.dstOffset = dstOffset + done;
+			copyRegion.size = chunk;
+			vkCmdCopyBuffer(commandBuffer, region.buffer, dstBuffer, 1, &copyRegion);
+
+			endSingleTimeCommands(commandBuffer, &region);
+			done += chunk;
+		}
 	}
 
 	//! record into a single-use command buffer
@@ -2219,7 +3552,7 @@ private:
 		VkCommandBufferAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = mCommandPool;
+		allocInfo.commandPool = singleTimeCommandPool();
 		allocInfo.commandBufferCount = 1;
 
 		VkCommandBuffer commandBuffer;
@@ -2234,8 +3567,8 @@ private:
 		return commandBuffer;
 	}
 
-	//! finish recording into a single-use command buffer
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer)
+	//! finish recording into a single-use command buffer, which copies from a region of the staging ring if one is given, and wait for it to execute
+	void endSingleTimeCommands(VkCommandBuffer commandBuffer, const vk::StagingRing::Region* stagingRegion = nullptr)
 	{
 		vkEndCommandBuffer(commandBuffer);
 
@@ -2245,14 +3578,55 @@ private:
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &commandBuffer;
 
-		vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(mGraphicsQueue); // wait for the transfer operation to finish
+		if (stagingRegion)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mGraphicsQueueMutex);
+				vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, stagingRegion->fence);
+			}
+			mBarrierCounters.submitted();
+
+			// only this copy is waited for, not the other threads' uploads; the region is free again as soon as the fence has signaled
+			VkFence fence = stagingRegion->fence;
+			vkWaitForFences(mDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+			mStagingRing.submitted(*stagingRegion);
+		}
+		else
+		{
+			// queues are externally synchronized, and startup stages on other threads may be submitting at the same time
+			std::lock_guard<std::mutex> lock(mGraphicsQueueMutex);
+			vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+			vkQueueWaitIdle(mGraphicsQueue); // wait for the transfer operation to finish
+			mBarrierCounters.submitted();
+		}
+
+		vkFreeCommandBuffers(mDevice, singleTimeCommandPool(), 1, &commandBuffer);
+	}
 
-		vkFreeCommandBuffers(mDevice, mCommandPool, 1, &commandBuffer);
+	//! the command pool that the calling thread allocates its single-use command buffers from
+	VkCommandPool singleTimeCommandPool()
+	{
+		uint32_t thread = jobs::JobSystem::currentThreadIndex();
+		if (thread >= mSingleTimeCommandPools.size())
+		{
+			throw std::runtime_error("Single-time commands can only be recorded on a job system thread.");
+		}
+		return mSingleTimeCommandPools[thread];
 	}
 
 	//! called from createVertexBuffer to find the appropriate memory type to use 
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+	{
+		uint32_t index;
+		if (!tryFindMemoryType(typeFilter, properties, index))
+		{
+			throw std::runtime_error("Failed to find a suitable memory type.");
+		}
+		return index;
+	}
+
+	//! like findMemoryType, but returns false instead of throwing if there is no such memory type
+	bool tryFindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, uint32_t& index)
 	{
 		/*
 		
@@ -2278,11 +3652,12 @@ private:
 			//	   define special features of the memory, like being able to map it from the CPU for writing)
 			if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) 
 			{
-				return i;
+				index = i;
+				return true;
 			}
 		}
 
-		throw std::runtime_error("Failed to find a suitable memory type.");
+		return false;
 	}
 
 	//! create command buffers, which record drawing or compute commands
@@ -2309,7 +3684,9 @@ private:
 		buffers. It specifies which state to inherit from the calling primary command buffers.
 
 		Drawing starts by beginning the render pass with vkCmdBeginRenderPass. The render pass is configured
-		using some parameters in a VkRenderPassBeginInfo structure.
+		using some parameters in a VkRenderPassBeginInfo structure. The render graph records this for every
+		pass of the frame, along with the barriers in front of it (see vk::RenderGraph::execute), and calls
+		back into the pass's record function in between.
 
 		Note how all commands in Vulkan begin with this vkCmd* prefix. The first parameter is always the command
 		buffer to record the command to. The second parameter specifies the details of the render pass we've just
@@ -2323,14 +3700,16 @@ private:
 
 		*/
 
-		// free any previous command buffers (this will happen via a call to recreateSwapChain)
+		// previous command buffers may still be executing (this will happen via a call to recreateSwapChain), so retire their pools instead of freeing them
 		if (mCommandBuffers.size() > 0)
 		{
-			vkFreeCommandBuffers(mDevice, mCommandPool, mCommandBuffers.size(), mCommandBuffers.data());
-			std::cout << "Freeing command buffers." << std::endl;
+			createRecordingCommandPools();
+			mSecondaryCommandBuffers.clear();
+			mPrepassCommandBuffers.clear();
+			std::cout << "Retiring command buffers." << std::endl;
 		}
 
-		mCommandBuffers.resize(mSwapChainFramebuffers.size());
+		mCommandBuffers.resize(mSwapChainImages.size());
 
 		VkCommandBufferAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -2343,6 +3722,29 @@ private:
 			throw std::runtime_error("Failed to allocate command buffers.");
 		}
 
+		allocateSecondaryCommandBuffers();
+
+		// the scene is a grid of copies of the model at the selected level of detail
+		mDrawCommands = layoutObjects(mSettings.objectCount);
+
+		// the textures that the draws sample, which are marked as used every frame (see updateResidency)
+		std::vector<bool> used(mTextures.size(), false);
+		for (const DrawCommand& draw : mDrawCommands)
+		{
+			used[mMaterials[draw.constants.materialIndex].textureIndex] = true;
+		}
+		mUsedTextures.clear();
+		for (uint32_t i = 0; i < used.size(); ++i)
+		{
+			if (used[i])
+			{
+				mUsedTextures.push_back(i);
+			}
+		}
+
+		// the draws are recorded on the worker threads first, since the primary command buffers only reference them
+		mSecondaryThreadCount = recordSecondaryCommandBuffers(mDrawCommands, mSwapChainImages.size());
+
 		for (size_t i = 0; i < mCommandBuffers.size(); i++)
 		{
 			VkCommandBufferBeginInfo beginInfo = {};
@@ -2353,66 +3755,326 @@ private:
 			// begin recording commands
 			vkBeginCommandBuffer(mCommandBuffers[i], &beginInfo);
 
-			VkRenderPassBeginInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = mRenderPass;
-			renderPassInfo.framebuffer = mSwapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = { 0, 0 };			// the size of the render area
-			renderPassInfo.renderArea.extent = mSwapChainExtent;
+			// the passes of the frame, rendering into the swap chain image with the same index, each one measured by the queries (if enabled)
+			mQueries.begin(mCommandBuffers[i], i);
+			mFrameBarriers = mRenderGraph.execute(mCommandBuffers[i], i, &mQueries);
+
+			// finish recording into the command buffer
+			if (vkEndCommandBuffer(mCommandBuffers[i]) != VK_SUCCESS) 
+			{
+				throw std::runtime_error("Failed to record command buffer.");
+			}
+		}
+	}
+
+	//! arrange count copies of the current level of detail in a square grid that fits within the model's bounding sphere, each with its own model matrix and material
+	std::vector<DrawCommand> layoutObjects(size_t count) const
+	{
+		const mesh::Lod& lod = mModelLods[mCurrentLod];
+		const size_t materialCount = mMaterials.size();
+
+		size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+		float spacing = 2.0f * mModelBoundingRadius / side;
+		float scale = 1.0f / side;
+
+		std::vector<DrawCommand> draws(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			float x = (i % side + 0.5f) * spacing - mModelBoundingRadius;
+			float y = (i / side + 0.5f) * spacing - mModelBoundingRadius;
+
+			draws[i].indexCount = lod.indexCount;
+			draws[i].firstIndex = lod.firstIndex;
+			draws[i].constants.model = count > 1 ? glm::scale(glm::translate(glm::mat4(), glm::vec3(x, y, 0.0f)), glm::vec3(scale)) : glm::mat4();
+			draws[i].constants.materialIndex = static_cast<uint32_t>(i % materialCount);
+		}
+
+		return draws;
+	}
+
+	//! allocate one secondary command buffer per swap chain image and pass from each recording thread's command pool
+	void allocateSecondaryCommandBuffers()
+	{
+		mSecondaryCommandBuffers.resize(mThreadCommandPools.size());
+		mPrepassCommandBuffers.resize(mThreadCommandPools.size());
+
+		for (size_t thread = 0; thread < mThreadCommandPools.size(); ++thread)
+		{
+			// the depth prepass's are allocated even while it's off, they're only recorded when it's on
+			for (auto* commandBuffers : { &mSecondaryCommandBuffers[thread], &mPrepassCommandBuffers[thread] })
+			{
+				commandBuffers->resize(mSwapChainImages.size());
+
+				VkCommandBufferAllocateInfo allocInfo = {};
+				allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				allocInfo.commandPool = mThreadCommandPools[thread];
+				allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+				allocInfo.commandBufferCount = (uint32_t)commandBuffers->size();
 
-			// we now have multiple attachments with VK_ATTACHMENT_LOAD_OP_CLEAR, so we need to specify multiple clear values
-			std::array<VkClearValue, 2> clearValues = {};
-			clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-			clearValues[1].depthStencil = { 1.0f, 0 };
+				if (vkAllocateCommandBuffers(mDevice, &allocInfo, commandBuffers->data()) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to allocate secondary command buffers.");
+				}
+			}
+		}
+	}
 
-			renderPassInfo.clearValueCount = clearValues.size();
-			renderPassInfo.pClearValues = clearValues.data();
+	//! record the draws into the secondary command buffers of the first imageCount swap chain images on up to maxThreads threads, returning the number of threads used
+	size_t recordSecondaryCommandBuffers(const std::vector<DrawCommand>& draws, size_t imageCount, size_t maxThreads = std::numeric_limits<size_t>::max())
+	{
+		/*
 
-			// begin the render pass
-			vkCmdBeginRenderPass(mCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		Command pools are externally synchronized: two threads may never record into command buffers
+		that were allocated from the same pool at the same time. That is why every range of draws owns
+		its own pool (see createCommandPool) and only ever touches the command buffers allocated from it.
+		The ranges are recorded as jobs on the job system, so whichever thread picks a range up is the
+		only one using its pool at that moment.
 
-			// bind the graphics pipeline: notice the second parameter which tells Vulkan that this is a graphics (not compute) pipeline
-			vkCmdBindPipeline(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mGraphicsPipeline);
+		The draws are split into contiguous ranges, one per recording thread. A secondary command buffer does not
+		inherit any bound state from the primary command buffer that executes it, so every range binds the
+		pipeline, descriptor set, and vertex and index buffers itself. The descriptor set is bound once, with
+		the dynamic offset of the swap chain image's uniforms, and each draw only pushes its own constants. The VkCommandBufferInheritanceInfo
+		tells the driver which render pass, subpass and framebuffer the secondary command buffer will be
+		executed in.
 
-			// bind the uniform buffer
-			vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mDescriptorSet, 0, nullptr);
+		Resetting a whole pool is cheaper than resetting its command buffers one by one. The caller must
+		make sure that none of the secondary command buffers are still executing on the GPU.
 
-			// bind the vertex buffer
-			VkBuffer vertexBuffers[] = { mVertexBuffer };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(mCommandBuffers[i], 0, 1, vertexBuffers, offsets);
+		*/
 
-			// bind the index buffer
-			vkCmdBindIndexBuffer(mCommandBuffers[i], mIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		size_t threadCount = std::min({ mThreadCommandPools.size(), maxThreads, std::max<size_t>(draws.size(), 1) });
+		size_t drawsPerThread = (draws.size() + threadCount - 1) / threadCount;
 
-			// actual draw command:
-			// index count
-			// instance count
-			// first index
-			// first instance
-			vkCmdDrawIndexed(mCommandBuffers[i], mModelIndices.size(), 1, 0, 0, 0);
+		for (size_t thread = 0; thread < threadCount; ++thread)
+		{
+			vkResetCommandPool(mDevice, mThreadCommandPools[thread], 0);
+		}
 
-			// end the render pass
-			vkCmdEndRenderPass(mCommandBuffers[i]);
+		auto recordRange = [&](size_t thread)
+		{
+			size_t first = std::min(thread * drawsPerThread, draws.size());
+			size_t last = std::min(first + drawsPerThread, draws.size());
 
-			// finish recording into the command buffer
-			if (vkEndCommandBuffer(mCommandBuffers[i]) != VK_SUCCESS) 
+			for (size_t i = 0; i < imageCount; ++i)
 			{
-				throw std::runtime_error("Failed to record command buffer.");
+				recordDraws(mSecondaryCommandBuffers[thread][i], mMainPass, i, mGraphicsPipeline, mVertexBuffer, draws, first, last);
+
+				// the prepass draws the same range, so each thread's share of the work stays the same
+				if (mDepthPrepass)
+				{
+					recordDraws(mPrepassCommandBuffers[thread][i], mPrepass, i, mDepthPipeline, mPositionBuffer, draws, first, last);
+				}
+			}
+		};
+
+		// the calling thread records ranges itself while it waits, so a single range never leaves this thread
+		mJobs.parallelFor(threadCount, recordRange);
+
+		return threadCount;
+	}
+
+	//! record the draws [first, last) into a secondary command buffer that is executed in a pass of the render graph, for the given swap chain image
+	void recordDraws(VkCommandBuffer commandBuffer, vk::RenderGraph::PassId pass, size_t image, VkPipeline pipeline, VkBuffer vertexBuffer,
+		const std::vector<DrawCommand>& draws, size_t first, size_t last)
+	{
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = mRenderGraph.renderPass(pass);
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = mRenderGraph.framebuffer(pass, static_cast<uint32_t>(image));
+		mQueries.inheritance(inheritanceInfo);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+		// bind the graphics pipeline: notice the second parameter which tells Vulkan that this is a graphics (not compute) pipeline
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+		// the viewport and scissor rectangle are dynamic state: draw the entire framebuffer
+		VkViewport viewport = { 0.0f, 0.0f, (float)mSwapChainExtent.width, (float)mSwapChainExtent.height, 0.0f, 1.0f };
+		VkRect2D scissor = { { 0, 0 }, mSwapChainExtent };
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		// bind the uniform buffer, selecting this swap chain image's copy of the uniforms
+		uint32_t dynamicOffset = static_cast<uint32_t>(image * mUniformRegionSize);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mDescriptorSet, 1, &dynamicOffset);
+
+		// bind the vertex buffer
+		VkBuffer vertexBuffers[] = { vertexBuffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+		// bind the index buffer
+		vkCmdBindIndexBuffer(commandBuffer, mIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+		// actual draw commands:
+		// index count
+		// instance count
+		// first index
+		// vertex offset
+		// first instance
+		for (size_t draw = first; draw < last; ++draw)
+		{
+			vkCmdPushConstants(commandBuffer, mPipelineLayout, mPushConstantRange.stageFlags, mPushConstantRange.offset, mPushConstantRange.size,
+				reinterpret_cast<const char*>(&draws[draw].constants) + mPushConstantRange.offset);
+			vkCmdDrawIndexed(commandBuffer, draws[draw].indexCount, 1, draws[draw].firstIndex, 0, 0);
+		}
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to record secondary command buffer.");
+		}
+	}
+
+	//! measure how long it takes to record 10,000 draws with an increasing number of recording threads
+	void benchmarkCommandRecording()
+	{
+		/*
+
+		Every draw re-uses the currently selected level of detail, with its own push constants. Only the secondary command buffers of the
+		first swap chain image are recorded, and nothing is submitted, so the numbers reflect CPU recording
+		cost alone. Each thread count is measured several times and both the average and the best time are
+		reported.
+
+		*/
+
+		const size_t drawCount = 10000;
+		const size_t iterations = 20;
+
+		vkDeviceWaitIdle(mDevice);
+
+		std::vector<DrawCommand> draws = layoutObjects(drawCount);
+
+		std::vector<size_t> threadCounts;
+		for (size_t threads = 1; threads < mThreadCommandPools.size(); threads *= 2)
+		{
+			threadCounts.push_back(threads);
+		}
+		threadCounts.push_back(mThreadCommandPools.size());
+
+		std::cout << "Recording benchmark: " << drawCount << " draws, " << iterations << " iterations per thread count." << std::endl;
+
+		for (size_t threads : threadCounts)
+		{
+			double total = 0.0;
+			double best = std::numeric_limits<double>::max();
+			for (size_t iteration = 0; iteration < iterations; ++iteration)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				recordSecondaryCommandBuffers(draws, 1, threads);
+				auto end = std::chrono::high_resolution_clock::now();
+
+				double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+				total += milliseconds;
+				best = std::min(best, milliseconds);
 			}
+
+			std::cout << "\t" << threads << " thread(s): " << total / iterations << " ms average, " << best << " ms best per " << drawCount << " draws" << std::endl;
 		}
 	}
 	
+	//! compare uploading buffers through the staging ring with writing them directly into device local memory
+	void benchmarkUploadPaths()
+	{
+		/*
+
+		Every size is uploaded into a buffer that already exists, so only moving the data is measured. The
+		staged path copies into the staging ring and waits for the GPU's copy to execute; the direct path
+		maps the buffer's memory and writes it. Either way, the data is ready for the GPU to read at the end.
+
+		*/
+
+		const VkDeviceSize sizes[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+		const size_t iterations = 20;
+
+		vkDeviceWaitIdle(mDevice);
+
+		std::vector<char> data(static_cast<size_t>(sizes[2]));
+		for (size_t i = 0; i < data.size(); ++i)
+		{
+			data[i] = static_cast<char>(i * 31);
+		}
+
+		std::cout << "Upload benchmark: " << iterations << " iterations per size, " << (mDirectUpload ? "direct" : "staged") << " uploads are in use." << std::endl;
+		if (!mDirectUploadAvailable)
+		{
+			std::cout << "\tNo memory type is both device local and host visible, so only the staged path is measured." << std::endl;
+		}
+
+		auto milliseconds = [](std::chrono::high_resolution_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		};
+
+		std::cout << std::fixed << std::setprecision(3);
+		for (VkDeviceSize size : sizes)
+		{
+			vk::Buffer stagedBuffer;
+			vk::DeviceMemory stagedMemory;
+			createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, stagedBuffer, stagedMemory);
+
+			profiler::RunningStats staged;
+			for (size_t iteration = 0; iteration < iterations; ++iteration)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				uploadBuffer(data.data(), size, stagedBuffer);
+				staged.add(milliseconds(start));
+			}
+
+			std::cout << "\t" << std::setw(6) << size / 1024 << " KiB: staged " << std::setw(8) << staged.mean() << " ms mean, " << std::setw(8) << staged.min() << " ms best";
+
+			if (mDirectUploadAvailable)
+			{
+				vk::Buffer directBuffer;
+				vk::DeviceMemory directMemory;
+				createBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, directBuffer, directMemory);
+
+				profiler::RunningStats direct;
+				for (size_t iteration = 0; iteration < iterations; ++iteration)
+				{
+					auto start = std::chrono::high_resolution_clock::now();
+					writeMappedMemory(directMemory, data.data(), size);
+					direct.add(milliseconds(start));
+				}
+
+				std::cout << "; direct " << std::setw(8) << direct.mean() << " ms mean, " << std::setw(8) << direct.min() << " ms best (" << staged.mean() / direct.mean() << "x)";
+			}
+			std::cout << std::endl;
+		}
+		std::cout.unsetf(std::ios_base::floatfield);
+	}
+
 	//! create semaphores, which are used to synchronize operations within or across command queues
 	void createSemaphores()
 	{
+		/*
+
+		Every frame that may be in flight at the same time needs its own pair of semaphores: a semaphore
+		can't be signaled again by the next vkAcquireNextImageKHR while the previous frame's submission
+		still waits on it. The old semaphores may still be in use, so they are retired instead of destroyed.
+
+		*/
+
+		mDeletionQueue.retire(mImageAvailableSemaphores, mSubmittedFrame);
+		mDeletionQueue.retire(mRenderFinishedSemaphores, mSubmittedFrame);
+		mImageAvailableSemaphores.resize(mLatencyPolicy.framesInFlight);
+		mRenderFinishedSemaphores.resize(mLatencyPolicy.framesInFlight);
+
 		VkSemaphoreCreateInfo semaphoreInfo = {};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-		if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mImageAvailableSemaphore) != VK_SUCCESS ||
-			vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mRenderFinishedSemaphore) != VK_SUCCESS) 
+		for (uint32_t i = 0; i < mLatencyPolicy.framesInFlight; ++i)
 		{
-			throw std::runtime_error("Failed to create semaphores.");
+			if (vkCreateSemaphore(mDevice, &semaphoreInfo, vk::allocationCallbacks(), mImageAvailableSemaphores[i].replace(mDevice)) != VK_SUCCESS ||
+				vkCreateSemaphore(mDevice, &semaphoreInfo, vk::allocationCallbacks(), mRenderFinishedSemaphores[i].replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create semaphores.");
+			}
 		}
 
 		std::cout << "Successfully created semaphore objects." << std::endl;
@@ -2447,7 +4109,7 @@ private:
 		available. Using the maximum value of a 64-bit unsigned integer disables the timeout. The next two parameters
 		specify synchronization objects that are to be signaled when the presentation engine is finished using
 		the image. That's the point in time where we can start drawing to it. It is possible to specify a semaphore,
-		fence, or both. We're going to use our mImageAvailableSemaphore for that purpose.
+		fence, or both. We're going to use the image available semaphore of the frame's slot for that purpose.
 
 		The last parameter specifies a variable to output the index of the swap chain image that has become 
 		available. The index refers to the VkImage in our mSwapChainImages array. We're going to use that index
@@ -2465,24 +4127,40 @@ private:
 		we should submit the command buffer that binds the swap chain image we just acquired as color attachment.
 
 		The signalSemaphoreCount and pSignalSemaphores parameters specify which semaphores to signal once the 
-		command buffer(s) have finished execution. In our case we're using the mRenderFinishedSemaphore for that purpose.
+		command buffer(s) have finished execution. In our case we're using the render finished semaphore of the frame's slot for that purpose.
 
 		We can now submit the command buffer to the graphics queue using vkQueueSubmit. The function takes an array of 
 		VkSubmitInfo structures as argument for efficiency when the workload is much larger. The last parameter references 
-		an optional fence that will be signaled when the command buffers finish execution. We're using semaphores for 
-		synchronization, so we'll just pass a VK_NULL_HANDLE.
+		an optional fence that will be signaled when the command buffers finish execution. Semaphores take care of 
+		synchronizing the queue operations, but we do pass a fence: it tells us when the frame has completed, which
+		is when the objects that were retired while it was in flight can finally be destroyed.
 
 		The last step of drawing a frame is submitting the result back to the swap chain to have it eventually show 
 		up on the screen. Presentation is configured through a VkPresentInfoKHR structure.
 
 		*/
 		
+		// destroy whatever the frames that have completed since the last call were the last to use
+		collectCompletedFrames();
+
+		// the latency profile limits how far the CPU may run ahead: wait for the oldest frame if too many are queued
+		while (mFramesInFlight.size() >= mLatencyPolicy.framesInFlight)
+		{
+			waitForFrame(mFramesInFlight.front().frame);
+		}
+
+		// the semaphores of this slot were last used framesInFlight frames ago, which has completed by now
+		size_t slot = (mSubmittedFrame + 1) % mLatencyPolicy.framesInFlight;
+		VkSemaphore imageAvailableSemaphore = mImageAvailableSemaphores[slot];
+		VkSemaphore renderFinishedSemaphore = mRenderFinishedSemaphores[slot];
+
 		// retrieve an image from the swap chain: it is possible for Vulkan to tell us that the swap chain is no longer compatible during presentation
 		uint32_t imageIndex;
-		VkResult result = vkAcquireNextImageKHR(mDevice, mSwapChain, std::numeric_limits<uint64_t>::max(), mImageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+		VkResult result = vkAcquireNextImageKHR(mDevice, mSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 		if (result == VK_ERROR_OUT_OF_DATE_KHR)
 		{
-			recreateSwapChain();
+			// nothing has been acquired, so the swap chain can be recreated at the start of the next frame
+			mResizePending = true;
 			return;
 		}
 		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) // continue if we receive VK_SUBOPTIMAL_KHR...
@@ -2490,11 +4168,13 @@ private:
 			throw std::runtime_error("Failed to acquire swap chain image.");
 		}
 
+		updateUniformBuffer(imageIndex);
+
 		VkSubmitInfo submitInfo = {};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 		// prepare the queue for submission
-		VkSemaphore waitSemaphores[] = { mImageAvailableSemaphore };
+		VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
 		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 		submitInfo.waitSemaphoreCount = 1;
 		submitInfo.pWaitSemaphores = waitSemaphores;
@@ -2502,14 +4182,19 @@ private:
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &mCommandBuffers[imageIndex];
 
-		VkSemaphore signalSemaphores[] = { mRenderFinishedSemaphore };
+		VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
 		submitInfo.signalSemaphoreCount = 1;
 		submitInfo.pSignalSemaphores = signalSemaphores;
 
-		if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) 
+		vk::Fence frameFence = acquireFrameFence();
+		if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, frameFence) != VK_SUCCESS) 
 		{
 			throw std::runtime_error("Failed to submit draw command buffer.");
 		}
+		mBarrierCounters.recorded(mFrameBarriers);								// the frame's command buffer was recorded once, but its barriers execute every time
+		mBarrierCounters.submitted();
+		mFramesInFlight.push_back({ ++mSubmittedFrame, std::move(frameFence), std::chrono::high_resolution_clock::now() });
+		mQueries.submitted(imageIndex, mSubmittedFrame);
 
 		// configure presentation 
 		VkPresentInfoKHR presentInfo = {};
@@ -2525,9 +4210,18 @@ private:
 
 		// similar to vkAcquireNextImageKHR, we check the result of presenting the newly rendered image and take action if necessary
 		result = vkQueuePresentKHR(mPresentQueue, &presentInfo);
+
+		// with FIFO, vkQueuePresentKHR (or the next acquire) blocks until the display is ready, so the time between presents shows the pacing
+		auto presentTime = std::chrono::high_resolution_clock::now();
+		if (mLastPresent != std::chrono::high_resolution_clock::time_point())
+		{
+			mPresentIntervals.add(std::chrono::duration<double, std::milli>(presentTime - mLastPresent).count());
+		}
+		mLastPresent = presentTime;
+
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
 		{
-			recreateSwapChain();
+			mResizePending = true;
 		}
 		else if (result != VK_SUCCESS)
 		{
@@ -2535,102 +4229,285 @@ private:
 		}
 	}
 
+	//! an unsignaled fence for the next frame's submission, reusing the fences of completed frames
+	vk::Fence acquireFrameFence()
+	{
+		vk::Fence fence;
+
+		if (!mFreeFences.empty())
+		{
+			fence = std::move(mFreeFences.back());
+			mFreeFences.pop_back();
+			return fence;
+		}
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(mDevice, &fenceInfo, vk::allocationCallbacks(), fence.replace(mDevice)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create frame fence.");
+		}
+
+		return fence;
+	}
+
+	//! find the frames that have completed on the GPU (without waiting) and destroy the objects retired up to the last of them
+	void collectCompletedFrames()
+	{
+		// the queue executes submissions in order, so the first fence that isn't signaled yet ends the search
+		while (!mFramesInFlight.empty() && vkGetFenceStatus(mDevice, mFramesInFlight.front().fence) == VK_SUCCESS)
+		{
+			SubmittedFrame& frame = mFramesInFlight.front();
+			mCompletedFrame = frame.frame;
+			mQueueLatencies.add(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frame.submitTime).count());
+
+			VkFence fence = frame.fence;
+			vkResetFences(mDevice, 1, &fence);
+			mFreeFences.push_back(std::move(frame.fence));
+			mFramesInFlight.pop_front();
+		}
+
+		mDeletionQueue.collect(mCompletedFrame);
+		mQueries.collect(mCompletedFrame);
+	}
+
+	//! block until the given frame has completed on the GPU, then collect it like collectCompletedFrames
+	void waitForFrame(uint64_t frame)
+	{
+		while (mCompletedFrame < frame && !mFramesInFlight.empty())
+		{
+			VkFence oldestFence = mFramesInFlight.front().fence;
+			vkWaitForFences(mDevice, 1, &oldestFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			collectCompletedFrames();
+		}
+	}
+
 	//! rebuilds the entire swap chain 
 	void recreateSwapChain()
 	{
 		/*
 		
-		If the window size changes, our swap chain will no longer be compatible with the window surface. We
-		first call vkDeviceWaitIdle to ensure that we don't touch any resources that may still be in use.
+		If the window size changes, our swap chain will no longer be compatible with the window surface. This
+		is only ever called at a frame boundary (see renderFrame), so no image of the old swap chain is
+		acquired but not yet submitted.
 
 		Obviously, the first thing we'll have to do is recreate the swap chain itself. The image views need 
-		to be recreated because they are based directly on the swap chain images. The render pass needs to be 
-		recreated because it depends on the format of the swap chain images. Viewport and scissor rectangle 
-		size is specified during graphics pipeline creation, so the pipeline also needs to be rebuilt. It is
-		possible to avoid this by using dynamic state for the viewports and scissor rectangles. Finally, the 
-		framebuffers and command buffers also directly depend on the swap chain images.
+		to be recreated because they are based directly on the swap chain images. The render graph's render
+		passes depend on the format of the swap chain images, which normally stays the same, so the graph (and
+		the pipeline that was created for its render pass) is only rebuilt if the format changed. The viewport
+		and scissor rectangle are dynamic state, so a new size alone doesn't require a new pipeline. Finally, the
+		graph's transient images, its framebuffers and the command buffers directly depend on the swap chain
+		images and their size.
+
+		Instead of waiting for the whole device to become idle, every object that is about to be replaced is
+		retired to the deletion queue, tagged with the last frame that was submitted. The frames that are still
+		in flight keep using the old objects, and they are destroyed once those frames have completed.
 
 		*/
 
-		vkDeviceWaitIdle(mDevice);
+		uint64_t lastUse = mSubmittedFrame;
+		VkFormat previousFormat = mSwapChainImageFormat;
 
 		createSwapChain();
+
+		mDeletionQueue.retire(mSwapChainImageViews, lastUse);
 		createImageViews();
-		createRenderPass();
+
+		if (mSwapChainImageFormat != previousFormat)
+		{
+			rebuildRenderGraph(lastUse);
+		}
+		else
+		{
+			mRenderGraph.retireResources(mDeletionQueue, lastUse);
+			createRenderGraphResources();
+		}
+
+		createCommandBuffers();
+
+		std::cout << "Recreated swap chain at " << mSwapChainExtent.width << " x " << mSwapChainExtent.height << ", " << mDeletionQueue.size() << " objects awaiting destruction." << std::endl;
+	}
+
+	//! replace the render graph, along with the pipelines that were created for its render passes
+	void rebuildRenderGraph(uint64_t lastUse)
+	{
+		mRenderGraph.retire(mDeletionQueue, lastUse);
+		mPipelineRegistry.retireAll(mDeletionQueue, lastUse);
+		mDeletionQueue.retire(std::move(mPipelineLayout), lastUse);
+		createRenderGraph();
 		createGraphicsPipeline();
-		createDepthResource();
-		createFramebuffers();
+	}
+
+	//! switch the depth prepass on or off at a frame boundary: the frames in flight keep using the previous passes and pipelines
+	void setDepthPrepass(bool enabled)
+	{
+		mDepthPrepass = mDepthPrepassRequested = enabled && depthPrepassSupported();
+		rebuildRenderGraph(mSubmittedFrame);
 		createCommandBuffers();
+
+		std::cout << "Depth prepass " << (mDepthPrepass ? "enabled" : "disabled") << "." << std::endl;
 	}
 
 	/* General */
+	AppSettings mSettings;
+	jobs::JobSystem mJobs;																// the thread that constructs the app becomes thread 0 of the job system
 	GLFWwindow *mWindow;
 	const int mWidth = 800;
 	const int mHeight = 600;
+
+	/* Resize related */
+	struct ResizeStats
+	{
+		uint32_t events = 0;
+		uint32_t recreations = 0;
+		double worstFrameMs = 0.0;
+		double worstRecreationMs = 0.0;
+	};
+
+	int mWindowWidth = mWidth;															// the latest size reported by GLFW, which the swap chain may not have caught up with yet
+	int mWindowHeight = mHeight;
+	bool mResizePending = false;
+	ResizeStats mResizeStats;
+	std::chrono::high_resolution_clock::time_point mLastResizeEvent;
+	std::chrono::high_resolution_clock::time_point mLastFrameEnd;
+
+	/* Latency related */
+	LatencyPolicy mLatencyPolicy;
+	double mFrameLimit = 0.0;															// frames per second, 0 for no limit
+	std::chrono::high_resolution_clock::time_point mNextFrameDeadline;
+	std::chrono::high_resolution_clock::time_point mLastPresent;
+	profiler::RunningStats mPresentIntervals;											// milliseconds between successive presents
+	profiler::RunningStats mQueueLatencies;												// milliseconds from submission until the frame's fence was seen signaled
 	
 	/* Instance, device, and surface related */
-	vk::Deleter<VkInstance> mInstance{ vkDestroyInstance };
-	vk::Deleter<VkSurfaceKHR> mSurface{ mInstance, vkDestroySurfaceKHR };
+	vk::Instance mInstance;
+	vk::SurfaceKHR mSurface;
 	VkPhysicalDevice mPhysicalDevice{ VK_NULL_HANDLE };									// implicitly destroyed when the VkInstance is destroyed, so we don't need to add a delete wrapper
-	vk::Deleter<VkDevice> mDevice{ vkDestroyDevice };									// needs to be declared below the VkInstance, since it must be destroyed before the instance is cleaned up
+	vk::Device mDevice;									// needs to be declared below the VkInstance, since it must be destroyed before the instance is cleaned up
 	
 	/* Queue related */
 	VkQueue mGraphicsQueue;																// automatically created and destroyed alongside the logical device
 	VkQueue mPresentQueue;
 	
 	/* Swap chain related */
-	vk::Deleter<VkSwapchainKHR> mSwapChain{ mDevice, vkDestroySwapchainKHR };
+	vk::SwapchainKHR mSwapChain;
 	std::vector<VkImage> mSwapChainImages;												// automatically destroyed alongside the swap chain
 	VkFormat mSwapChainImageFormat;
 	VkExtent2D mSwapChainExtent;
-	std::vector<vk::Deleter<VkImageView>> mSwapChainImageViews;							// unlike VkImages, VkImageView objects are created by us so we need to clean them up ourselves
+	std::vector<vk::ImageView> mSwapChainImageViews;							// unlike VkImages, VkImageView objects are created by us so we need to clean them up ourselves
+
+	/* Render graph related */
+	vk::RenderGraph mRenderGraph;														// the passes of a frame, with their render passes, attachments and framebuffers
+	vk::RenderGraph::ResourceId mBackbuffer = 0;										// the swap chain images
+	vk::RenderGraph::ResourceId mDepth = 0;												// transient
+	vk::RenderGraph::PassId mMainPass = 0;
+	vk::RenderGraph::PassId mPrepass = 0;												// only if mDepthPrepass
+	std::vector<vk::ResidencyManager::ResourceId> mTransientResidency;					// the memory behind the graph's transient images
 
 	/* Graphics pipeline related */
-	vk::Deleter<VkRenderPass> mRenderPass{ mDevice, vkDestroyRenderPass };
-	vk::Deleter<VkDescriptorSetLayout> mDescriptorSetLayout{ mDevice, vkDestroyDescriptorSetLayout };
-	vk::Deleter<VkDescriptorPool> mDescriptorPool{ mDevice, vkDestroyDescriptorPool };
+	vk::DescriptorSetLayoutCache mDescriptorSetLayoutCache;								// owns every descriptor set layout
+	VkDescriptorSetLayout mDescriptorSetLayout = VK_NULL_HANDLE;
+	VkPushConstantRange mPushConstantRange = {};										// reflected from the shaders
+	vk::DescriptorAllocator mDescriptorAllocator;										// persistent sets, never reset (nothing allocates per-frame sets yet)
+	vk::DescriptorSetCache mDescriptorSetCache{ mDescriptorAllocator };
 	VkDescriptorSet mDescriptorSet;
-	vk::Deleter<VkPipelineLayout> mPipelineLayout{ mDevice, vkDestroyPipelineLayout };	// for describing uniform layouts: should be destroyed before the render pass above
-	vk::Deleter<VkPipeline> mGraphicsPipeline{ mDevice, vkDestroyPipeline };
-	std::vector<vk::Deleter<VkFramebuffer>> mSwapChainFramebuffers;
+	vk::PipelineLayout mPipelineLayout;	// for describing uniform layouts
+	vk::ShaderModule mVertShaderModule;													// shared by every pipeline variant
+	vk::ShaderModule mFragShaderModule;
+	vk::ShaderModule mDepthShaderModule;												// loaded when the depth prepass is first enabled
+	VkPipeline mDepthPipeline = VK_NULL_HANDLE;
+	bool mDepthPrepass = false;															// whether the render graph has a depth prepass
+	bool mDepthPrepassRequested = false;												// applied at the next frame boundary, see renderFrame
+	vk::PipelineRegistry mPipelineRegistry;												// owns every graphics pipeline
+	VkPipeline mGraphicsPipeline = VK_NULL_HANDLE;										// the selected variant
 	
 	/* Buffers and device memory related */
-	vk::Deleter<VkBuffer> mVertexBuffer{ mDevice, vkDestroyBuffer };
-	vk::Deleter<VkDeviceMemory> mVertexBufferMemory{ mDevice, vkFreeMemory };
-	vk::Deleter<VkBuffer> mIndexBuffer{ mDevice, vkDestroyBuffer };
-	vk::Deleter<VkDeviceMemory> mIndexBufferMemory{ mDevice, vkFreeMemory };
-	vk::Deleter<VkBuffer> mUniformStagingBuffer{ mDevice, vkDestroyBuffer };
-	vk::Deleter<VkDeviceMemory> mUniformStagingBufferMemory{ mDevice, vkFreeMemory };
-	vk::Deleter<VkBuffer> mUniformBuffer{ mDevice, vkDestroyBuffer };
-	vk::Deleter<VkDeviceMemory> mUniformBufferMemory{ mDevice, vkFreeMemory };
+	vk::StagingRing mStagingRing;														// every upload's staging memory
+	bool mDirectUpload = false;															// whether buffers are written in place instead of staged (see chooseUploadPath)
+	uint32_t mDirectUploadMemoryType = 0;												// a device local, host visible and host coherent type, if mDirectUploadAvailable
+	bool mDirectUploadAvailable = false;
+	vk::Buffer mVertexBuffer;
+	vk::DeviceMemory mVertexBufferMemory;
+	vk::Buffer mIndexBuffer;
+	vk::DeviceMemory mIndexBufferMemory;
+	vk::Buffer mPositionBuffer;															// the positions of mVertexBuffer alone, for the depth prepass
+	vk::DeviceMemory mPositionBufferMemory;
+	static const uint32_t sMaxSwapChainImages = 8;										// the number of copies of the uniforms in mUniformBuffer
+	vk::Buffer mUniformBuffer;
+	vk::DeviceMemory mUniformBufferMemory;
+	char* mUniformData = nullptr;														// persistently mapped
+	VkDeviceSize mUniformRegionSize = 0;												// the size of one copy, aligned for use as a dynamic offset
+	std::array<uint64_t, sMaxSwapChainImages> mUniformRegionFrames = {};				// the last frame that read each copy
 	
-	/* Depth attachment related */
-	vk::Deleter<VkImage> mDepthImage{ mDevice, vkDestroyImage };
-	vk::Deleter<VkDeviceMemory> mDepthImageMemory{ mDevice, vkFreeMemory };
-	vk::Deleter<VkImageView> mDepthImageView{ mDevice, vkDestroyImageView };
+	/* Device memory budget related */
+	vk::ResidencyManager mResidency;													// every long-lived allocation, see initResidency
+	bool mMemoryBudgetExtension = false;												// whether VK_EXT_memory_budget is enabled on the device
+	bool mEvictionAllowed = false;														// set once startup is over, see allocateMemory
+	bool mTexturesEvicted = false;														// the descriptor set and command buffers still reference evicted textures
+	std::vector<uint32_t> mUsedTextures;												// the textures that the recorded draws sample
+	static const uint64_t sMemoryBudgetInterval = 60;									// the frames between queries of VK_EXT_memory_budget
 
 	/* Textures and samplers related */
-	vk::Deleter<VkImage> mTextureImage{ mDevice, vkDestroyImage };
-	vk::Deleter<VkDeviceMemory> mTextureImageMemory{ mDevice, vkFreeMemory };
-	vk::Deleter<VkImageView> mTextureImageView{ mDevice, vkDestroyImageView };
-	vk::Deleter<VkSampler> mTextureSampler{ mDevice, vkDestroySampler };
+	std::vector<Texture> mTextures;														// indexed by Material::textureIndex
+	vk::Sampler mTextureSampler;														// shared by all textures
+	uint32_t mTextureSlotCount = 0;														// the size of the texture array in the descriptor set
+	bool mBindlessTextures = false;														// whether the texture array uses VK_EXT_descriptor_indexing
+	bool mPhysicalDeviceProperties2 = false;											// whether VK_KHR_get_physical_device_properties2 is enabled on the instance
+
+	/* Material related */
+	std::vector<Material> mMaterials;
+	vk::Buffer mMaterialBuffer;
+	vk::DeviceMemory mMaterialBufferMemory;
 
 	/* 3D model related*/
+	std::unique_ptr<assets::ArchiveReader> mAssetArchive;								// only if the assets are loaded from an archive (--archive)
 	std::vector<Vertex> mModelVertices;
-	std::vector<uint32_t> mModelIndices;
+	std::vector<uint32_t> mModelIndices;												// the indices of all levels of detail, one after another
+	std::vector<mesh::Lod> mModelLods;													// finest to coarsest
+	size_t mCurrentLod = 0;
+	float mModelBoundingRadius = 0.0f;
+
+	/* Camera related */
+	const glm::vec3 mEyePosition{ 2.0f, 2.0f, 2.0f };
+	const float mFieldOfView = glm::radians(45.0f);
 
 	/* Command pool related */
-	vk::Deleter<VkCommandPool> mCommandPool{ mDevice, vkDestroyCommandPool };
+	vk::CommandPool mCommandPool;
 	std::vector<VkCommandBuffer> mCommandBuffers;										// automatically freed when the VkCommandPool is destroyed
+	std::vector<vk::CommandPool> mThreadCommandPools;						// one per recording thread, since command pools are externally synchronized
+	std::vector<std::vector<VkCommandBuffer>> mSecondaryCommandBuffers;					// indexed by [recording thread][swap chain image]
+	std::vector<std::vector<VkCommandBuffer>> mPrepassCommandBuffers;					// the same, for the depth prepass
+	size_t mSecondaryThreadCount = 0;													// the threads that recorded the secondary command buffers
+	vk::BarrierStats mFrameBarriers;													// what the render graph recorded into each of mCommandBuffers
+	vk::BarrierCounters mBarrierCounters;												// per frame, and at startup
+	vk::QueryProfiler mQueries;															// occlusion and pipeline statistics queries around each pass, with --query-stats
+	std::vector<DrawCommand> mDrawCommands;
+	std::vector<vk::CommandPool> mSingleTimeCommandPools;					// one per job system thread, indexed by jobs::JobSystem::currentThreadIndex
+	std::mutex mGraphicsQueueMutex;														// guards submissions that can happen on several threads at once
 
 	/* Semaphore related */
-	vk::Deleter<VkSemaphore> mImageAvailableSemaphore{ mDevice, vkDestroySemaphore };
-	vk::Deleter<VkSemaphore> mRenderFinishedSemaphore{ mDevice, vkDestroySemaphore };
+	std::vector<vk::Semaphore> mImageAvailableSemaphores;								// one per frame in flight
+	std::vector<vk::Semaphore> mRenderFinishedSemaphores;
+
+	/* Frame tracking and deferred destruction related */
+	struct SubmittedFrame
+	{
+		uint64_t frame;
+		vk::Fence fence;																// signaled once the frame's command buffer has finished executing
+		std::chrono::high_resolution_clock::time_point submitTime;
+	};
+
+	uint64_t mSubmittedFrame = 0;														// frames are numbered from 1, so 0 means nothing has been submitted yet
+	uint64_t mCompletedFrame = 0;
+	std::deque<SubmittedFrame> mFramesInFlight;
+	std::vector<vk::Fence> mFreeFences;
+	vk::DeletionQueue mDeletionQueue;													// destroyed before the device, once mainLoop has waited for it to become idle
 
 	/* Validation layer and extension related */
 	const std::vector<const char*> mDeviceExtensions{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
-	vk::Deleter<VkDebugReportCallbackEXT> mCallback{ mInstance, DestroyDebugReportCallbackEXT };
+	vk::InstanceHandle<VkDebugReportCallbackEXT, DestroyDebugReportCallbackEXT> mCallback;
 
 	static VkBool32 sDebugCallback (
 		VkDebugReportFlagsEXT flags,			// type of the message, i.e. VK_DEBUG_REPORT_INFORMATION_BIT_EXT, VK_DEBUG_REPORT_WARNING_BIT_EXT, etc.
@@ -2656,9 +4533,126 @@ private:
 
 };
 
-int main()
+int main(int argc, char** argv)
 {
-	BasicApp app;
+	AppSettings settings;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+		{
+			settings.recordingThreads = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--worker-threads") == 0 && i + 1 < argc)
+		{
+			settings.workerThreads = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--bench-recording") == 0)
+		{
+			settings.benchmarkRecording = true;
+		}
+		else if (std::strcmp(argv[i], "--latency-profile") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "lowest-latency") == 0)
+		{
+			settings.latencyProfile = LatencyProfile::LowestLatency;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--latency-profile") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "vsync-throughput") == 0)
+		{
+			settings.latencyProfile = LatencyProfile::VsyncThroughput;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--latency-profile") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "power-saving") == 0)
+		{
+			settings.latencyProfile = LatencyProfile::PowerSaving;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--frame-limit") == 0 && i + 1 < argc)
+		{
+			settings.frameLimit = std::max(0.0, std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--bench-latency") == 0)
+		{
+			settings.benchmarkLatency = true;
+		}
+		else if (std::strcmp(argv[i], "--objects") == 0 && i + 1 < argc)
+		{
+			settings.objectCount = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--pipeline-variant") == 0 && i + 1 < argc &&
+			std::any_of(PIPELINE_VARIANTS.begin(), PIPELINE_VARIANTS.end(), [&](PipelineVariant variant) { return std::strcmp(argv[i + 1], pipelineVariantName(variant)) == 0; }))
+		{
+			++i;
+			settings.pipelineVariant = *std::find_if(PIPELINE_VARIANTS.begin(), PIPELINE_VARIANTS.end(), [&](PipelineVariant variant) { return std::strcmp(argv[i], pipelineVariantName(variant)) == 0; });
+		}
+		else if (std::strcmp(argv[i], "--archive") == 0 && i + 1 < argc)
+		{
+			settings.assetArchive = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--pack-assets") == 0)
+		{
+			settings.packArchive = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : ASSET_ARCHIVE_PATH;
+		}
+		else if (std::strcmp(argv[i], "--bench-assets") == 0)
+		{
+			settings.benchmarkAssets = true;
+		}
+		else if (std::strcmp(argv[i], "--staging-size") == 0 && i + 1 < argc)
+		{
+			settings.stagingRingSize = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--upload-path") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "auto") == 0)
+		{
+			settings.uploadPath = UploadPath::Auto;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--upload-path") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "staged") == 0)
+		{
+			settings.uploadPath = UploadPath::Staged;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--upload-path") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "direct") == 0)
+		{
+			settings.uploadPath = UploadPath::Direct;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--bench-uploads") == 0)
+		{
+			settings.benchmarkUploads = true;
+		}
+		else if (std::strcmp(argv[i], "--host-arena") == 0 && i + 1 < argc)
+		{
+			settings.hostArenaSize = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+		{
+			settings.memoryBudget = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--depth-prepass") == 0)
+		{
+			settings.depthPrepass = true;
+		}
+		else if (std::strcmp(argv[i], "--bench-prepass") == 0)
+		{
+			settings.benchmarkPrepass = true;
+		}
+		else if (std::strcmp(argv[i], "--query-stats") == 0)
+		{
+			settings.queryStatistics = true;
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+			std::cerr << "Usage: VulkanBasic [--record-threads N] [--worker-threads N] [--bench-recording]" << std::endl;
+			std::cerr << "                   [--latency-profile lowest-latency|vsync-throughput|power-saving] [--frame-limit FPS] [--bench-latency]" << std::endl;
+			std::cerr << "                   [--objects N] [--pipeline-variant opaque|alpha-test|untextured]" << std::endl;
+			std::cerr << "                   [--archive PATH] [--pack-assets [PATH]] [--bench-assets] [--staging-size MiB]" << std::endl;
+			std::cerr << "                   [--upload-path auto|staged|direct] [--bench-uploads] [--host-arena KiB]" << std::endl;
+			std::cerr << "                   [--memory-budget MiB] [--depth-prepass] [--bench-prepass] [--query-stats]" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	BasicApp app(settings);
 
 	try
 	{
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+
+Reading a file into a std::vector copies every byte twice: from the page cache into the stream's buffer,
+and from there into the vector (and often a third time, into whatever consumes the data). Mapping the
+file instead makes its pages part of the address space, so the bytes are read straight out of the page
+cache, and only the pages that are actually touched are ever loaded:
+
+	io::MappedFile file("shaders/vert.spv");
+	createInfo.codeSize = file.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(file.data());		// mappings are page aligned
+
+The access hint tells the kernel how the mapping is going to be read (madvise on Linux, the equivalent
+file flags on Windows), so sequential reads prefetch ahead and random reads don't waste memory on it.
+Libraries that only read from a std::istream can parse a mapping through io::SpanStreamBuffer, which
+points the stream at the mapped bytes rather than copying them.
+
+*/
+
+namespace io
+{
+	//! a read-only view of bytes that are owned by someone else, i.e. a MappedFile
+	struct ByteSpan
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+
+		const char* begin() const { return data; }
+		const char* end() const { return data + size; }
+		bool empty() const { return size == 0; }
+	};
+
+	//! how a mapping is going to be read
+	enum class AccessHint
+	{
+		Sequential,																	// read once from front to back, i.e. parsed or decoded
+		Random,																		// read in no particular order
+		WillNeed																	// read in full soon, so start loading all of it now
+	};
+
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+
+		//! map the whole file read-only, throwing if it can't be opened
+		explicit MappedFile(const std::string& path, AccessHint hint = AccessHint::Sequential) :
+			mPath(path)
+		{
+#ifdef _WIN32
+			DWORD flags = hint == AccessHint::Random ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN;
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | flags, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				throw std::runtime_error("Failed to open file " + path);
+			}
+
+			LARGE_INTEGER size = {};
+			GetFileSizeEx(file, &size);
+			mSize = static_cast<size_t>(size.QuadPart);
+
+			if (mSize > 0)
+			{
+				// the mapping object keeps the file open, so the file handle can be closed right away
+				HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping)
+				{
+					mData = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					CloseHandle(mapping);
+				}
+			}
+			CloseHandle(file);
+#else
+			int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (file < 0)
+			{
+				throw std::runtime_error("Failed to open file " + path);
+			}
+
+			struct stat status = {};
+			fstat(file, &status);
+			mSize = static_cast<size_t>(status.st_size);
+
+			if (mSize > 0)
+			{
+				void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, file, 0);
+				if (data != MAP_FAILED)
+				{
+					mData = static_cast<const char*>(data);
+					madvise(data, mSize, hint == AccessHint::Random ? MADV_RANDOM : hint == AccessHint::WillNeed ? MADV_WILLNEED : MADV_SEQUENTIAL);
+				}
+			}
+
+			// the mapping holds its own reference to the file
+			::close(file);
+#endif
+
+			if (mSize > 0 && !mData)
+			{
+				throw std::runtime_error("Failed to map file " + path);
+			}
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other) noexcept :
+			mPath(std::move(other.mPath)),
+			mData(other.mData),
+			mSize(other.mSize)
+		{
+			other.mData = nullptr;
+			other.mSize = 0;
+		}
+
+		MappedFile& operator=(MappedFile&& other) noexcept
+		{
+			if (this != &other)
+			{
+				close();
+				mPath = std::move(other.mPath);
+				mData = other.mData;
+				mSize = other.mSize;
+				other.mData = nullptr;
+				other.mSize = 0;
+			}
+			return *this;
+		}
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		//! unmap the file: every span handed out before becomes invalid
+		void close()
+		{
+			if (mData)
+			{
+#ifdef _WIN32
+				UnmapViewOfFile(mData);
+#else
+				munmap(const_cast<char*>(mData), mSize);
+#endif
+			}
+			mData = nullptr;
+			mSize = 0;
+		}
+
+		const char* data() const { return mData; }
+		size_t size() const { return mSize; }
+		ByteSpan span() const { return { mData, mSize }; }
+		const std::string& path() const { return mPath; }
+
+	private:
+		std::string mPath;
+		const char* mData = nullptr;
+		size_t mSize = 0;
+	};
+
+	//! drop a file's pages from the operating system's file cache, so the next read has to go to the disk; returns false where that isn't supported
+	inline bool evictFromFileCache(const std::string& path)
+	{
+#if defined(_WIN32) || defined(__APPLE__)
+		// there is no unprivileged way to evict a single file on these platforms
+		(void)path;
+		return false;
+#else
+		int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (file < 0)
+		{
+			return false;
+		}
+
+		// only clean pages are dropped, which is all of them for files that are only ever read
+		bool evicted = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		::close(file);
+		return evicted;
+#endif
+	}
+
+	//! a read-only stream buffer over a span, for reading mapped files through a std::istream without copying them
+	class SpanStreamBuffer : public std::streambuf
+	{
+	public:
+		explicit SpanStreamBuffer(ByteSpan span)
+		{
+			// the get area is never written to, std::streambuf just isn't const-correct
+			char* begin = const_cast<char*>(span.begin());
+			setg(begin, begin, begin + span.size);
+		}
+
+	protected:
+		pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override
+		{
+			if (!(which & std::ios_base::in))
+			{
+				return pos_type(off_type(-1));
+			}
+
+			char* base = direction == std::ios_base::beg ? eback() : direction == std::ios_base::cur ? gptr() : egptr();
+			char* position = base + offset;
+			if (position < eback() || position > egptr())
+			{
+				return pos_type(off_type(-1));
+			}
+
+			setg(eback(), position, egptr());
+			return pos_type(off_type(position - eback()));
+		}
+
+		pos_type seekpos(pos_type position, std::ios_base::openmode which) override
+		{
+			return seekoff(off_type(position), std::ios_base::beg, which);
+		}
+	};
+}
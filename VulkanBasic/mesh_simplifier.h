@@ -0,0 +1,461 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "glm/gtx/hash.hpp"
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstdint>
+
+/*
+
+Distant objects cover only a handful of pixels, so drawing them with the full-resolution mesh wastes vertex
+work. This header builds a chain of progressively coarser index buffers (levels of detail) from an indexed
+triangle mesh using edge collapses driven by the quadric error metric (Garland and Heckbert, 1997):
+
+	1. Every triangle defines a plane. Each vertex accumulates a quadric (a symmetric 4x4 matrix) that measures
+	   the sum of squared distances from a point to the planes of all of its adjacent triangles.
+	2. Collapsing the edge (u, v) moves u onto v. The cost of the collapse is the combined quadric of u and v
+	   evaluated at v's position, which approximates how far the new surface drifts from the original.
+	3. The cheapest collapses are performed first until the requested triangle count is reached.
+
+We use half-edge collapses (u always moves onto an existing vertex v), so every level of detail indexes into
+the original vertex buffer and only a new index range needs to be stored per level. Vertices that lie on a
+texture seam (several vertices sharing one position) are locked so that the seam cannot tear open, and
+vertices on an open border may only slide along that border.
+
+The square root of the largest collapse cost performed so far is stored with each level as its geometric
+error (in object space units). At runtime, selectLod projects this error onto the screen and picks the
+coarsest level that stays below a pixel threshold.
+
+*/
+
+namespace mesh
+{
+	//! a single level of detail: a range of the shared index buffer plus the geometric error it introduces
+	struct Lod
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;
+	};
+
+	//! the index list and error bound produced for one target ratio
+	struct SimplifiedLevel
+	{
+		std::vector<uint32_t> indices;
+		float error;
+	};
+
+	//! a symmetric 4x4 matrix stored as its 10 unique coefficients
+	struct Quadric
+	{
+		double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+		double b2 = 0.0, bc = 0.0, bd = 0.0;
+		double c2 = 0.0, cd = 0.0;
+		double d2 = 0.0;
+
+		//! builds the quadric of the plane ax + by + cz + d = 0 scaled by weight
+		static Quadric fromPlane(double a, double b, double c, double d, double weight)
+		{
+			Quadric q;
+			q.a2 = a * a * weight; q.ab = a * b * weight; q.ac = a * c * weight; q.ad = a * d * weight;
+			q.b2 = b * b * weight; q.bc = b * c * weight; q.bd = b * d * weight;
+			q.c2 = c * c * weight; q.cd = c * d * weight;
+			q.d2 = d * d * weight;
+			return q;
+		}
+
+		Quadric& operator+=(const Quadric& other)
+		{
+			a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+			b2 += other.b2; bc += other.bc; bd += other.bd;
+			c2 += other.c2; cd += other.cd;
+			d2 += other.d2;
+			return *this;
+		}
+
+		//! the sum of squared (weighted) plane distances of point p
+		double evaluate(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double result = a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+				+ b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+				+ c2 * z * z + 2.0 * cd * z
+				+ d2;
+			return std::max(result, 0.0); // guard against tiny negative values caused by rounding
+		}
+	};
+
+	//! performs successive half-edge collapses on an indexed triangle mesh
+	class Simplifier
+	{
+	public:
+
+		Simplifier(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices) :
+			mPositions(positions),
+			mTriangles(indices),
+			mTriangleAlive(indices.size() / 3, true),
+			mAliveTriangles(indices.size() / 3),
+			mVertexTriangles(positions.size()),
+			mQuadrics(positions.size()),
+			mVersions(positions.size(), 0),
+			mRemoved(positions.size(), false),
+			mLocked(positions.size(), false),
+			mBorder(positions.size(), false)
+		{
+			classifyVertices();
+			computeQuadrics();
+
+			// seed the queue with both directions of every unique edge
+			for (const auto& edge : mEdgeUseCounts)
+			{
+				uint32_t a = static_cast<uint32_t>(edge.first >> 32);
+				uint32_t b = static_cast<uint32_t>(edge.first & 0xffffffff);
+				pushCandidate(a, b);
+				pushCandidate(b, a);
+			}
+		}
+
+		//! collapse edges until at most targetTriangleCount triangles remain or the next collapse would exceed maxError
+		void simplifyTo(size_t targetTriangleCount, float maxError)
+		{
+			const double maxCost = static_cast<double>(maxError) * maxError;
+
+			while (mAliveTriangles > targetTriangleCount && !mCandidates.empty())
+			{
+				Collapse collapse = mCandidates.top();
+				mCandidates.pop();
+
+				// skip candidates that refer to removed vertices or to quadrics that have changed since they were queued
+				if (mRemoved[collapse.from] || mRemoved[collapse.to] ||
+					collapse.fromVersion != mVersions[collapse.from] ||
+					collapse.toVersion != mVersions[collapse.to])
+				{
+					continue;
+				}
+
+				// the queue is ordered by cost, so every remaining candidate is at least as expensive
+				if (collapse.cost > maxCost)
+				{
+					break;
+				}
+
+				if (flipsTriangles(collapse.from, collapse.to))
+				{
+					continue;
+				}
+
+				performCollapse(collapse.from, collapse.to);
+				mError = std::max(mError, static_cast<float>(std::sqrt(collapse.cost)));
+			}
+		}
+
+		//! the indices of all triangles that are still alive
+		std::vector<uint32_t> currentIndices() const
+		{
+			std::vector<uint32_t> indices;
+			indices.reserve(mAliveTriangles * 3);
+			for (size_t t = 0; t < mTriangleAlive.size(); ++t)
+			{
+				if (mTriangleAlive[t])
+				{
+					indices.insert(indices.end(), mTriangles.begin() + t * 3, mTriangles.begin() + t * 3 + 3);
+				}
+			}
+			return indices;
+		}
+
+		size_t triangleCount() const { return mAliveTriangles; }
+
+		//! the largest geometric error introduced by any collapse so far
+		float error() const { return mError; }
+
+	private:
+
+		struct Collapse
+		{
+			double cost;
+			uint32_t from;
+			uint32_t to;
+			uint32_t fromVersion;
+			uint32_t toVersion;
+
+			bool operator>(const Collapse& other) const { return cost > other.cost; }
+		};
+
+		//! constraint planes along open borders are weighted heavily so that silhouettes are preserved
+		static constexpr double sBorderWeight = 10.0;
+
+		static uint64_t edgeKey(uint32_t a, uint32_t b)
+		{
+			if (a > b) std::swap(a, b);
+			return (static_cast<uint64_t>(a) << 32) | b;
+		}
+
+		//! build vertex to triangle adjacency and find seam (locked) and border vertices
+		void classifyVertices()
+		{
+			for (size_t t = 0; t < mTriangleAlive.size(); ++t)
+			{
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					uint32_t a = mTriangles[t * 3 + corner];
+					uint32_t b = mTriangles[t * 3 + (corner + 1) % 3];
+					mVertexTriangles[a].push_back(static_cast<uint32_t>(t));
+					mEdgeUseCounts[edgeKey(a, b)]++;
+				}
+			}
+
+			// an edge that is used by exactly one triangle lies on an open border
+			for (const auto& edge : mEdgeUseCounts)
+			{
+				if (edge.second == 1)
+				{
+					mBorderEdges.insert(edge.first);
+					mBorder[edge.first >> 32] = true;
+					mBorder[edge.first & 0xffffffff] = true;
+				}
+			}
+
+			// vertices that share a position with another vertex sit on an attribute seam
+			std::unordered_map<glm::vec3, uint32_t> positionCounts;
+			for (const auto& p : mPositions)
+			{
+				positionCounts[p]++;
+			}
+			for (size_t v = 0; v < mPositions.size(); ++v)
+			{
+				mLocked[v] = positionCounts[mPositions[v]] > 1;
+			}
+		}
+
+		void computeQuadrics()
+		{
+			for (size_t t = 0; t < mTriangleAlive.size(); ++t)
+			{
+				uint32_t i0 = mTriangles[t * 3 + 0], i1 = mTriangles[t * 3 + 1], i2 = mTriangles[t * 3 + 2];
+				glm::vec3 p0 = mPositions[i0], p1 = mPositions[i1], p2 = mPositions[i2];
+
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				float area = glm::length(normal);
+				if (area <= 0.0f) continue; // degenerate triangles carry no plane information
+
+				normal /= area;
+				Quadric plane = Quadric::fromPlane(normal.x, normal.y, normal.z, -glm::dot(normal, p0), 1.0);
+				mQuadrics[i0] += plane;
+				mQuadrics[i1] += plane;
+				mQuadrics[i2] += plane;
+
+				// add a plane perpendicular to the triangle through each of its border edges
+				const uint32_t corners[3] = { i0, i1, i2 };
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					uint32_t a = corners[corner];
+					uint32_t b = corners[(corner + 1) % 3];
+					if (mBorderEdges.count(edgeKey(a, b)) == 0) continue;
+
+					glm::vec3 edgeNormal = glm::cross(mPositions[b] - mPositions[a], normal);
+					float length = glm::length(edgeNormal);
+					if (length <= 0.0f) continue;
+
+					edgeNormal /= length;
+					Quadric constraint = Quadric::fromPlane(edgeNormal.x, edgeNormal.y, edgeNormal.z, -glm::dot(edgeNormal, mPositions[a]), sBorderWeight);
+					mQuadrics[a] += constraint;
+					mQuadrics[b] += constraint;
+				}
+			}
+		}
+
+		//! queue the collapse of vertex from onto vertex to, if it is allowed
+		void pushCandidate(uint32_t from, uint32_t to)
+		{
+			if (mLocked[from]) return;
+			if (mBorder[from] && mBorderEdges.count(edgeKey(from, to)) == 0) return; // border vertices may only slide along the border
+
+			Quadric combined = mQuadrics[from];
+			combined += mQuadrics[to];
+
+			mCandidates.push({ combined.evaluate(mPositions[to]), from, to, mVersions[from], mVersions[to] });
+		}
+
+		//! returns true if moving from onto to would turn any of the remaining triangles around from inside out
+		bool flipsTriangles(uint32_t from, uint32_t to) const
+		{
+			for (uint32_t t : mVertexTriangles[from])
+			{
+				if (!mTriangleAlive[t]) continue;
+
+				const uint32_t* tri = &mTriangles[t * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to) continue; // this triangle disappears
+
+				glm::vec3 before[3], after[3];
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					before[corner] = mPositions[tri[corner]];
+					after[corner] = tri[corner] == from ? mPositions[to] : before[corner];
+				}
+
+				glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+				if (glm::dot(n0, n1) <= 0.0f)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void performCollapse(uint32_t from, uint32_t to)
+		{
+			// move border edges that started at from so that they now start at to
+			if (mBorder[from])
+			{
+				for (uint32_t t : mVertexTriangles[from])
+				{
+					if (!mTriangleAlive[t]) continue;
+					for (size_t corner = 0; corner < 3; ++corner)
+					{
+						uint32_t other = mTriangles[t * 3 + corner];
+						if (other == from) continue;
+						if (mBorderEdges.erase(edgeKey(from, other)) > 0 && other != to)
+						{
+							mBorderEdges.insert(edgeKey(to, other));
+						}
+					}
+				}
+			}
+
+			// triangles that contain both vertices collapse to lines and are removed, the rest are rewired onto to
+			for (uint32_t t : mVertexTriangles[from])
+			{
+				if (!mTriangleAlive[t]) continue;
+
+				uint32_t* tri = &mTriangles[t * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					mTriangleAlive[t] = false;
+					--mAliveTriangles;
+					continue;
+				}
+
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					if (tri[corner] == from) tri[corner] = to;
+				}
+				mVertexTriangles[to].push_back(t);
+			}
+			mVertexTriangles[from].clear();
+			mVertexTriangles[from].shrink_to_fit();
+
+			mQuadrics[to] += mQuadrics[from];
+			mRemoved[from] = true;
+			mVersions[to]++;
+
+			// drop dead triangles from the adjacency of to and requeue every edge around it, since its quadric has changed
+			auto& adjacent = mVertexTriangles[to];
+			adjacent.erase(std::remove_if(adjacent.begin(), adjacent.end(), [this](uint32_t t) { return !mTriangleAlive[t]; }), adjacent.end());
+
+			for (uint32_t t : adjacent)
+			{
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					uint32_t other = mTriangles[t * 3 + corner];
+					if (other == to) continue;
+					pushCandidate(other, to);
+					pushCandidate(to, other);
+				}
+			}
+		}
+
+		std::vector<glm::vec3> mPositions;
+		std::vector<uint32_t> mTriangles;
+		std::vector<bool> mTriangleAlive;
+		size_t mAliveTriangles;
+		std::vector<std::vector<uint32_t>> mVertexTriangles;
+		std::vector<Quadric> mQuadrics;
+		std::vector<uint32_t> mVersions;
+		std::vector<bool> mRemoved;
+		std::vector<bool> mLocked;
+		std::vector<bool> mBorder;
+		std::unordered_map<uint64_t, uint32_t> mEdgeUseCounts;
+		std::unordered_set<uint64_t> mBorderEdges;
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> mCandidates;
+		float mError = 0.0f;
+	};
+
+	/*
+
+	Builds one simplified level per entry in targetRatios (fractions of the original triangle count, e.g. 0.5f
+	for half of the triangles). Levels are produced progressively from a single simplifier, so generating the
+	whole chain costs about as much as generating its coarsest level. The chain stops early once maxError
+	prevents any further reduction. VertexT only needs a glm::vec3 member called position.
+
+	*/
+	template<typename VertexT>
+	std::vector<SimplifiedLevel> buildLodChain(const std::vector<VertexT>& vertices,
+		const std::vector<uint32_t>& indices,
+		std::vector<float> targetRatios,
+		float maxError)
+	{
+		std::vector<glm::vec3> positions;
+		positions.reserve(vertices.size());
+		for (const auto& vertex : vertices)
+		{
+			positions.push_back(vertex.position);
+		}
+
+		std::sort(targetRatios.begin(), targetRatios.end(), std::greater<float>());
+
+		Simplifier simplifier(positions, indices);
+		std::vector<SimplifiedLevel> levels;
+		size_t previousCount = indices.size() / 3;
+
+		for (float ratio : targetRatios)
+		{
+			size_t target = std::max<size_t>(1, static_cast<size_t>(indices.size() / 3 * ratio));
+			simplifier.simplifyTo(target, maxError);
+
+			// no further progress is possible within the error bound
+			if (simplifier.triangleCount() >= previousCount)
+			{
+				break;
+			}
+			previousCount = simplifier.triangleCount();
+
+			levels.push_back({ simplifier.currentIndices(), simplifier.error() });
+		}
+
+		return levels;
+	}
+
+	/*
+
+	Returns the index of the coarsest level whose error, projected onto the screen, is at most pixelThreshold
+	pixels. projectionScale converts an object space length at unit distance into pixels and is equal to
+	viewportHeight / (2 * tan(fovy / 2)) for a perspective projection. Levels must be ordered from finest to
+	coarsest, which is how buildLodChain produces them.
+
+	*/
+	inline size_t selectLod(const std::vector<Lod>& lods, float distance, float projectionScale, float pixelThreshold)
+	{
+		distance = std::max(distance, 1e-4f);
+
+		size_t selected = 0;
+		for (size_t i = 1; i < lods.size(); ++i)
+		{
+			float projectedError = lods[i].error / distance * projectionScale;
+			if (projectedError > pixelThreshold)
+			{
+				break;
+			}
+			selected = i;
+		}
+		return selected;
+	}
+}
@@ -0,0 +1,519 @@
+#pragma once
+
+#include "deleter.h"
+#include "deletion_queue.h"
+#include "job_system.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+Every combination of shaders, specialization constants and fixed-function state needs its own VkPipeline,
+and creating one is expensive (the driver compiles the shaders to machine code at that point). The
+pipeline registry describes a pipeline as a key that holds all of that state, and creates each distinct
+key only once: asking for a key that was seen before returns the same pipeline.
+
+	vk::PipelineKey key = baseKey;
+	key.specialization.push_back({ 1, VK_TRUE });								// i.e. enable alpha testing
+	VkPipeline pipeline = registry.get(key);									// created now if it's new
+
+Variants that are going to be needed later can be prepared instead, which creates them on a worker thread of
+the job system while the main thread keeps rendering. A later get for the same key waits for that to finish
+rather than creating the pipeline a second time. All pipelines are created through one VkPipelineCache, so
+variants that share shaders also share part of the compilation work.
+
+get, prepare and retireAll are called from one thread at a time, which has to belong to the job system since
+waiting for prepared pipelines runs queued jobs. Stats are only complete once waitForPrepared has returned.
+
+*/
+
+namespace vk
+{
+	//! a specialization constant: the same values are given to every stage, which ignores ids its module doesn't declare
+	struct SpecializationConstant
+	{
+		uint32_t id;
+		uint32_t value;
+	};
+
+	//! everything that distinguishes one graphics pipeline from another; the name is only used for reporting
+	struct PipelineKey
+	{
+		std::string name;
+
+		// shaders: a pipeline without a fragment shader only writes depth
+		VkShaderModule vertexShader = VK_NULL_HANDLE;
+		VkShaderModule fragmentShader = VK_NULL_HANDLE;
+		std::vector<SpecializationConstant> specialization;
+
+		// vertex layout
+		std::vector<VkVertexInputBindingDescription> vertexBindings;
+		std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+		// rasterization
+		VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+		VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+		VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+		// depth
+		VkBool32 depthTest = VK_TRUE;
+		VkBool32 depthWrite = VK_TRUE;
+		VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
+
+		// blending: source alpha over the destination if enabled, the fragment shader's output unmodified otherwise
+		VkBool32 alphaBlend = VK_FALSE;
+		uint32_t colorAttachments = 1;												// of the subpass, which all blend the same way
+
+		// where the pipeline is used
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		uint32_t subpass = 0;
+	};
+
+	//! how long a pipeline took to create, and how often it was asked for
+	struct PipelineStats
+	{
+		std::string name;
+		double createMs = 0.0;
+		uint32_t thread = 0;														// the job system thread that created it
+		uint64_t hostBytes = 0;														// allocated by the driver through the allocation callbacks on that thread while creating it
+		bool prepared = false;														// created ahead of time by prepare, rather than on demand by get
+		uint64_t requests = 0;
+	};
+
+	class PipelineRegistry
+	{
+	public:
+		PipelineRegistry() = default;
+		PipelineRegistry(const PipelineRegistry&) = delete;
+		PipelineRegistry& operator=(const PipelineRegistry&) = delete;
+
+		~PipelineRegistry()
+		{
+			waitForPrepared();
+		}
+
+		//! jobs may be null, in which case prepare creates pipelines right away
+		void init(VkDevice device, jobs::JobSystem* jobs)
+		{
+			mDevice = device;
+			mJobs = jobs;
+
+			VkPipelineCacheCreateInfo cacheInfo = {};
+			cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+			if (vkCreatePipelineCache(mDevice, &cacheInfo, allocationCallbacks(), mCache.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create pipeline cache.");
+			}
+		}
+
+		//! the pipeline for key, creating it now if it doesn't exist yet (or waiting for it if it's being prepared)
+		VkPipeline get(const PipelineKey& key)
+		{
+			Entry* entry = nullptr;
+			bool created = false;
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				entry = find(key);
+				if (!entry)
+				{
+					entry = insert(key);
+					created = true;
+				}
+				entry->stats.requests++;
+			}
+
+			if (created)
+			{
+				mMisses++;
+				build(*entry);
+			}
+			else
+			{
+				mHits++;
+				if (entry->state == State::Pending)
+				{
+					waitForPrepared();
+				}
+			}
+
+			if (entry->state == State::Failed)
+			{
+				throw std::runtime_error("Failed to create graphics pipeline " + key.name + ".");
+			}
+
+			return entry->pipeline;
+		}
+
+		//! start creating the pipeline for key on a worker thread, unless it exists or is being created already
+		void prepare(const PipelineKey& key)
+		{
+			Entry* entry = nullptr;
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (find(key))
+				{
+					return;
+				}
+				entry = insert(key);
+				entry->stats.prepared = true;
+			}
+
+			if (mJobs && mJobs->threadCount() > 1)
+			{
+				mJobs->run([this, entry]() { build(*entry); }, &mPrepared);
+			}
+			else
+			{
+				build(*entry);
+			}
+		}
+
+		//! block until every pipeline that was prepared so far has been created
+		void waitForPrepared()
+		{
+			if (mJobs)
+			{
+				mJobs->wait(mPrepared);
+			}
+		}
+
+		//! hand every pipeline over to the deletion queue, i.e. because the render pass they were created for is being replaced
+		void retireAll(DeletionQueue& deletionQueue, uint64_t frame)
+		{
+			waitForPrepared();
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (auto& bucket : mEntries)
+			{
+				for (auto& entry : bucket.second)
+				{
+					deletionQueue.retire(std::move(entry->pipeline), frame);
+					mRetiredStats.push_back(entry->stats);
+				}
+			}
+			mEntries.clear();
+		}
+
+		//! creation time and use count of every pipeline created so far, including retired ones
+		std::vector<PipelineStats> stats() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			std::vector<PipelineStats> all = mRetiredStats;
+			for (const auto& bucket : mEntries)
+			{
+				for (const auto& entry : bucket.second)
+				{
+					all.push_back(entry->stats);
+				}
+			}
+			return all;
+		}
+
+		void report(std::ostream& out) const
+		{
+			std::vector<PipelineStats> all = stats();
+			size_t nameWidth = 0;
+			for (const auto& pipeline : all)
+			{
+				nameWidth = std::max(nameWidth, pipeline.name.size());
+			}
+
+			out << "Pipelines (" << mHits << " hits, " << mMisses << " created on demand):" << std::endl;
+			out << std::fixed << std::setprecision(2);
+			for (const auto& pipeline : all)
+			{
+				out << "\t" << std::left << std::setw(nameWidth) << pipeline.name << std::right
+					<< std::setw(10) << pipeline.createMs << " ms on thread " << pipeline.thread
+					<< (pipeline.prepared ? " (prepared)" : " (on demand)") << ", requested " << pipeline.requests << " times, "
+					<< pipeline.hostBytes / 1024 << " KiB of driver host allocations" << std::endl;
+			}
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+		uint64_t hits() const { return mHits; }
+		uint64_t misses() const { return mMisses; }
+
+	private:
+		enum class State
+		{
+			Pending,
+			Ready,
+			Failed
+		};
+
+		struct Entry
+		{
+			PipelineKey key;
+			vk::Pipeline pipeline;
+			std::atomic<State> state{ State::Pending };
+			PipelineStats stats;
+		};
+
+		//! create the pipeline of an entry: runs on the calling thread or a worker, never throws
+		void build(Entry& entry)
+		{
+			const PipelineKey& key = entry.key;
+			auto start = profiler::Clock::now();
+
+			// the same specialization data goes to every stage
+			std::vector<VkSpecializationMapEntry> mapEntries;
+			std::vector<uint32_t> values;
+			for (const auto& constant : key.specialization)
+			{
+				mapEntries.push_back({ constant.id, static_cast<uint32_t>(values.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+				values.push_back(constant.value);
+			}
+
+			VkSpecializationInfo specialization = {};
+			specialization.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+			specialization.pMapEntries = mapEntries.data();
+			specialization.dataSize = values.size() * sizeof(uint32_t);
+			specialization.pData = values.data();
+
+			VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+			shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+			shaderStages[0].module = key.vertexShader;
+			shaderStages[0].pName = "main";							// the function to invoke (main is standard)
+			shaderStages[0].pSpecializationInfo = mapEntries.empty() ? nullptr : &specialization;
+			shaderStages[1] = shaderStages[0];
+			shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+			shaderStages[1].module = key.fragmentShader;
+
+			VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+			vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+			vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(key.vertexBindings.size());
+			vertexInputInfo.pVertexBindingDescriptions = key.vertexBindings.data();
+			vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(key.vertexAttributes.size());
+			vertexInputInfo.pVertexAttributeDescriptions = key.vertexAttributes.data();
+
+			VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+			inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+			inputAssembly.topology = key.topology;
+			inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+			// the viewport and scissor rectangle are dynamic state (see below), so only their number is part of the pipeline
+			VkPipelineViewportStateCreateInfo viewportState = {};
+			viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+			viewportState.viewportCount = 1;
+			viewportState.scissorCount = 1;
+
+			VkPipelineRasterizationStateCreateInfo rasterizer = {};
+			rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+			rasterizer.depthClampEnable = VK_FALSE;					// fragments beyond the near and far planes are clamped as opposed to discarded if this is true
+			rasterizer.rasterizerDiscardEnable = VK_FALSE;			// disables output to any framebuffer if this is true
+			rasterizer.polygonMode = key.polygonMode;				// how fragments are generated for geometry
+			rasterizer.lineWidth = 1.0f;							// the thickness of lines in terms of number of fragments
+			rasterizer.cullMode = key.cullMode;						// the type of face culling to use
+			rasterizer.frontFace = key.frontFace;					// the vertex order for faces to be considered front-facing
+			rasterizer.depthBiasEnable = VK_FALSE;
+
+			VkPipelineMultisampleStateCreateInfo multisampling = {};
+			multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+			multisampling.sampleShadingEnable = VK_FALSE;
+			multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+			multisampling.minSampleShading = 1.0f;
+
+			VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+			depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+			depthStencil.depthTestEnable = key.depthTest;
+			depthStencil.depthWriteEnable = key.depthWrite;
+			depthStencil.depthCompareOp = key.depthCompare;
+			depthStencil.depthBoundsTestEnable = VK_FALSE;
+			depthStencil.minDepthBounds = 0.0f;
+			depthStencil.maxDepthBounds = 1.0f;
+			depthStencil.stencilTestEnable = VK_FALSE;
+
+			VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+			colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+			colorBlendAttachment.blendEnable = key.alphaBlend;
+			colorBlendAttachment.srcColorBlendFactor = key.alphaBlend ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+			colorBlendAttachment.dstColorBlendFactor = key.alphaBlend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+			colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+			colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+			colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+			std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(key.colorAttachments, colorBlendAttachment);
+
+			VkPipelineColorBlendStateCreateInfo colorBlending = {};
+			colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+			colorBlending.logicOpEnable = VK_FALSE;
+			colorBlending.logicOp = VK_LOGIC_OP_COPY;
+			colorBlending.attachmentCount = key.colorAttachments;
+			colorBlending.pAttachments = colorBlendAttachments.data();
+
+			// the viewport and scissor rectangle are set while recording, so resizing doesn't require a new pipeline
+			VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+			VkPipelineDynamicStateCreateInfo dynamicState = {};
+			dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+			dynamicState.dynamicStateCount = 2;
+			dynamicState.pDynamicStates = dynamicStates;
+
+			VkGraphicsPipelineCreateInfo pipelineInfo = {};
+			pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+			pipelineInfo.stageCount = key.fragmentShader != VK_NULL_HANDLE ? 2 : 1;
+			pipelineInfo.pStages = shaderStages;
+			pipelineInfo.pVertexInputState = &vertexInputInfo;
+			pipelineInfo.pInputAssemblyState = &inputAssembly;
+			pipelineInfo.pViewportState = &viewportState;
+			pipelineInfo.pRasterizationState = &rasterizer;
+			pipelineInfo.pMultisampleState = &multisampling;
+			pipelineInfo.pDepthStencilState = &depthStencil;
+			pipelineInfo.pColorBlendState = &colorBlending;
+			pipelineInfo.pDynamicState = &dynamicState;
+			pipelineInfo.layout = key.layout;
+			pipelineInfo.renderPass = key.renderPass;
+			pipelineInfo.subpass = key.subpass;
+			pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+			pipelineInfo.basePipelineIndex = -1;
+
+			// the pipeline cache is internally synchronized, so several threads can create pipelines through it at once
+			uint64_t hostBytes = HostAllocator::threadAllocatedBytes();
+			VkResult result = vkCreateGraphicsPipelines(mDevice, mCache, 1, &pipelineInfo, allocationCallbacks(), entry.pipeline.replace(mDevice));
+
+			entry.stats.createMs = std::chrono::duration<double, std::milli>(profiler::Clock::now() - start).count();
+			entry.stats.thread = jobs::JobSystem::currentThreadIndex();
+			entry.stats.hostBytes = HostAllocator::threadAllocatedBytes() - hostBytes;
+			entry.state = result == VK_SUCCESS ? State::Ready : State::Failed;
+		}
+
+		Entry* find(const PipelineKey& key)
+		{
+			auto bucket = mEntries.find(hash(key));
+			if (bucket != mEntries.end())
+			{
+				for (auto& entry : bucket->second)
+				{
+					if (equal(entry->key, key))
+					{
+						return entry.get();
+					}
+				}
+			}
+			return nullptr;
+		}
+
+		Entry* insert(const PipelineKey& key)
+		{
+			std::unique_ptr<Entry> entry(new Entry());
+			entry->key = key;
+			entry->stats.name = key.name;
+
+			Entry* pointer = entry.get();
+			mEntries[hash(key)].push_back(std::move(entry));
+			return pointer;
+		}
+
+		template<typename T>
+		static void combine(size_t& seed, const T& value)
+		{
+			seed ^= std::hash<T>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		}
+
+		template<typename Handle>
+		static void combineHandle(size_t& seed, Handle handle)
+		{
+			// non-dispatchable handles are pointers on 64-bit platforms and integers on 32-bit ones
+			uint64_t bits = 0;
+			std::memcpy(&bits, &handle, sizeof(handle));
+			combine(seed, bits);
+		}
+
+		static size_t hash(const PipelineKey& key)
+		{
+			size_t seed = 0;
+			combineHandle(seed, key.vertexShader);
+			combineHandle(seed, key.fragmentShader);
+
+			for (const auto& constant : key.specialization)
+			{
+				combine(seed, constant.id);
+				combine(seed, constant.value);
+			}
+
+			for (const auto& binding : key.vertexBindings)
+			{
+				combine(seed, binding.binding);
+				combine(seed, binding.stride);
+				combine(seed, static_cast<uint32_t>(binding.inputRate));
+			}
+
+			for (const auto& attribute : key.vertexAttributes)
+			{
+				combine(seed, attribute.location);
+				combine(seed, attribute.binding);
+				combine(seed, static_cast<uint32_t>(attribute.format));
+				combine(seed, attribute.offset);
+			}
+
+			combine(seed, static_cast<uint32_t>(key.topology));
+			combine(seed, static_cast<uint32_t>(key.polygonMode));
+			combine(seed, static_cast<uint32_t>(key.cullMode));
+			combine(seed, static_cast<uint32_t>(key.frontFace));
+			combine(seed, key.depthTest);
+			combine(seed, key.depthWrite);
+			combine(seed, static_cast<uint32_t>(key.depthCompare));
+			combine(seed, key.alphaBlend);
+			combine(seed, key.colorAttachments);
+			combineHandle(seed, key.layout);
+			combineHandle(seed, key.renderPass);
+			combine(seed, key.subpass);
+			return seed;
+		}
+
+		static bool equal(const PipelineKey& a, const PipelineKey& b)
+		{
+			return a.vertexShader == b.vertexShader && a.fragmentShader == b.fragmentShader &&
+				a.specialization.size() == b.specialization.size() &&
+				std::equal(a.specialization.begin(), a.specialization.end(), b.specialization.begin(), [](const SpecializationConstant& x, const SpecializationConstant& y)
+				{
+					return x.id == y.id && x.value == y.value;
+				}) &&
+				a.vertexBindings.size() == b.vertexBindings.size() &&
+				std::equal(a.vertexBindings.begin(), a.vertexBindings.end(), b.vertexBindings.begin(), [](const VkVertexInputBindingDescription& x, const VkVertexInputBindingDescription& y)
+				{
+					return x.binding == y.binding && x.stride == y.stride && x.inputRate == y.inputRate;
+				}) &&
+				a.vertexAttributes.size() == b.vertexAttributes.size() &&
+				std::equal(a.vertexAttributes.begin(), a.vertexAttributes.end(), b.vertexAttributes.begin(), [](const VkVertexInputAttributeDescription& x, const VkVertexInputAttributeDescription& y)
+				{
+					return x.location == y.location && x.binding == y.binding && x.format == y.format && x.offset == y.offset;
+				}) &&
+				a.topology == b.topology && a.polygonMode == b.polygonMode && a.cullMode == b.cullMode && a.frontFace == b.frontFace &&
+				a.depthTest == b.depthTest && a.depthWrite == b.depthWrite && a.depthCompare == b.depthCompare &&
+				a.alphaBlend == b.alphaBlend && a.colorAttachments == b.colorAttachments && a.layout == b.layout && a.renderPass == b.renderPass && a.subpass == b.subpass;
+		}
+
+		VkDevice mDevice = VK_NULL_HANDLE;
+		jobs::JobSystem* mJobs = nullptr;
+		vk::PipelineCache mCache;
+		jobs::Counter mPrepared;													// pipelines that are being created by prepare
+
+		mutable std::mutex mMutex;
+		std::unordered_map<size_t, std::vector<std::unique_ptr<Entry>>> mEntries;
+		std::vector<PipelineStats> mRetiredStats;
+		std::atomic<uint64_t> mHits{ 0 };
+		std::atomic<uint64_t> mMisses{ 0 };
+	};
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+
+Collects named, timed stages from any number of threads and prints them as a timeline. Each stage is drawn
+as a bar relative to the start of the timeline, so stages that ran at the same time on different threads
+show up as overlapping bars:
+
+	profiler::Timeline timeline;
+	auto start = profiler::Clock::now();
+	doSomething();
+	timeline.record("doSomething", threadIndex, start, profiler::Clock::now());
+	timeline.report(std::cout);
+
+*/
+
+namespace profiler
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	struct Stage
+	{
+		std::string name;
+		uint32_t thread;
+		double startMs;															// relative to the creation of the timeline
+		double endMs;
+
+		double durationMs() const
+		{
+			return endMs - startMs;
+		}
+	};
+
+	//! running count, mean, minimum and maximum of a series of samples, i.e. frame times in milliseconds
+	class RunningStats
+	{
+	public:
+		void add(double sample)
+		{
+			mCount++;
+			mSum += sample;
+			mMin = std::min(mMin, sample);
+			mMax = std::max(mMax, sample);
+		}
+
+		void reset()
+		{
+			*this = RunningStats();
+		}
+
+		uint64_t count() const { return mCount; }
+		double mean() const { return mCount > 0 ? mSum / mCount : 0.0; }
+		double min() const { return mCount > 0 ? mMin : 0.0; }
+		double max() const { return mCount > 0 ? mMax : 0.0; }
+
+	private:
+		uint64_t mCount = 0;
+		double mSum = 0.0;
+		double mMin = std::numeric_limits<double>::max();
+		double mMax = std::numeric_limits<double>::lowest();
+	};
+
+	class Timeline
+	{
+	public:
+		Timeline() :
+			mOrigin(Clock::now())
+		{
+		}
+
+		//! restart the timeline, discarding all stages recorded so far
+		void reset()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mOrigin = Clock::now();
+			mStages.clear();
+		}
+
+		//! safe to call from any thread
+		void record(const std::string& name, uint32_t thread, Clock::time_point start, Clock::time_point end)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStages.push_back({ name, thread, toMs(start), toMs(end) });
+		}
+
+		//! a copy of all recorded stages, sorted by start time
+		std::vector<Stage> stages() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			std::vector<Stage> sorted = mStages;
+			std::sort(sorted.begin(), sorted.end(), [](const Stage& a, const Stage& b) { return a.startMs < b.startMs; });
+			return sorted;
+		}
+
+		//! print every stage with its thread, start and duration, followed by the total wall time and how much of it overlapped
+		void report(std::ostream& out, size_t barWidth = 40) const
+		{
+			std::vector<Stage> sorted = stages();
+			if (sorted.empty())
+			{
+				return;
+			}
+
+			double begin = sorted.front().startMs;
+			double end = begin;
+			double busy = 0.0;
+			size_t nameWidth = 0;
+
+			for (const auto& stage : sorted)
+			{
+				end = std::max(end, stage.endMs);
+				busy += stage.durationMs();
+				nameWidth = std::max(nameWidth, stage.name.size());
+			}
+
+			double wall = std::max(end - begin, 1e-6);
+
+			out << std::fixed << std::setprecision(2);
+
+			for (const auto& stage : sorted)
+			{
+				size_t first = static_cast<size_t>((stage.startMs - begin) / wall * barWidth);
+				size_t last = std::max(first + 1, static_cast<size_t>((stage.endMs - begin) / wall * barWidth));
+				last = std::min(last, barWidth);
+				first = std::min(first, last - 1);
+
+				out << "\t" << std::left << std::setw(nameWidth) << stage.name << std::right
+					<< "  thread " << stage.thread
+					<< std::setw(10) << stage.startMs - begin << " ms"
+					<< std::setw(10) << stage.durationMs() << " ms  |"
+					<< std::string(first, ' ') << std::string(last - first, '#') << std::string(barWidth - last, ' ') << "|" << std::endl;
+			}
+
+			out << "\tWall time " << wall << " ms, sum of all stages " << busy << " ms (" << std::max(busy - wall, 0.0) << " ms ran in parallel)" << std::endl;
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+	private:
+		double toMs(Clock::time_point time) const
+		{
+			return std::chrono::duration<double, std::milli>(time - mOrigin).count();
+		}
+
+		mutable std::mutex mMutex;
+		Clock::time_point mOrigin;
+		std::vector<Stage> mStages;
+	};
+}
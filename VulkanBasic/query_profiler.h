@@ -0,0 +1,314 @@
+#pragma once
+
+#include "deleter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+
+Frame times say how long a frame took, but not why: whether the vertices are transformed more often than
+they need to be (a mesh that makes poor use of the post-transform vertex cache), or whether the same pixels
+are shaded over and over (overdraw). Queries let the GPU count these things while it renders. The profiler
+wraps every pass of the frame in two of them:
+
+	profiler.begin(commandBuffer, imageIndex);									// resets the image's queries, outside of any render pass
+	profiler.beginPass(commandBuffer, imageIndex, "main");
+	... the pass
+	profiler.endPass(commandBuffer, imageIndex);
+	...
+	profiler.submitted(imageIndex, frame);										// once per submission of the command buffer
+	profiler.collect(completedFrame);											// whenever frames complete
+
+An occlusion query counts the samples that pass the depth test, and a pipeline statistics query (if the
+device supports pipelineStatisticsQuery) counts input assembly vertices and primitives, vertex and fragment
+shader invocations and the primitives that come out of clipping. Dividing the vertex shader invocations by
+the primitives gives the average cache miss ratio (ACMR, between 0.5 for a perfect cache and 3 for none),
+and dividing the fragment shader invocations by the pixels of the framebuffer gives the overdraw.
+
+Each variant of the command buffers (one per swap chain image) has a range of queries of its own. The
+results of a submission are only read once its frame's fence has signaled, by which time they are
+available, so vkGetQueryPoolResults is called without VK_QUERY_RESULT_WAIT_BIT and never stalls; the
+counters lag the frame that is being rendered by however many frames are in flight. A variant's queries are
+reset by the command buffer itself, so its results have to be collected before it is submitted again.
+
+The draws are recorded into secondary command buffers that execute while the queries are active, which
+requires the inheritedQueries feature and the inheritance info from inheritance.
+
+*/
+
+namespace vk
+{
+	//! the counters of one pass, summed over the frames that have been read back
+	struct PassQueryStats
+	{
+		std::string name;
+		uint64_t frames = 0;
+		uint64_t samplesPassed = 0;													// exact with occlusionQueryPrecise, otherwise only zero or not
+		uint64_t inputVertices = 0;
+		uint64_t inputPrimitives = 0;
+		uint64_t vertexShaderInvocations = 0;
+		uint64_t clippingInvocations = 0;
+		uint64_t clippingPrimitives = 0;
+		uint64_t fragmentShaderInvocations = 0;
+	};
+
+	class QueryProfiler
+	{
+	public:
+		static const uint32_t sMaxPasses = 8;										// per variant, the passes after these aren't measured
+
+		QueryProfiler() = default;
+		QueryProfiler(const QueryProfiler&) = delete;
+		QueryProfiler& operator=(const QueryProfiler&) = delete;
+
+		//! create the query pools for variants sets of passes; pipelineStatistics and precise must match the enabled device features
+		void init(VkDevice device, bool pipelineStatistics, bool precise, uint32_t variants)
+		{
+			mDevice = device;
+			mPrecise = precise;
+			mStatisticsFlags = pipelineStatistics ? sStatistics : 0;
+			mRecorded.assign(variants, std::vector<std::string>());
+
+			VkQueryPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			poolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+			poolInfo.queryCount = variants * sMaxPasses;
+
+			if (vkCreateQueryPool(device, &poolInfo, allocationCallbacks(), mOcclusionPool.replace(device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create occlusion query pool.");
+			}
+
+			if (pipelineStatistics)
+			{
+				poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+				poolInfo.pipelineStatistics = mStatisticsFlags;
+
+				if (vkCreateQueryPool(device, &poolInfo, allocationCallbacks(), mStatisticsPool.replace(device)) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create pipeline statistics query pool.");
+				}
+			}
+		}
+
+		bool enabled() const { return mOcclusionPool.get() != VK_NULL_HANDLE; }
+		bool pipelineStatistics() const { return mStatisticsFlags != 0; }
+
+		//! the queries that a secondary command buffer executed within a measured pass inherits
+		void inheritance(VkCommandBufferInheritanceInfo& inheritanceInfo) const
+		{
+			if (enabled())
+			{
+				inheritanceInfo.occlusionQueryEnable = VK_TRUE;
+				inheritanceInfo.queryFlags = mPrecise ? VK_QUERY_CONTROL_PRECISE_BIT : 0;
+				inheritanceInfo.pipelineStatistics = mStatisticsFlags;
+			}
+		}
+
+		//! reset the variant's queries, at the start of its command buffer
+		void begin(VkCommandBuffer commandBuffer, uint32_t variant)
+		{
+			if (!enabled())
+			{
+				return;
+			}
+
+			vkCmdResetQueryPool(commandBuffer, mOcclusionPool, variant * sMaxPasses, sMaxPasses);
+			if (pipelineStatistics())
+			{
+				vkCmdResetQueryPool(commandBuffer, mStatisticsPool, variant * sMaxPasses, sMaxPasses);
+			}
+			mRecorded[variant].clear();
+		}
+
+		//! start measuring a pass, outside of its render pass; returns whether endPass has to be called
+		bool beginPass(VkCommandBuffer commandBuffer, uint32_t variant, const std::string& name)
+		{
+			if (!enabled() || mRecorded[variant].size() == sMaxPasses)
+			{
+				return false;
+			}
+
+			uint32_t query = variant * sMaxPasses + static_cast<uint32_t>(mRecorded[variant].size());
+			mRecorded[variant].push_back(name);
+
+			vkCmdBeginQuery(commandBuffer, mOcclusionPool, query, mPrecise ? VK_QUERY_CONTROL_PRECISE_BIT : 0);
+			if (pipelineStatistics())
+			{
+				vkCmdBeginQuery(commandBuffer, mStatisticsPool, query, 0);
+			}
+			return true;
+		}
+
+		//! stop measuring the pass that the last beginPass started
+		void endPass(VkCommandBuffer commandBuffer, uint32_t variant)
+		{
+			uint32_t query = variant * sMaxPasses + static_cast<uint32_t>(mRecorded[variant].size()) - 1;
+
+			if (pipelineStatistics())
+			{
+				vkCmdEndQuery(commandBuffer, mStatisticsPool, query);
+			}
+			vkCmdEndQuery(commandBuffer, mOcclusionPool, query);
+		}
+
+		//! the variant's command buffer has been submitted as the given frame
+		void submitted(uint32_t variant, uint64_t frame)
+		{
+			if (enabled() && !mRecorded[variant].empty())
+			{
+				mPending.push_back({ frame, variant, mRecorded[variant] });
+			}
+		}
+
+		//! read back the results of every submission up to the completed frame, without waiting for any
+		void collect(uint64_t completedFrame)
+		{
+			while (!mPending.empty() && mPending.front().frame <= completedFrame)
+			{
+				read(mPending.front());
+				mPending.pop_front();
+			}
+		}
+
+		//! forget the results read back so far, and the submissions that haven't been read back yet
+		void reset()
+		{
+			mPending.clear();
+			mPasses.clear();
+			mFrames = 0;
+			mNotReady = 0;
+		}
+
+		const std::vector<PassQueryStats>& stats() const { return mPasses; }
+
+		//! the average counters of each pass per frame, relative to a framebuffer of pixels pixels
+		void report(std::ostream& out, uint64_t pixels) const
+		{
+			if (!enabled())
+			{
+				return;
+			}
+
+			out << "Queries over " << mFrames << " frames (" << mNotReady << " not ready), per frame:" << std::endl;
+
+			out << std::fixed << std::setprecision(2);
+			for (const PassQueryStats& pass : mPasses)
+			{
+				double frames = static_cast<double>(std::max<uint64_t>(pass.frames, 1));
+				out << "\t" << std::left << std::setw(14) << pass.name << std::right;
+				if (pipelineStatistics())
+				{
+					out << pass.inputVertices / frames << " input vertices, " << pass.inputPrimitives / frames << " primitives, "
+						<< pass.vertexShaderInvocations / frames << " VS invocations (ACMR " << ratio(pass.vertexShaderInvocations, pass.inputPrimitives) << "), "
+						<< pass.clippingPrimitives / frames << " clipped primitives (of " << pass.clippingInvocations / frames << "), "
+						<< pass.fragmentShaderInvocations / frames << " FS invocations (overdraw " << ratio(pass.fragmentShaderInvocations, pass.frames * pixels) << "), ";
+				}
+				if (mPrecise)
+				{
+					out << pass.samplesPassed / frames << " samples passed (" << ratio(pass.samplesPassed, pass.frames * pixels) << " per pixel)";
+				}
+				else
+				{
+					out << "samples passed in " << pass.samplesPassed << " of " << pass.frames << " frames";
+				}
+				out << std::endl;
+			}
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+	private:
+		// the results of a pipeline statistics query come back in the order of the bits, lowest first
+		static const VkQueryPipelineStatisticFlags sStatistics =
+			VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+		static const uint32_t sStatisticCount = 6;
+
+		//! a submitted command buffer, along with the passes that it measures
+		struct Submission
+		{
+			uint64_t frame;
+			uint32_t variant;
+			std::vector<std::string> passes;
+		};
+
+		static double ratio(uint64_t a, uint64_t b)
+		{
+			return b > 0 ? static_cast<double>(a) / b : 0.0;
+		}
+
+		void read(const Submission& submission)
+		{
+			uint32_t first = submission.variant * sMaxPasses;
+			uint32_t count = static_cast<uint32_t>(submission.passes.size());
+
+			std::vector<uint64_t> samples(count);
+			VkResult result = vkGetQueryPoolResults(mDevice, mOcclusionPool, first, count, samples.size() * sizeof(uint64_t), samples.data(),
+				sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+			std::vector<uint64_t> statistics(count * sStatisticCount);
+			if (result == VK_SUCCESS && pipelineStatistics())
+			{
+				result = vkGetQueryPoolResults(mDevice, mStatisticsPool, first, count, statistics.size() * sizeof(uint64_t), statistics.data(),
+					sStatisticCount * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+			}
+
+			// the frame's fence has signaled, so this shouldn't happen, but there's no point in waiting if it does
+			if (result != VK_SUCCESS)
+			{
+				mNotReady++;
+				return;
+			}
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				PassQueryStats& pass = find(submission.passes[i]);
+				const uint64_t* s = &statistics[i * sStatisticCount];
+				pass.frames++;
+				pass.samplesPassed += mPrecise ? samples[i] : (samples[i] > 0 ? 1 : 0);
+				pass.inputVertices += s[0];
+				pass.inputPrimitives += s[1];
+				pass.vertexShaderInvocations += s[2];
+				pass.clippingInvocations += s[3];
+				pass.clippingPrimitives += s[4];
+				pass.fragmentShaderInvocations += s[5];
+			}
+			mFrames++;
+		}
+
+		PassQueryStats& find(const std::string& name)
+		{
+			auto pass = std::find_if(mPasses.begin(), mPasses.end(), [&](const PassQueryStats& p) { return p.name == name; });
+			if (pass != mPasses.end())
+			{
+				return *pass;
+			}
+			mPasses.push_back(PassQueryStats());
+			mPasses.back().name = name;
+			return mPasses.back();
+		}
+
+		VkDevice mDevice = VK_NULL_HANDLE;
+		QueryPool mOcclusionPool;
+		QueryPool mStatisticsPool;														// only with pipelineStatisticsQuery
+		VkQueryPipelineStatisticFlags mStatisticsFlags = 0;
+		bool mPrecise = false;
+
+		std::vector<std::vector<std::string>> mRecorded;								// per variant, the passes its command buffer measures
+		std::deque<Submission> mPending;												// oldest first
+		std::vector<PassQueryStats> mPasses;											// in the order they were first read back
+		uint64_t mFrames = 0;
+		uint64_t mNotReady = 0;
+	};
+}
@@ -0,0 +1,872 @@
+#pragma once
+
+#include "barrier_batch.h"
+#include "deletion_queue.h"
+#include "query_profiler.h"
+#include "transient_attachments.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+
+Every pass of a frame reads and writes images and buffers, and between two passes that touch the same
+resource there has to be a pipeline barrier: one that waits for the right stages, makes the right writes
+visible, and transitions the image into the layout the next pass needs. Writing those barriers by hand is
+easy to get wrong once there's more than one pass, and the safe way out (waiting for everything) throws
+away the overlap between passes. The render graph derives them instead. Passes are declared in the order
+they run, along with the resources they access and how:
+
+	vk::RenderGraph::ResourceId backbuffer = graph.importImage("swap chain", format, VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vk::ResourceUsage::Present);
+	vk::RenderGraph::ResourceId depth = graph.createImage("depth", depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+	graph.addPass("main")
+		.clear(backbuffer, vk::ResourceUsage::ColorAttachment, clearColor)
+		.clear(depth, vk::ResourceUsage::DepthAttachment, clearDepth)
+		.record([&](const vk::RenderGraph::PassContext& context) { ... });
+
+	graph.compile(device);
+	graph.setImportedImages(backbuffer, images, views);
+	graph.createResources(physicalDevice, extent);
+	...
+	graph.execute(commandBuffer, imageIndex);
+
+compile works out, once, everything that doesn't depend on the actual images:
+
+1. Passes whose results are never used are culled: walking backwards from the imported resources (the
+   graph's outputs), a pass only survives if something later reads what it writes (or it is marked with
+   sideEffects).
+2. The barriers in front of each pass are derived by following the state of every resource through the
+   surviving passes. Reads after reads in the same layout need no barrier at all, and all of a pass's
+   barriers are recorded together as a vk::BarrierBatch (one vkCmdPipelineBarrier per pair of stages).
+3. Every pass that renders into attachments gets a render pass of its own, whose load and store ops follow
+   from the graph: an attachment is only loaded if an earlier pass wrote it, and only stored if a later
+   pass reads it (or it's imported).
+
+Resources that the graph creates itself are transient: they only exist between the first and the last
+pass that uses them, so their contents don't survive from one frame to the next. createResources hands
+them to vk::TransientAttachments, which aliases the memory of resources whose lifetimes don't overlap;
+the first barrier of each one then waits for the last use of whatever it shares memory with.
+
+*/
+
+namespace vk
+{
+	struct RenderGraphStats
+	{
+		uint32_t passes = 0;
+		uint32_t culledPasses = 0;
+		uint32_t renderPasses = 0;
+		BarrierStats barriers;															// recorded by every execute
+	};
+
+	class RenderGraph
+	{
+	public:
+		using ResourceId = uint32_t;
+		using PassId = uint32_t;
+
+		//! what a pass's record function gets to work with
+		struct PassContext
+		{
+			VkCommandBuffer commandBuffer;
+			uint32_t variant;															// which of the imported images is used, i.e. the swap chain image index
+			VkRenderPass renderPass;													// VK_NULL_HANDLE unless the pass renders into attachments
+			VkFramebuffer framebuffer;
+			VkExtent2D extent;
+		};
+
+		using RecordFunction = std::function<void(const PassContext&)>;
+
+		class PassBuilder
+		{
+		public:
+			//! the pass reads the resource, with a usage that doesn't write
+			PassBuilder& read(ResourceId resource, ResourceUsage usage)
+			{
+				return use(resource, usage, Mode::Read, {});
+			}
+
+			//! the pass writes (part of) the resource, keeping what earlier passes wrote
+			PassBuilder& write(ResourceId resource, ResourceUsage usage)
+			{
+				return use(resource, usage, Mode::Write, {});
+			}
+
+			//! the pass overwrites the resource: attachments are cleared to value when the render pass begins, other resources are simply not loaded
+			PassBuilder& clear(ResourceId resource, ResourceUsage usage, VkClearValue value = {})
+			{
+				return use(resource, usage, Mode::Clear, value);
+			}
+
+			//! how the render pass's commands are provided, see vkCmdBeginRenderPass
+			PassBuilder& contents(VkSubpassContents contents)
+			{
+				mGraph.mPasses[mPass].contents = contents;
+				return *this;
+			}
+
+			//! keep the pass even if nothing reads what it writes
+			PassBuilder& sideEffects()
+			{
+				mGraph.mPasses[mPass].sideEffects = true;
+				return *this;
+			}
+
+			PassBuilder& record(RecordFunction record)
+			{
+				mGraph.mPasses[mPass].record = std::move(record);
+				return *this;
+			}
+
+			PassId id() const { return mPass; }
+			operator PassId() const { return mPass; }
+
+		private:
+			friend class RenderGraph;
+
+			PassBuilder(RenderGraph& graph, PassId pass) : mGraph(graph), mPass(pass) {}
+
+			enum class Mode
+			{
+				Read,
+				Write,
+				Clear
+			};
+
+			//! the one place that records an access: the usage has to agree with whether the pass reads or writes
+			PassBuilder& use(ResourceId resource, ResourceUsage usage, Mode mode, VkClearValue value)
+			{
+				if (usageAccess(usage).write != (mode != Mode::Read))
+				{
+					throw std::invalid_argument("Pass " + mGraph.mPasses[mPass].name + (mode == Mode::Read ? " reads " : " writes ") + mGraph.mResources[resource].name +
+						(mode == Mode::Read ? " with a usage that writes." : " with a usage that doesn't write."));
+				}
+
+				Access a;
+				a.resource = resource;
+				a.usage = usage;
+				a.clear = mode == Mode::Clear;
+				a.clearValue = value;
+				mGraph.mPasses[mPass].accesses.push_back(a);
+				return *this;
+			}
+
+			RenderGraph& mGraph;
+			PassId mPass;
+		};
+
+		RenderGraph() = default;
+		RenderGraph(const RenderGraph&) = delete;
+		RenderGraph& operator=(const RenderGraph&) = delete;
+
+		//! an image that lives outside of the graph, in initialLayout once initialStages are done with it, which has to end up in finalUsage
+		ResourceId importImage(const std::string& name, VkFormat format, VkImageAspectFlags aspect, VkImageLayout initialLayout, VkPipelineStageFlags initialStages, ResourceUsage finalUsage)
+		{
+			Resource resource;
+			resource.name = name;
+			resource.imported = true;
+			resource.format = format;
+			resource.aspect = aspect;
+			resource.initialLayout = initialLayout;
+			resource.initialStages = initialStages;
+			resource.finalUsage = finalUsage;
+			mResources.push_back(resource);
+			return static_cast<ResourceId>(mResources.size() - 1);
+		}
+
+		//! a transient image as large as the graph's extent
+		ResourceId createImage(const std::string& name, VkFormat format, VkImageAspectFlags aspect)
+		{
+			Resource resource;
+			resource.name = name;
+			resource.format = format;
+			resource.aspect = aspect;
+			mResources.push_back(resource);
+			return static_cast<ResourceId>(mResources.size() - 1);
+		}
+
+		//! a transient buffer
+		ResourceId createBuffer(const std::string& name, VkDeviceSize size)
+		{
+			Resource resource;
+			resource.name = name;
+			resource.isBuffer = true;
+			resource.size = size;
+			mResources.push_back(resource);
+			return static_cast<ResourceId>(mResources.size() - 1);
+		}
+
+		//! passes run in the order they're added
+		PassBuilder addPass(const std::string& name)
+		{
+			Pass pass;
+			pass.name = name;
+			mPasses.push_back(std::move(pass));
+			return PassBuilder(*this, static_cast<PassId>(mPasses.size() - 1));
+		}
+
+		//! the handles of an imported image, one per variant (execute picks one)
+		void setImportedImages(ResourceId resource, const std::vector<VkImage>& images, const std::vector<VkImageView>& views)
+		{
+			mResources[resource].images = images;
+			mResources[resource].views = views;
+		}
+
+		//! cull unused passes, derive the barriers and create the render passes
+		void compile(VkDevice device)
+		{
+			mDevice = device;
+			cull();
+
+			for (Pass& pass : mPasses)
+			{
+				pass.barriers.clear();
+				for (const Access& a : pass.accesses)
+				{
+					UsageAccess u = usageAccess(a.usage);
+					mResources[a.resource].imageUsage |= u.imageUsage;
+					mResources[a.resource].bufferUsage |= u.bufferUsage;
+				}
+			}
+
+			deriveBarriers();
+
+			for (Pass& pass : mPasses)
+			{
+				if (pass.alive)
+				{
+					createRenderPass(pass);
+				}
+			}
+		}
+
+		//! create the transient resources and the framebuffers, for the given extent and the handles passed to setImportedImages
+		void createResources(VkPhysicalDevice physicalDevice, VkExtent2D extent)
+		{
+			mExtent = extent;
+
+			std::vector<uint32_t> transients;
+			for (ResourceId r = 0; r < mResources.size(); ++r)
+			{
+				Resource& resource = mResources[r];
+				if (resource.imported || resource.firstPass > resource.lastPass)
+				{
+					continue;
+				}
+
+				if (resource.isBuffer)
+				{
+					resource.transient = mTransients.addBuffer({ resource.name, resource.size, resource.bufferUsage, resource.firstPass, resource.lastPass });
+				}
+				else
+				{
+					// only an image that a single render pass uses never has its contents stored or loaded
+					bool lazy = resource.firstPass == resource.lastPass;
+					resource.transient = mTransients.add({ resource.name, resource.format, extent, resource.imageUsage, resource.aspect, resource.firstPass, resource.lastPass, lazy });
+				}
+				transients.push_back(r);
+			}
+			mTransients.build(mDevice, physicalDevice);
+			resolveAliasing(transients);
+
+			uint32_t variants = 1;
+			for (const Resource& resource : mResources)
+			{
+				variants = std::max(variants, static_cast<uint32_t>(resource.views.size()));
+			}
+
+			for (Pass& pass : mPasses)
+			{
+				if (pass.renderPass.get() != VK_NULL_HANDLE)
+				{
+					createFramebuffers(pass, variants);
+				}
+			}
+		}
+
+		//! retire the transient resources and framebuffers, i.e. before createResources is called again for a new extent
+		void retireResources(DeletionQueue& queue, uint64_t frame)
+		{
+			for (Pass& pass : mPasses)
+			{
+				queue.retire(pass.framebuffers, frame);
+			}
+			mTransients.retire(queue, frame);
+		}
+
+		//! retire everything and forget the passes and resources, so that the graph can be declared again
+		void retire(DeletionQueue& queue, uint64_t frame)
+		{
+			retireResources(queue, frame);
+			for (Pass& pass : mPasses)
+			{
+				queue.retire(std::move(pass.renderPass), frame);
+			}
+			mPasses.clear();
+			mResources.clear();
+			mFinalBarriers.clear();
+		}
+
+		//! record every pass that survived culling, along with the barriers in front of it and the transitions into the final usages at the end, returning the barriers recorded; queries (if any) measure each pass
+		BarrierStats execute(VkCommandBuffer commandBuffer, uint32_t variant, QueryProfiler* queries = nullptr) const
+		{
+			BarrierStats recorded;
+			for (const Pass& pass : mPasses)
+			{
+				if (!pass.alive)
+				{
+					continue;
+				}
+
+				recorded += batch(pass.barriers, variant).flush(commandBuffer);
+
+				bool measured = queries && queries->beginPass(commandBuffer, variant, pass.name);
+
+				PassContext context = { commandBuffer, variant, pass.renderPass, VK_NULL_HANDLE, mExtent };
+				if (pass.renderPass.get() != VK_NULL_HANDLE)
+				{
+					context.framebuffer = pass.framebuffers[std::min<size_t>(variant, pass.framebuffers.size() - 1)];
+
+					VkRenderPassBeginInfo renderPassInfo = {};
+					renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+					renderPassInfo.renderPass = pass.renderPass;
+					renderPassInfo.framebuffer = context.framebuffer;
+					renderPassInfo.renderArea.offset = { 0, 0 };
+					renderPassInfo.renderArea.extent = mExtent;
+					renderPassInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+					renderPassInfo.pClearValues = pass.clearValues.data();
+
+					vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.contents);
+					if (pass.record)
+					{
+						pass.record(context);
+					}
+					vkCmdEndRenderPass(commandBuffer);
+				}
+				else if (pass.record)
+				{
+					pass.record(context);
+				}
+
+				if (measured)
+				{
+					queries->endPass(commandBuffer, variant);
+				}
+			}
+
+			recorded += batch(mFinalBarriers, variant).flush(commandBuffer);
+			return recorded;
+		}
+
+		VkRenderPass renderPass(PassId pass) const { return mPasses[pass].renderPass; }
+		VkFramebuffer framebuffer(PassId pass, uint32_t variant) const { return mPasses[pass].framebuffers[variant]; }
+		bool alive(PassId pass) const { return mPasses[pass].alive; }
+		const TransientAttachments& transients() const { return mTransients; }
+
+		RenderGraphStats stats() const
+		{
+			RenderGraphStats s;
+			s.passes = static_cast<uint32_t>(mPasses.size());
+			auto count = [&](const std::vector<Barrier>& barriers)
+			{
+				// only the stages matter for how the barriers are grouped, so this works before there are any images as well
+				BarrierBatch batch;
+				for (const Barrier& barrier : barriers)
+				{
+					if (mResources[barrier.resource].isBuffer)
+					{
+						batch.buffer(VkBufferMemoryBarrier{}, barrier.srcStages, barrier.dstStages);
+					}
+					else
+					{
+						batch.image(VkImageMemoryBarrier{}, barrier.srcStages, barrier.dstStages);
+					}
+				}
+				s.barriers += batch.stats();
+			};
+
+			for (const Pass& pass : mPasses)
+			{
+				if (!pass.alive)
+				{
+					s.culledPasses++;
+					continue;
+				}
+				if (pass.renderPass.get() != VK_NULL_HANDLE)
+				{
+					s.renderPasses++;
+				}
+				count(pass.barriers);
+			}
+			count(mFinalBarriers);
+			return s;
+		}
+
+		void report(std::ostream& out) const
+		{
+			RenderGraphStats s = stats();
+			out << "Render graph: " << s.passes - s.culledPasses << " of " << s.passes << " passes (" << s.renderPasses << " render passes), "
+				<< s.barriers.imageBarriers << " image and " << s.barriers.bufferBarriers << " buffer barriers in " << s.barriers.batches << " vkCmdPipelineBarrier calls per frame." << std::endl;
+			for (const Pass& pass : mPasses)
+			{
+				out << "\t" << pass.name << ": ";
+				if (!pass.alive)
+				{
+					out << "culled" << std::endl;
+					continue;
+				}
+				out << pass.accesses.size() << " resources, " << pass.barriers.size() << " barriers";
+				for (const Barrier& barrier : pass.barriers)
+				{
+					out << (&barrier == &pass.barriers.front() ? " (" : ", ") << mResources[barrier.resource].name;
+				}
+				out << (pass.barriers.empty() ? "" : ")") << std::endl;
+			}
+			mTransients.report(out);
+		}
+
+	private:
+		struct Resource
+		{
+			std::string name;
+			bool imported = false;
+			bool isBuffer = false;
+			VkFormat format = VK_FORMAT_UNDEFINED;
+			VkImageAspectFlags aspect = 0;
+			VkDeviceSize size = 0;
+			VkImageUsageFlags imageUsage = 0;
+			VkBufferUsageFlags bufferUsage = 0;
+
+			// imported resources only
+			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkPipelineStageFlags initialStages = 0;
+			ResourceUsage finalUsage = ResourceUsage::None;
+			std::vector<VkImage> images;
+			std::vector<VkImageView> views;
+
+			// transient resources only: the surviving passes that use them, numbered in the order they run
+			uint32_t firstPass = 1;
+			uint32_t lastPass = 0;
+			uint32_t transient = 0;
+		};
+
+		struct Access
+		{
+			ResourceId resource;
+			ResourceUsage usage;
+			bool clear;
+			VkClearValue clearValue;
+		};
+
+		struct Barrier
+		{
+			ResourceId resource;
+			VkPipelineStageFlags srcStages;
+			VkAccessFlags srcAccess;
+			VkPipelineStageFlags dstStages;
+			VkAccessFlags dstAccess;
+			VkImageLayout oldLayout;
+			VkImageLayout newLayout;
+			bool firstUse;																// of a transient resource in the frame, see resolveAliasing
+		};
+
+		struct Pass
+		{
+			std::string name;
+			std::vector<Access> accesses;
+			RecordFunction record;
+			VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
+			bool sideEffects = false;
+
+			bool alive = true;
+			std::vector<Barrier> barriers;												// recorded in front of the pass
+			RenderPass renderPass;
+			std::vector<ResourceId> attachments;
+			std::vector<VkClearValue> clearValues;
+			std::vector<Framebuffer> framebuffers;										// one per variant
+		};
+
+		//! what the graph knows about a resource between two passes
+		struct State
+		{
+			VkImageLayout layout;
+			VkPipelineStageFlags writeStages;											// the last write, which later accesses have to wait for
+			VkAccessFlags writeAccess;
+			VkPipelineStageFlags readStages;											// the reads since then, which the next write has to wait for
+			VkAccessFlags readAccess;													// the reads that the last write has been made visible to
+		};
+
+		//! walk backwards from the outputs, keeping only the passes that contribute to them
+		void cull()
+		{
+			std::vector<bool> needed(mResources.size(), false);
+			for (ResourceId r = 0; r < mResources.size(); ++r)
+			{
+				needed[r] = mResources[r].imported;
+			}
+
+			for (size_t p = mPasses.size(); p-- > 0;)
+			{
+				Pass& pass = mPasses[p];
+				pass.alive = pass.sideEffects || std::any_of(pass.accesses.begin(), pass.accesses.end(), [&](const Access& a)
+				{
+					return usageAccess(a.usage).write && needed[a.resource];
+				});
+
+				if (!pass.alive)
+				{
+					continue;
+				}
+
+				// a cleared resource doesn't depend on what came before, while everything else the pass accesses does
+				for (const Access& a : pass.accesses)
+				{
+					needed[a.resource] = !a.clear || mResources[a.resource].imported;
+				}
+			}
+		}
+
+		State initialState(const Resource& resource) const
+		{
+			State state = {};
+			state.layout = resource.imported ? resource.initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+			state.writeStages = resource.initialStages;
+			return state;
+		}
+
+		//! follow every resource through the surviving passes and collect the barriers that each pass needs
+		void deriveBarriers()
+		{
+			std::vector<State> states(mResources.size());
+			for (ResourceId r = 0; r < mResources.size(); ++r)
+			{
+				states[r] = initialState(mResources[r]);
+				mResources[r].firstPass = 1;
+				mResources[r].lastPass = 0;
+			}
+
+			uint32_t order = 0;
+			for (Pass& pass : mPasses)
+			{
+				if (!pass.alive)
+				{
+					continue;
+				}
+
+				for (const Access& a : pass.accesses)
+				{
+					Resource& resource = mResources[a.resource];
+					bool firstUse = !resource.imported && resource.firstPass > resource.lastPass;
+					if (firstUse)
+					{
+						resource.firstPass = order;
+					}
+					resource.lastPass = order;
+
+					transition(pass.barriers, a.resource, states[a.resource], usageAccess(a.usage), firstUse);
+				}
+				++order;
+			}
+
+			// the transient resources start every frame where the last frame left them, apart from their contents
+			mEndStates = states;
+			for (ResourceId r = 0; r < mResources.size(); ++r)
+			{
+				const State& end = states[r];
+				for (Pass& pass : mPasses)
+				{
+					for (Barrier& barrier : pass.barriers)
+					{
+						if (barrier.resource == r && barrier.firstUse)
+						{
+							barrier.srcStages = end.writeStages | end.readStages;
+							barrier.srcAccess = end.writeAccess;
+						}
+					}
+				}
+			}
+
+			mFinalBarriers.clear();
+			for (ResourceId r = 0; r < mResources.size(); ++r)
+			{
+				if (mResources[r].imported && mResources[r].finalUsage != ResourceUsage::None)
+				{
+					transition(mFinalBarriers, r, states[r], usageAccess(mResources[r].finalUsage), false);
+				}
+			}
+		}
+
+		//! add the barrier (if any) that an access needs, and update the resource's state
+		void transition(std::vector<Barrier>& barriers, ResourceId r, State& state, const UsageAccess& u, bool firstUse)
+		{
+			const Resource& resource = mResources[r];
+			bool layoutChange = !resource.isBuffer && state.layout != u.layout;
+
+			if (u.write || layoutChange || firstUse)
+			{
+				// write after read only needs an execution dependency, write after write a memory dependency as well
+				VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+				if (layoutChange || firstUse || srcStages != 0)
+				{
+					barriers.push_back({ r, srcStages, state.writeAccess, u.stages, u.access, resource.isBuffer ? VK_IMAGE_LAYOUT_UNDEFINED : (firstUse ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout), u.layout, firstUse });
+				}
+
+				state.layout = u.layout;
+				state.writeStages = u.write ? u.stages : state.writeStages;
+				state.writeAccess = u.write ? writeAccess(u.access) : state.writeAccess;
+				state.readStages = u.write ? 0 : u.stages;
+				state.readAccess = u.write ? 0 : u.access;
+				return;
+			}
+
+			// read after read needs nothing, and neither does a read that the last write has already been made visible to
+			bool visible = (state.readStages & u.stages) == u.stages && (state.readAccess & u.access) == u.access;
+			if (state.writeAccess != 0 && !visible)
+			{
+				barriers.push_back({ r, state.writeStages, state.writeAccess, u.stages, u.access, state.layout, state.layout, false });
+				state.readAccess |= u.access;
+			}
+			state.readStages |= u.stages;
+		}
+
+		//! the first use of a transient resource has to wait for the last use of the resource it took the memory from
+		void resolveAliasing(const std::vector<uint32_t>& transients)
+		{
+			for (ResourceId r : transients)
+			{
+				const Resource& resource = mResources[r];
+				uint32_t slot = mTransients.slot(resource.transient);
+
+				// the previous owner of the memory is the last resource in the same slot that is done before this one starts...
+				ResourceId previous = r;
+				bool found = false;
+				for (ResourceId other : transients)
+				{
+					const Resource& o = mResources[other];
+					if (other != r && mTransients.slot(o.transient) == slot && o.lastPass < resource.firstPass && (!found || o.lastPass > mResources[previous].lastPass))
+					{
+						previous = other;
+						found = true;
+					}
+				}
+
+				// ...or, for the first one in the frame, the one that was used last in the previous frame (possibly itself, which deriveBarriers took care of)
+				for (ResourceId other : transients)
+				{
+					const Resource& o = mResources[other];
+					if (!found && mTransients.slot(o.transient) == slot && o.lastPass > mResources[previous].lastPass)
+					{
+						previous = other;
+					}
+				}
+
+				if (previous == r)
+				{
+					continue;
+				}
+
+				VkPipelineStageFlags stages = mEndStates[previous].writeStages | mEndStates[previous].readStages;
+				VkAccessFlags writes = mEndStates[previous].writeAccess;
+
+				for (Pass& pass : mPasses)
+				{
+					for (Barrier& barrier : pass.barriers)
+					{
+						if (barrier.resource == r && barrier.firstUse)
+						{
+							barrier.srcStages = stages;
+							barrier.srcAccess = writes;
+						}
+					}
+				}
+			}
+		}
+
+		void createRenderPass(Pass& pass)
+		{
+			/*
+
+			The barriers in front of the pass have already moved every attachment into the layout that the
+			pass uses, so the render pass leaves the layouts alone (and needs no subpass dependencies of its
+			own). Load and store ops follow from the other passes: contents are loaded only if an earlier
+			pass wrote them, and stored only if a later pass (or whoever imported the image) reads them.
+
+			*/
+
+			std::vector<VkAttachmentDescription> descriptions;
+			std::vector<VkAttachmentReference> colorReferences;
+			VkAttachmentReference depthReference = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+			pass.attachments.clear();
+			pass.clearValues.clear();
+
+			size_t index = &pass - mPasses.data();
+			for (const Access& a : pass.accesses)
+			{
+				UsageAccess u = usageAccess(a.usage);
+				if (!u.attachment)
+				{
+					continue;
+				}
+
+				const Resource& resource = mResources[a.resource];
+				bool earlierWrite = resource.imported && resource.initialLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+				bool laterUse = resource.imported;
+				for (size_t p = 0; p < mPasses.size(); ++p)
+				{
+					if (p == index || !mPasses[p].alive)
+					{
+						continue;
+					}
+					for (const Access& other : mPasses[p].accesses)
+					{
+						if (other.resource == a.resource)
+						{
+							earlierWrite |= p < index && usageAccess(other.usage).write;
+							laterUse |= p > index;
+						}
+					}
+				}
+
+				VkAttachmentLoadOp load = a.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : (earlierWrite ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+				VkAttachmentStoreOp store = u.write && laterUse ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				if (!u.write && laterUse)
+				{
+					// a read-only attachment has nothing new to store, but DONT_CARE would allow the contents to be discarded
+					store = VK_ATTACHMENT_STORE_OP_STORE;
+				}
+				bool stencil = (resource.aspect & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+
+				VkAttachmentDescription description = {};
+				description.format = resource.format;
+				description.samples = VK_SAMPLE_COUNT_1_BIT;
+				description.loadOp = load;
+				description.storeOp = store;
+				description.stencilLoadOp = stencil ? load : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				description.stencilStoreOp = stencil ? store : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				description.initialLayout = u.layout;
+				description.finalLayout = u.layout;
+
+				VkAttachmentReference reference = { static_cast<uint32_t>(descriptions.size()), u.layout };
+				if (a.usage == ResourceUsage::ColorAttachment)
+				{
+					colorReferences.push_back(reference);
+				}
+				else
+				{
+					depthReference = reference;
+				}
+
+				descriptions.push_back(description);
+				pass.attachments.push_back(a.resource);
+				pass.clearValues.push_back(a.clearValue);
+			}
+
+			if (descriptions.empty())
+			{
+				return;
+			}
+
+			VkSubpassDescription subpass = {};
+			subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+			subpass.pColorAttachments = colorReferences.data();
+			subpass.pDepthStencilAttachment = depthReference.attachment != VK_ATTACHMENT_UNUSED ? &depthReference : nullptr;
+
+			VkRenderPassCreateInfo renderPassInfo = {};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			renderPassInfo.attachmentCount = static_cast<uint32_t>(descriptions.size());
+			renderPassInfo.pAttachments = descriptions.data();
+			renderPassInfo.subpassCount = 1;
+			renderPassInfo.pSubpasses = &subpass;
+
+			if (vkCreateRenderPass(mDevice, &renderPassInfo, allocationCallbacks(), pass.renderPass.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create the render pass of " + pass.name + ".");
+			}
+		}
+
+		void createFramebuffers(Pass& pass, uint32_t variants)
+		{
+			pass.framebuffers.resize(variants);
+			for (uint32_t v = 0; v < variants; ++v)
+			{
+				std::vector<VkImageView> views;
+				for (ResourceId r : pass.attachments)
+				{
+					const Resource& resource = mResources[r];
+					views.push_back(resource.imported ? resource.views[std::min<size_t>(v, resource.views.size() - 1)] : mTransients.view(resource.transient));
+				}
+
+				VkFramebufferCreateInfo framebufferInfo = {};
+				framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+				framebufferInfo.renderPass = pass.renderPass;
+				framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+				framebufferInfo.pAttachments = views.data();
+				framebufferInfo.width = mExtent.width;
+				framebufferInfo.height = mExtent.height;
+				framebufferInfo.layers = 1;
+
+				if (vkCreateFramebuffer(mDevice, &framebufferInfo, allocationCallbacks(), pass.framebuffers[v].replace(mDevice)) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create a framebuffer for " + pass.name + ".");
+				}
+			}
+		}
+
+		//! the barriers for one of the variants (the imported images differ between them)
+		BarrierBatch batch(const std::vector<Barrier>& barriers, uint32_t variant) const
+		{
+			BarrierBatch batch;
+			for (const Barrier& barrier : barriers)
+			{
+				const Resource& resource = mResources[barrier.resource];
+				if (resource.isBuffer)
+				{
+					VkBufferMemoryBarrier b = {};
+					b.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+					b.srcAccessMask = barrier.srcAccess;
+					b.dstAccessMask = barrier.dstAccess;
+					b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					b.buffer = mTransients.buffer(resource.transient);
+					b.offset = 0;
+					b.size = VK_WHOLE_SIZE;
+					batch.buffer(b, barrier.srcStages, barrier.dstStages);
+				}
+				else
+				{
+					VkImage image = resource.imported ? resource.images[std::min<size_t>(variant, resource.images.size() - 1)] : mTransients.image(resource.transient);
+
+					VkImageMemoryBarrier b = {};
+					b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+					b.srcAccessMask = barrier.srcAccess;
+					b.dstAccessMask = barrier.dstAccess;
+					b.oldLayout = barrier.oldLayout;
+					b.newLayout = barrier.newLayout;
+					b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					b.image = image;
+					b.subresourceRange = { resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+					batch.image(b, barrier.srcStages, barrier.dstStages);
+				}
+			}
+			return batch;
+		}
+
+		VkDevice mDevice = VK_NULL_HANDLE;
+		VkExtent2D mExtent = {};
+		std::vector<Resource> mResources;
+		std::vector<Pass> mPasses;
+		std::vector<Barrier> mFinalBarriers;											// into the final usage of the imported resources
+		std::vector<State> mEndStates;													// of every resource, after the last pass
+		TransientAttachments mTransients;
+	};
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+Device memory is finite, and once a heap is full vkAllocateMemory fails (or worse, the driver starts paging
+memory in and out behind the application's back). The residency manager keeps a budget for every memory
+heap and tracks the size of each resource along with the last frame that used it:
+
+	vk::ResidencyManager::ResourceId id = residency.track("textures/chalet.jpg", allocation, true, [&]() { evictTexture(0); });
+	...
+	residency.touch(id, frame);												// every frame that draws with it
+	residency.evictOverBudget();											// once per frame
+
+Streamable resources (textures and meshes that can be dropped and drawn with something cheaper instead)
+are evicted, least recently used first, whenever a heap goes over its budget. Everything else is only
+counted. The budget and usage come from VK_EXT_memory_budget where the device supports it, which accounts
+for other processes and the driver's own allocations as well; otherwise the budget is a fixed fraction of
+the heap and the usage is whatever has been tracked.
+
+The manager can be used from several threads at once. Eviction callbacks run on the thread that evicts,
+without the manager's lock held, so they may call back into it.
+
+*/
+
+namespace vk
+{
+	//! where a resource's memory lives, and how much of it there is
+	struct Allocation
+	{
+		uint32_t heap = 0;
+		VkDeviceSize size = 0;
+	};
+
+	struct HeapBudget
+	{
+		VkDeviceSize size = 0;
+		VkDeviceSize budget = 0;														// what the application should stay below
+		VkDeviceSize usage = 0;															// the reported usage plus what has been tracked since, or only what has been tracked
+		VkDeviceSize tracked = 0;														// the resources the manager knows about
+		bool deviceLocal = false;
+	};
+
+	class ResidencyManager
+	{
+	public:
+		using ResourceId = uint32_t;
+		static const ResourceId sInvalidResource = ~0u;
+
+		//! without VK_EXT_memory_budget, each heap's budget is fraction of its size; budgetCap (if non-zero) limits device local heaps further
+		void init(const VkPhysicalDeviceMemoryProperties& properties, double fraction = 0.8, VkDeviceSize budgetCap = 0)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBudgetCap = budgetCap;
+			mHeaps.resize(properties.memoryHeapCount);
+			for (uint32_t i = 0; i < properties.memoryHeapCount; ++i)
+			{
+				mHeaps[i].size = properties.memoryHeaps[i].size;
+				mHeaps[i].deviceLocal = (properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+				mHeaps[i].budget = capped(i, static_cast<VkDeviceSize>(mHeaps[i].size * fraction));
+			}
+			mReported.assign(mHeaps.size(), Reported());
+		}
+
+		//! replace the estimates with the budget and usage of every heap, as reported by VK_EXT_memory_budget
+		void setReportedBudget(const VkDeviceSize* budget, const VkDeviceSize* usage)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (uint32_t i = 0; i < mHeaps.size(); ++i)
+			{
+				mHeaps[i].budget = capped(i, budget[i]);
+				mReported[i].valid = true;
+				mReported[i].usage = usage[i];
+				mReported[i].tracked = mHeaps[i].tracked;
+				updateUsage(i);
+			}
+		}
+
+		//! start tracking a resource; only streamable ones are ever evicted, by calling evict
+		ResourceId track(const std::string& name, const Allocation& allocation, bool streamable, std::function<void()> evict = {})
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			ResourceId id = mNextId++;
+			Resource& resource = mResources[id];
+			resource.name = name;
+			resource.allocation = allocation;
+			resource.streamable = streamable && evict;
+			resource.evict = std::move(evict);
+
+			mHeaps[allocation.heap].tracked += allocation.size;
+			updateUsage(allocation.heap);
+			return id;
+		}
+
+		//! stop tracking a resource that has been destroyed (or retired)
+		void untrack(ResourceId id)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			auto resource = mResources.find(id);
+			if (resource != mResources.end())
+			{
+				release(resource->second.allocation);
+				mResources.erase(resource);
+			}
+		}
+
+		//! the resource is used by the given frame
+		void touch(ResourceId id, uint64_t frame)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			auto resource = mResources.find(id);
+			if (resource != mResources.end())
+			{
+				resource->second.lastUsed = std::max(resource->second.lastUsed, frame);
+			}
+		}
+
+		//! whether size more bytes fit into the heap's budget
+		bool fits(uint32_t heap, VkDeviceSize size) const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mHeaps[heap].usage + size <= mHeaps[heap].budget;
+		}
+
+		//! evict least recently used streamable resources from the heap until size more bytes fit into its budget, returning whether they do
+		bool makeRoom(uint32_t heap, VkDeviceSize size)
+		{
+			evict([&](const HeapBudget& h, uint32_t i, const Resource&) { return i == heap && h.usage + size > h.budget; });
+			return fits(heap, size);
+		}
+
+		//! evict least recently used streamable resources from the heap until at least bytes have been released, whatever the budget says, returning whether they have
+		bool evictBytes(uint32_t heap, VkDeviceSize bytes)
+		{
+			VkDeviceSize released = 0;
+			evict([&](const HeapBudget&, uint32_t i, const Resource& resource)
+			{
+				if (i != heap || released >= bytes)
+				{
+					return false;
+				}
+				released += resource.allocation.size;
+				return true;
+			});
+			return released >= bytes;
+		}
+
+		//! evict least recently used streamable resources from every heap that is over its budget, returning how many were evicted
+		size_t evictOverBudget()
+		{
+			return evict([](const HeapBudget& h, uint32_t, const Resource&) { return h.usage > h.budget; });
+		}
+
+		std::vector<HeapBudget> heaps() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mHeaps;
+		}
+
+		uint64_t evictions() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mEvictions;
+		}
+
+		void report(std::ostream& out) const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			size_t streamable = std::count_if(mResources.begin(), mResources.end(), [](const std::pair<const ResourceId, Resource>& r) { return r.second.streamable; });
+			out << "Device memory (" << (mReported.empty() || !mReported[0].valid ? "estimated" : "VK_EXT_memory_budget") << " budget), " << mResources.size()
+				<< " resources tracked (" << streamable << " streamable), " << mEvictions << " evicted:" << std::endl;
+
+			const double mib = 1024.0 * 1024.0;
+			out << std::fixed << std::setprecision(1);
+			for (size_t i = 0; i < mHeaps.size(); ++i)
+			{
+				const HeapBudget& heap = mHeaps[i];
+				out << "\theap " << i << (heap.deviceLocal ? " (device local)" : " (host)         ") << ": " << std::setw(8) << heap.usage / mib << " of "
+					<< std::setw(8) << heap.budget / mib << " MiB budget in use, " << std::setw(8) << heap.tracked / mib << " MiB tracked, " << heap.size / mib << " MiB heap" << std::endl;
+			}
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+	private:
+		struct Resource
+		{
+			std::string name;
+			Allocation allocation;
+			bool streamable = false;
+			uint64_t lastUsed = 0;
+			std::function<void()> evict;
+		};
+
+		//! the last usage that VK_EXT_memory_budget reported, and how much was tracked at the time
+		struct Reported
+		{
+			bool valid = false;
+			VkDeviceSize usage = 0;
+			VkDeviceSize tracked = 0;
+		};
+
+		VkDeviceSize capped(uint32_t heap, VkDeviceSize budget) const
+		{
+			return mBudgetCap > 0 && mHeaps[heap].deviceLocal ? std::min(budget, mBudgetCap) : budget;
+		}
+
+		void updateUsage(uint32_t heap)
+		{
+			HeapBudget& h = mHeaps[heap];
+			const Reported& reported = mReported[heap];
+
+			// resources tracked or released since the last report aren't part of the reported usage yet
+			h.usage = reported.valid ? reported.usage + h.tracked - std::min(reported.tracked, reported.usage + h.tracked) : h.tracked;
+		}
+
+		void release(const Allocation& allocation)
+		{
+			mHeaps[allocation.heap].tracked -= std::min(mHeaps[allocation.heap].tracked, allocation.size);
+			updateUsage(allocation.heap);
+		}
+
+		template<typename OverBudget>
+		size_t evict(OverBudget overBudget)
+		{
+			std::vector<std::function<void()>> callbacks;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+
+				// least recently used first, and the largest of those that were last used at the same time
+				std::vector<std::unordered_map<ResourceId, Resource>::iterator> candidates;
+				for (auto resource = mResources.begin(); resource != mResources.end(); ++resource)
+				{
+					if (resource->second.streamable)
+					{
+						candidates.push_back(resource);
+					}
+				}
+				std::sort(candidates.begin(), candidates.end(), [](const std::unordered_map<ResourceId, Resource>::iterator& a, const std::unordered_map<ResourceId, Resource>::iterator& b)
+				{
+					return a->second.lastUsed != b->second.lastUsed ? a->second.lastUsed < b->second.lastUsed : a->second.allocation.size > b->second.allocation.size;
+				});
+
+				for (auto resource : candidates)
+				{
+					uint32_t heap = resource->second.allocation.heap;
+					if (!overBudget(mHeaps[heap], heap, resource->second))
+					{
+						continue;
+					}
+
+					callbacks.push_back(std::move(resource->second.evict));
+					release(resource->second.allocation);
+					mResources.erase(resource);
+					mEvictions++;
+				}
+			}
+
+			for (auto& callback : callbacks)
+			{
+				callback();
+			}
+			return callbacks.size();
+		}
+
+		mutable std::mutex mMutex;
+		std::vector<HeapBudget> mHeaps;
+		std::vector<Reported> mReported;
+		VkDeviceSize mBudgetCap = 0;
+		std::unordered_map<ResourceId, Resource> mResources;
+		ResourceId mNextId = 0;
+		uint64_t mEvictions = 0;
+	};
+}
@@ -1,3 +1,4 @@
 C:/VulkanSDK/1.0.17.0/Bin/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.0.17.0/Bin/glslangValidator.exe -V shader.frag
+C:/VulkanSDK/1.0.17.0/Bin/glslangValidator.exe -V depth.vert -o depth.spv
 pause
@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// the depth prepass: only the positions are read, from a stream of their own (see createPositionBuffer in main.cpp)
+
+// per-frame data, bound with a dynamic offset that selects the current swap chain image's copy
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+  mat4 world;
+  mat4 view;
+  mat4 projection;
+} ubo;
+
+// per-draw data, see DrawConstants in main.cpp
+layout(push_constant) uniform DrawConstants
+{
+  mat4 model;
+} draw;
+
+// the main pass tests against this depth with VK_COMPARE_OP_EQUAL, so both shaders have to compute exactly the same position
+out gl_PerVertex
+{
+  invariant vec4 gl_Position;
+};
+
+layout(location = 0) in vec3 inPosition;
+
+void main()
+{
+  gl_Position = ubo.projection * ubo.view * ubo.world * draw.model * vec4(inPosition, 1.0);
+}
@@ -1,7 +1,31 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 1) uniform sampler2D uTexSampler;
+// every texture of the scene, see chooseTextureSlots in main.cpp for how many slots there are
+layout(constant_id = 0) const uint TEXTURE_SLOTS = 64;
+layout(binding = 1) uniform sampler2D uTextures[TEXTURE_SLOTS];
+
+// pipeline variants, see PipelineVariant in main.cpp
+layout(constant_id = 1) const bool ALPHA_TEST = false;
+layout(constant_id = 2) const bool UNTEXTURED = false;
+
+// the material table, see Material in main.cpp
+struct Material
+{
+  vec4 tint;
+  uint textureIndex;
+};
+
+layout(std430, binding = 2) readonly buffer MaterialTable
+{
+  Material materials[];
+};
+
+// per-draw data, see DrawConstants in main.cpp (the fragment shader only reads the material index)
+layout(push_constant) uniform DrawConstants
+{
+  layout(offset = 64) uint materialIndex;
+} draw;
 
 layout(location = 0) in vec3 vColor;
 layout(location = 1) in vec2 vTexCoord;
@@ -10,5 +34,14 @@ layout(location = 0) out vec4 oColor;
 
 void main()
 {
-  oColor = texture(uTexSampler, vTexCoord);
+  // the material index comes from a push constant, so it's the same for the whole draw (dynamically uniform)
+  Material material = materials[draw.materialIndex];
+  vec4 color = UNTEXTURED ? vec4(vColor, 1.0) : texture(uTextures[material.textureIndex], vTexCoord);
+  oColor = color * material.tint;
+
+  // specialization constants are folded by the driver, so variants without alpha testing don't pay for the branch
+  if (ALPHA_TEST && oColor.a < 0.5)
+  {
+    discard;
+  }
 }
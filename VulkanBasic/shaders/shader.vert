@@ -1,16 +1,25 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// per-frame data, bound with a dynamic offset that selects the current swap chain image's copy
 layout(set = 0, binding = 0) uniform UniformBufferObject
 {
-  mat4 model;
+  mat4 world;
   mat4 view;
   mat4 projection;
 } ubo;
 
+// per-draw data, see DrawConstants in main.cpp
+layout(push_constant) uniform DrawConstants
+{
+  mat4 model;
+  uint materialIndex;
+} draw;
+
+// invariant, since the depth prepass (see depth.vert) has to produce exactly the same depth
 out gl_PerVertex
 {
-  vec4 gl_Position;
+  invariant vec4 gl_Position;
 };
 
 layout(location = 0) out vec3 vColor;
@@ -26,5 +35,5 @@ void main()
 {
   vColor = inColor;
   vTexCoord = inTexCoord;
-  gl_Position = ubo.projection * ubo.view * ubo.model * vec4(inPosition, 1.0);
+  gl_Position = ubo.projection * ubo.view * ubo.world * draw.model * vec4(inPosition, 1.0);
 }
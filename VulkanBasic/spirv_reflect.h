@@ -0,0 +1,550 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+A small SPIR-V reflection module. A SPIR-V binary is a stream of 32-bit words: a five word header followed by
+instructions, each of which starts with a word that holds its length and opcode. Everything the pipeline
+layout has to agree with is declared up front in a module - the types, the variables with their storage
+classes, and the decorations that assign descriptor sets, bindings, locations and offsets - so a single pass
+over the instructions is enough to collect it, without understanding any of the function bodies.
+
+	io::MappedFile vertexCode("shaders/vert.spv");
+	io::MappedFile fragmentCode("shaders/frag.spv");
+	auto vertex = spirv::reflect(vertexCode.data(), vertexCode.size());
+	auto fragment = spirv::reflect(fragmentCode.data(), fragmentCode.size());
+	auto layout = spirv::mergeStages({ vertex, fragment });
+
+Only the subset of SPIR-V that GLSL shaders produce for descriptors, push constants and vertex inputs is
+handled; anything else is skipped.
+
+*/
+
+namespace spirv
+{
+	//! a descriptor that a shader declares: array sizes that come from a specialization constant are reported with its id
+	struct Binding
+	{
+		uint32_t set;
+		uint32_t binding;
+		VkDescriptorType type;
+		uint32_t count;																// 0 for runtime arrays
+		uint32_t countSpecId;														// sNoSpecId if the count is a literal
+		VkShaderStageFlags stages;
+		std::string name;
+
+		static const uint32_t sNoSpecId = ~0u;
+	};
+
+	//! an input variable of a vertex shader
+	struct VertexInput
+	{
+		uint32_t location;
+		VkFormat format;
+		std::string name;
+	};
+
+	//! everything the reflection found in a single shader module
+	struct ShaderReflection
+	{
+		VkShaderStageFlagBits stage;
+		std::vector<Binding> bindings;
+		VkPushConstantRange pushConstants;											// size is 0 if the shader has no push constants
+		std::vector<VertexInput> inputs;											// only for vertex shaders
+	};
+
+	//! the bindings of all stages of a pipeline, grouped by descriptor set, along with a single push constant range covering all stages
+	struct PipelineReflection
+	{
+		std::map<uint32_t, std::vector<Binding>> sets;
+		VkPushConstantRange pushConstants;
+	};
+
+	namespace detail
+	{
+		// the handful of opcodes, decorations and enumerants we need from the SPIR-V specification
+		enum Op : uint32_t
+		{
+			OpName = 5, OpEntryPoint = 15,
+			OpTypeBool = 20, OpTypeInt = 21, OpTypeFloat = 22, OpTypeVector = 23, OpTypeMatrix = 24, OpTypeImage = 25, OpTypeSampler = 26,
+			OpTypeSampledImage = 27, OpTypeArray = 28, OpTypeRuntimeArray = 29, OpTypeStruct = 30, OpTypePointer = 32,
+			OpConstant = 43, OpSpecConstant = 50, OpVariable = 59, OpDecorate = 71, OpMemberDecorate = 72
+		};
+
+		enum Decoration : uint32_t
+		{
+			DecorationSpecId = 1, DecorationBlock = 2, DecorationBufferBlock = 3, DecorationArrayStride = 6, DecorationMatrixStride = 7, DecorationBuiltIn = 11,
+			DecorationLocation = 30, DecorationBinding = 33, DecorationDescriptorSet = 34, DecorationOffset = 35
+		};
+
+		enum StorageClass : uint32_t
+		{
+			UniformConstant = 0, Input = 1, Uniform = 2, PushConstant = 9, StorageBuffer = 12
+		};
+
+		enum ExecutionModel : uint32_t
+		{
+			Vertex = 0, TessellationControl = 1, TessellationEvaluation = 2, Geometry = 3, Fragment = 4, GLCompute = 5
+		};
+
+		enum Dim : uint32_t
+		{
+			DimBuffer = 5, DimSubpassData = 6
+		};
+
+		const uint32_t sMagic = 0x07230203;
+		const uint32_t sNone = ~0u;
+
+		//! what we know about a single result id
+		struct Id
+		{
+			uint32_t opcode = 0;
+			std::vector<uint32_t> operands;											// the instruction's operands, starting with the result id for types
+			std::string name;
+
+			uint32_t set = sNone;
+			uint32_t binding = sNone;
+			uint32_t location = sNone;
+			uint32_t specId = sNone;
+			uint32_t arrayStride = 0;
+			bool block = false;
+			bool bufferBlock = false;
+			bool builtIn = false;
+
+			std::vector<uint32_t> memberOffsets;
+			std::vector<uint32_t> memberMatrixStrides;
+		};
+
+		inline std::string readString(const uint32_t* words, size_t count)
+		{
+			const char* characters = reinterpret_cast<const char*>(words);
+			size_t length = 0;
+			while (length < count * 4 && characters[length] != '\0')
+			{
+				length++;
+			}
+			return std::string(characters, length);
+		}
+
+		class Parser
+		{
+		public:
+			Parser(const uint32_t* words, size_t wordCount)
+			{
+				if (wordCount < 5 || words[0] != sMagic)
+				{
+					throw std::runtime_error("Not a SPIR-V module (wrong magic number).");
+				}
+
+				mIds.resize(words[3]);												// the id bound: all ids are smaller than this
+
+				for (size_t i = 5; i < wordCount;)
+				{
+					uint32_t instructionWords = words[i] >> 16;
+					uint32_t opcode = words[i] & 0xffff;
+
+					if (instructionWords == 0 || i + instructionWords > wordCount)
+					{
+						throw std::runtime_error("Malformed SPIR-V module (truncated instruction).");
+					}
+
+					parseInstruction(opcode, &words[i + 1], instructionWords - 1);
+					i += instructionWords;
+				}
+			}
+
+			ShaderReflection reflect() const
+			{
+				ShaderReflection reflection = {};
+				reflection.stage = mStage;
+
+				uint32_t pushBegin = std::numeric_limits<uint32_t>::max();
+				uint32_t pushEnd = 0;
+
+				for (uint32_t variable : mVariables)
+				{
+					const Id& id = mIds[variable];
+					uint32_t storageClass = id.operands[2];
+					uint32_t pointee = mIds[id.operands[0]].operands[2];
+
+					if (storageClass == UniformConstant || storageClass == Uniform || storageClass == StorageBuffer)
+					{
+						if (id.binding == sNone)
+						{
+							continue;
+						}
+
+						Binding binding = {};
+						binding.set = id.set == sNone ? 0 : id.set;
+						binding.binding = id.binding;
+						binding.count = 1;
+						binding.countSpecId = Binding::sNoSpecId;
+						binding.stages = mStage;
+						binding.name = id.name;
+
+						// arrays of descriptors: the length is a constant or a specialization constant
+						uint32_t element = pointee;
+						if (mIds[element].opcode == OpTypeArray)
+						{
+							const Id& length = mIds[mIds[element].operands[2]];
+							binding.count = length.operands[2];
+							binding.countSpecId = length.opcode == OpSpecConstant ? length.specId : Binding::sNoSpecId;
+							element = mIds[element].operands[1];
+						}
+						else if (mIds[element].opcode == OpTypeRuntimeArray)
+						{
+							binding.count = 0;
+							element = mIds[element].operands[1];
+						}
+
+						binding.type = descriptorType(storageClass, element);
+						reflection.bindings.push_back(binding);
+					}
+					else if (storageClass == PushConstant)
+					{
+						const Id& type = mIds[pointee];
+						for (size_t member = 0; member + 1 < type.operands.size(); ++member)
+						{
+							uint32_t offset = member < type.memberOffsets.size() ? type.memberOffsets[member] : 0;
+							uint32_t stride = member < type.memberMatrixStrides.size() ? type.memberMatrixStrides[member] : 0;
+							pushBegin = std::min(pushBegin, offset);
+							pushEnd = std::max(pushEnd, offset + typeSize(type.operands[member + 1], stride));
+						}
+					}
+					else if (storageClass == Input && mStage == VK_SHADER_STAGE_VERTEX_BIT)
+					{
+						if (id.builtIn || id.location == sNone)
+						{
+							continue;
+						}
+
+						reflection.inputs.push_back({ id.location, vertexFormat(pointee), id.name });
+					}
+				}
+
+				if (pushEnd > 0)
+				{
+					reflection.pushConstants.stageFlags = mStage;
+					reflection.pushConstants.offset = pushBegin;
+					reflection.pushConstants.size = pushEnd - pushBegin;
+				}
+
+				std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const Binding& a, const Binding& b)
+				{
+					return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+				});
+				std::sort(reflection.inputs.begin(), reflection.inputs.end(), [](const VertexInput& a, const VertexInput& b)
+				{
+					return a.location < b.location;
+				});
+
+				return reflection;
+			}
+
+		private:
+			Id& id(uint32_t index)
+			{
+				if (index >= mIds.size())
+				{
+					throw std::runtime_error("Malformed SPIR-V module (id out of bounds).");
+				}
+				return mIds[index];
+			}
+
+			void parseInstruction(uint32_t opcode, const uint32_t* operands, uint32_t count)
+			{
+				switch (opcode)
+				{
+				case OpEntryPoint:
+					if (count >= 2)
+					{
+						mStage = stageFlag(operands[0]);
+					}
+					break;
+
+				case OpName:
+					if (count >= 1)
+					{
+						id(operands[0]).name = readString(operands + 1, count - 1);
+					}
+					break;
+
+				case OpDecorate:
+					if (count >= 2)
+					{
+						decorate(id(operands[0]), operands[1], count > 2 ? operands[2] : 0);
+					}
+					break;
+
+				case OpMemberDecorate:
+					if (count >= 3)
+					{
+						Id& type = id(operands[0]);
+						uint32_t member = operands[1];
+						uint32_t value = count > 3 ? operands[3] : 0;
+
+						if (operands[2] == DecorationOffset)
+						{
+							type.memberOffsets.resize(std::max<size_t>(type.memberOffsets.size(), member + 1), 0);
+							type.memberOffsets[member] = value;
+						}
+						else if (operands[2] == DecorationMatrixStride)
+						{
+							type.memberMatrixStrides.resize(std::max<size_t>(type.memberMatrixStrides.size(), member + 1), 0);
+							type.memberMatrixStrides[member] = value;
+						}
+						else if (operands[2] == DecorationBuiltIn)
+						{
+							type.builtIn = true;
+						}
+					}
+					break;
+
+				case OpTypeBool: case OpTypeInt: case OpTypeFloat: case OpTypeVector: case OpTypeMatrix: case OpTypeImage: case OpTypeSampler:
+				case OpTypeSampledImage: case OpTypeArray: case OpTypeRuntimeArray: case OpTypeStruct: case OpTypePointer:
+					if (count >= 1)
+					{
+						Id& type = id(operands[0]);
+						type.opcode = opcode;
+						type.operands.assign(operands, operands + count);
+					}
+					break;
+
+				case OpConstant: case OpSpecConstant: case OpVariable:
+					if (count >= 3)
+					{
+						Id& result = id(operands[1]);
+						result.opcode = opcode;
+						result.operands.assign(operands, operands + count);
+
+						if (opcode == OpVariable)
+						{
+							mVariables.push_back(operands[1]);
+						}
+					}
+					break;
+				}
+			}
+
+			static void decorate(Id& target, uint32_t decoration, uint32_t value)
+			{
+				switch (decoration)
+				{
+				case DecorationSpecId: target.specId = value; break;
+				case DecorationBlock: target.block = true; break;
+				case DecorationBufferBlock: target.bufferBlock = true; break;
+				case DecorationArrayStride: target.arrayStride = value; break;
+				case DecorationBuiltIn: target.builtIn = true; break;
+				case DecorationLocation: target.location = value; break;
+				case DecorationBinding: target.binding = value; break;
+				case DecorationDescriptorSet: target.set = value; break;
+				}
+			}
+
+			static VkShaderStageFlagBits stageFlag(uint32_t executionModel)
+			{
+				switch (executionModel)
+				{
+				case Vertex: return VK_SHADER_STAGE_VERTEX_BIT;
+				case TessellationControl: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+				case TessellationEvaluation: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+				case Geometry: return VK_SHADER_STAGE_GEOMETRY_BIT;
+				case Fragment: return VK_SHADER_STAGE_FRAGMENT_BIT;
+				case GLCompute: return VK_SHADER_STAGE_COMPUTE_BIT;
+				}
+				throw std::runtime_error("Unsupported SPIR-V execution model.");
+			}
+
+			VkDescriptorType descriptorType(uint32_t storageClass, uint32_t typeId) const
+			{
+				const Id& type = mIds[typeId];
+
+				switch (type.opcode)
+				{
+				case OpTypeSampledImage:
+					return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				case OpTypeSampler:
+					return VK_DESCRIPTOR_TYPE_SAMPLER;
+				case OpTypeImage:
+				{
+					// operands: result, sampled type, dim, depth, arrayed, multisampled, sampled (1 = sampled, 2 = storage)
+					uint32_t dim = type.operands[2];
+					bool storage = type.operands[6] == 2;
+					if (dim == DimBuffer)
+					{
+						return storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+					}
+					if (dim == DimSubpassData)
+					{
+						return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+					}
+					return storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				}
+				case OpTypeStruct:
+					// before SPIR-V 1.3, storage buffers are Uniform blocks decorated with BufferBlock
+					if (storageClass == StorageBuffer || type.bufferBlock)
+					{
+						return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+					}
+					return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				}
+
+				throw std::runtime_error("Unsupported SPIR-V descriptor type.");
+			}
+
+			//! the size in bytes of a type inside a block with explicit layout
+			uint32_t typeSize(uint32_t typeId, uint32_t matrixStride = 0) const
+			{
+				const Id& type = mIds[typeId];
+
+				switch (type.opcode)
+				{
+				case OpTypeBool:
+					return 4;
+				case OpTypeInt:
+				case OpTypeFloat:
+					return type.operands[1] / 8;
+				case OpTypeVector:
+					return type.operands[2] * typeSize(type.operands[1]);
+				case OpTypeMatrix:
+					return type.operands[2] * (matrixStride > 0 ? matrixStride : typeSize(type.operands[1]));
+				case OpTypeArray:
+				{
+					uint32_t length = mIds[type.operands[2]].operands[2];
+					uint32_t stride = type.arrayStride > 0 ? type.arrayStride : typeSize(type.operands[1], matrixStride);
+					return length * stride;
+				}
+				case OpTypeRuntimeArray:
+					return 0;
+				case OpTypeStruct:
+				{
+					uint32_t size = 0;
+					for (size_t member = 0; member + 1 < type.operands.size(); ++member)
+					{
+						uint32_t offset = member < type.memberOffsets.size() ? type.memberOffsets[member] : 0;
+						uint32_t stride = member < type.memberMatrixStrides.size() ? type.memberMatrixStrides[member] : 0;
+						size = std::max(size, offset + typeSize(type.operands[member + 1], stride));
+					}
+					return size;
+				}
+				}
+
+				return 0;
+			}
+
+			//! the format of a 32-bit scalar or vector vertex input
+			VkFormat vertexFormat(uint32_t typeId) const
+			{
+				const Id& type = mIds[typeId];
+				uint32_t components = 1;
+				const Id* component = &type;
+
+				if (type.opcode == OpTypeVector)
+				{
+					components = type.operands[2];
+					component = &mIds[type.operands[1]];
+				}
+
+				if ((component->opcode != OpTypeFloat && component->opcode != OpTypeInt) || component->operands[1] != 32 || components < 1 || components > 4)
+				{
+					return VK_FORMAT_UNDEFINED;
+				}
+
+				static const VkFormat floatFormats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+				static const VkFormat intFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+				static const VkFormat uintFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+				if (component->opcode == OpTypeFloat)
+				{
+					return floatFormats[components - 1];
+				}
+				return component->operands[2] ? intFormats[components - 1] : uintFormats[components - 1];	// the signedness operand of OpTypeInt
+			}
+
+			std::vector<Id> mIds;
+			std::vector<uint32_t> mVariables;
+			VkShaderStageFlagBits mStage = VK_SHADER_STAGE_VERTEX_BIT;
+		};
+	}
+
+	//! reflect a SPIR-V module, given as the raw bytes of a .spv file (i.e. a mapped file, which is parsed in place)
+	inline ShaderReflection reflect(const char* code, size_t size)
+	{
+		if (size % 4 != 0)
+		{
+			throw std::runtime_error("Not a SPIR-V module (size isn't a multiple of four bytes).");
+		}
+
+		// the words can be read in place if they are aligned, which mapped files always are
+		if (reinterpret_cast<uintptr_t>(code) % alignof(uint32_t) == 0)
+		{
+			return detail::Parser(reinterpret_cast<const uint32_t*>(code), size / 4).reflect();
+		}
+
+		std::vector<uint32_t> words(size / 4);
+		std::memcpy(words.data(), code, size);
+		return detail::Parser(words.data(), words.size()).reflect();
+	}
+
+	//! combine the reflection of all stages of a pipeline: the same binding in several stages is merged, and a binding with conflicting types throws
+	inline PipelineReflection mergeStages(const std::vector<ShaderReflection>& stages)
+	{
+		PipelineReflection pipeline = {};
+		uint32_t pushBegin = std::numeric_limits<uint32_t>::max();
+		uint32_t pushEnd = 0;
+
+		for (const auto& stage : stages)
+		{
+			for (const auto& binding : stage.bindings)
+			{
+				auto& bindings = pipeline.sets[binding.set];
+				auto existing = std::find_if(bindings.begin(), bindings.end(), [&](const Binding& b) { return b.binding == binding.binding; });
+
+				if (existing == bindings.end())
+				{
+					bindings.push_back(binding);
+				}
+				else if (existing->type != binding.type || existing->count != binding.count)
+				{
+					throw std::runtime_error("Shader stages disagree on descriptor set " + std::to_string(binding.set) + ", binding " + std::to_string(binding.binding) + ".");
+				}
+				else
+				{
+					existing->stages |= binding.stages;
+				}
+			}
+
+			// vkCmdPushConstants has to update every stage whose range covers a byte, so a single range for all stages is the simplest to push to
+			if (stage.pushConstants.size > 0)
+			{
+				pipeline.pushConstants.stageFlags |= stage.pushConstants.stageFlags;
+				pushBegin = std::min(pushBegin, stage.pushConstants.offset);
+				pushEnd = std::max(pushEnd, stage.pushConstants.offset + stage.pushConstants.size);
+			}
+		}
+
+		if (pushEnd > 0)
+		{
+			pipeline.pushConstants.offset = pushBegin;
+			pipeline.pushConstants.size = pushEnd - pushBegin;
+		}
+
+		for (auto& set : pipeline.sets)
+		{
+			std::sort(set.second.begin(), set.second.end(), [](const Binding& a, const Binding& b) { return a.binding < b.binding; });
+		}
+
+		return pipeline;
+	}
+}
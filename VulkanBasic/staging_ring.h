@@ -0,0 +1,316 @@
+#pragma once
+
+#include "deleter.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+/*
+
+Every upload needs host visible memory to copy its data through, and allocating (and mapping) a fresh
+staging buffer for each one is slow: vkAllocateMemory is meant to be called a handful of times, not per
+upload. The staging ring is a single persistently mapped buffer that all uploads sub-allocate from, one
+after another. Each region is tracked by the fence that its copy is submitted with, and once that fence
+has signaled the space is reused, wrapping around to the start of the buffer when the end is reached:
+
+	vk::StagingRing::Region region = ring.allocate(size, 16);
+	memcpy(region.data, source, size);
+	... record a copy from region.buffer at region.offset, and submit it with region.fence
+	ring.submitted(region);
+
+An allocation waits for the oldest regions to retire when the ring is full, so uploads never allocate
+device memory, no matter how many there are. A single allocation can be at most maxAllocation bytes, which
+leaves room for several threads to upload at the same time; larger uploads are split into several copies
+(and submissions) by the caller.
+
+The ring can be used from any number of threads at once, as long as each thread submits its region before
+allocating the next one (the oldest region has to be submitted before an allocation can wait for it).
+
+*/
+
+namespace vk
+{
+	struct StagingRingStats
+	{
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+		uint64_t wraps = 0;																// the times an allocation started over at the beginning of the buffer
+		uint64_t stalls = 0;															// the times an allocation had to wait for a region to retire
+	};
+
+	class StagingRing
+	{
+	public:
+		//! a part of the ring, reserved until the fence it was submitted with has signaled
+		struct Region
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			char* data = nullptr;														// mapped, host coherent
+			VkFence fence = VK_NULL_HANDLE;												// unsignaled, to submit the commands that read the region with
+			uint64_t id = 0;
+		};
+
+		StagingRing() = default;
+		StagingRing(const StagingRing&) = delete;
+		StagingRing& operator=(const StagingRing&) = delete;
+
+		//! create and map a buffer of capacity bytes in host visible, host coherent memory
+		void init(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize capacity)
+		{
+			mDevice = device;
+			mCapacity = capacity;
+
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = capacity;
+			bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			if (vkCreateBuffer(device, &bufferInfo, allocationCallbacks(), mBuffer.replace(device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create staging ring buffer.");
+			}
+
+			VkMemoryRequirements requirements;
+			vkGetBufferMemoryRequirements(device, mBuffer, &requirements);
+
+			VkPhysicalDeviceMemoryProperties memoryProperties;
+			vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+			const VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			uint32_t memoryType = memoryProperties.memoryTypeCount;
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+			{
+				if ((requirements.memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+				{
+					memoryType = i;
+					break;
+				}
+			}
+
+			if (memoryType == memoryProperties.memoryTypeCount)
+			{
+				throw std::runtime_error("Failed to find a host visible memory type for the staging ring.");
+			}
+
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = requirements.size;
+			allocInfo.memoryTypeIndex = memoryType;
+
+			if (vkAllocateMemory(device, &allocInfo, allocationCallbacks(), mMemory.replace(device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate staging ring memory.");
+			}
+
+			vkBindBufferMemory(device, mBuffer, mMemory, 0);
+			mMemoryType = memoryType;
+			mMemorySize = requirements.size;
+
+			// the memory stays mapped until it is freed
+			void* data;
+			vkMapMemory(device, mMemory, 0, VK_WHOLE_SIZE, 0, &data);
+			mData = static_cast<char*>(data);
+		}
+
+		VkDeviceSize capacity() const { return mCapacity; }
+
+		//! the memory type and size of the ring's allocation
+		uint32_t memoryType() const { return mMemoryType; }
+		VkDeviceSize memorySize() const { return mMemorySize; }
+
+		//! the largest allocation: a quarter of the ring, so that uploads from several threads fit at once
+		VkDeviceSize maxAllocation() const { return mCapacity / 4; }
+
+		//! reserve size bytes at a multiple of alignment, waiting for earlier regions to retire if the ring is full
+		Region allocate(VkDeviceSize size, VkDeviceSize alignment = 16)
+		{
+			if (size > maxAllocation())
+			{
+				throw std::runtime_error("Staging ring allocations can't be larger than a quarter of the ring.");
+			}
+
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			VkDeviceSize offset;
+			bool stalled = false;
+			while (!fit(size, alignment, offset))
+			{
+				stalled = true;
+
+				// the oldest region is in the way: wait until its commands have been submitted, then until they have executed
+				mSubmitted.wait(lock, [this]() { return mRegions.empty() || mRegions.front().submitted; });
+				if (mRegions.empty())
+				{
+					continue;
+				}
+				VkFence fence = mRegions.front().fence;
+				vkWaitForFences(mDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+				retire();
+			}
+
+			if (stalled)
+			{
+				mStats.stalls++;
+			}
+			mStats.allocations++;
+			mStats.bytes += size;
+
+			Slot slot;
+			slot.begin = offset;
+			slot.end = offset + size;
+			slot.id = ++mNextId;
+			slot.fence = acquireFence();
+			mRegions.push_back(slot);
+
+			Region region;
+			region.buffer = mBuffer;
+			region.offset = offset;
+			region.size = size;
+			region.data = mData + offset;
+			region.fence = slot.fence;
+			region.id = slot.id;
+			return region;
+		}
+
+		//! the commands that read the region have been submitted with its fence (or waited for, or never will be): it is reused once the fence has signaled
+		void submitted(const Region& region)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				auto slot = std::find_if(mRegions.begin(), mRegions.end(), [&](const Slot& s) { return s.id == region.id; });
+				if (slot != mRegions.end())
+				{
+					slot->submitted = true;
+				}
+			}
+			mSubmitted.notify_all();
+		}
+
+		StagingRingStats stats() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mStats;
+		}
+
+		void report(std::ostream& out) const
+		{
+			StagingRingStats s = stats();
+			out << "Staging ring (" << mCapacity / (1024 * 1024) << " MiB): " << s.allocations << " allocations, " << s.bytes / (1024 * 1024)
+				<< " MiB uploaded, " << s.wraps << " wraps, " << s.stalls << " stalls." << std::endl;
+		}
+
+		//! the device must be idle by the time the ring is destroyed
+		~StagingRing()
+		{
+			for (VkFence fence : mFences)
+			{
+				vkDestroyFence(mDevice, fence, allocationCallbacks());
+			}
+		}
+
+	private:
+		struct Slot
+		{
+			VkDeviceSize begin;
+			VkDeviceSize end;
+			uint64_t id;
+			VkFence fence;
+			bool submitted = false;
+		};
+
+		//! find room for an allocation after the newest region, retiring regions whose fences have signaled first
+		bool fit(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+		{
+			retire();
+
+			if (mRegions.empty())
+			{
+				offset = 0;
+				return size <= mCapacity;
+			}
+
+			VkDeviceSize tail = mRegions.front().begin;											// the oldest live byte
+			VkDeviceSize head = mRegions.back().end;											// one past the newest live byte
+			VkDeviceSize aligned = (head + alignment - 1) / alignment * alignment;
+
+			if (head > tail)
+			{
+				// the live regions are contiguous: allocate after them, or wrap around to the start
+				if (aligned + size <= mCapacity)
+				{
+					offset = aligned;
+					return true;
+				}
+				if (size <= tail)
+				{
+					offset = 0;
+					mStats.wraps++;
+					return true;
+				}
+				return false;
+			}
+
+			// the live regions have wrapped, so the free space is between the newest and the oldest
+			offset = aligned;
+			return aligned + size <= tail;
+		}
+
+		//! release regions from the front, in order, as long as their fences have signaled
+		void retire()
+		{
+			while (!mRegions.empty() && mRegions.front().submitted && vkGetFenceStatus(mDevice, mRegions.front().fence) == VK_SUCCESS)
+			{
+				VkFence fence = mRegions.front().fence;
+				vkResetFences(mDevice, 1, &fence);
+				mFreeFences.push_back(fence);
+				mRegions.pop_front();
+			}
+		}
+
+		VkFence acquireFence()
+		{
+			if (!mFreeFences.empty())
+			{
+				VkFence fence = mFreeFences.back();
+				mFreeFences.pop_back();
+				return fence;
+			}
+
+			VkFenceCreateInfo fenceInfo = {};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+			VkFence fence;
+			if (vkCreateFence(mDevice, &fenceInfo, allocationCallbacks(), &fence) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create staging ring fence.");
+			}
+			mFences.push_back(fence);
+			return fence;
+		}
+
+		VkDevice mDevice = VK_NULL_HANDLE;
+		Buffer mBuffer;
+		DeviceMemory mMemory;
+		char* mData = nullptr;
+		VkDeviceSize mCapacity = 0;
+		uint32_t mMemoryType = 0;
+		VkDeviceSize mMemorySize = 0;
+
+		mutable std::mutex mMutex;
+		std::condition_variable mSubmitted;
+		std::deque<Slot> mRegions;																// oldest first
+		std::vector<VkFence> mFences;															// every fence the ring has created
+		std::vector<VkFence> mFreeFences;
+		uint64_t mNextId = 0;
+		StagingRingStats mStats;
+	};
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "job_system.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+
+A graph of named stages that runs on the job system. Each stage lists the stages it depends on and is
+started as soon as the last of them has finished, so independent stages run in parallel without anyone
+having to decide on an order by hand. Every stage is timed, and after a run the graph can report its
+critical path: the chain of dependent stages whose durations add up to the longest total. No amount of
+extra threads makes the whole graph finish sooner than that chain, so it's the part worth optimizing.
+A stage that waits on the job system runs other jobs in the meantime, often other stages; that time is
+left out of its duration, so that it isn't counted twice.
+
+	jobs::TaskGraph graph;
+	auto a = graph.add("a", []() { ... });
+	auto b = graph.add("b", []() { ... });
+	graph.add("c", []() { ... }, { a, b });
+	graph.run(jobSystem);
+	graph.report(std::cout);
+
+*/
+
+namespace jobs
+{
+	class TaskGraph
+	{
+	public:
+		using StageId = size_t;
+
+		//! dependencies must have been added before the stage that depends on them, which also rules out cycles
+		StageId add(const std::string& name, std::function<void()> function, const std::vector<StageId>& dependencies = {})
+		{
+			StageId id = mStages.size();
+
+			for (StageId dependency : dependencies)
+			{
+				if (dependency >= id)
+				{
+					throw std::logic_error("Task graph stage " + name + " depends on a stage that was added after it.");
+				}
+				mStages[dependency]->successors.push_back(id);
+			}
+
+			mStages.emplace_back(new Stage());
+			mStages.back()->name = name;
+			mStages.back()->function = std::move(function);
+			mStages.back()->dependencies = dependencies;
+
+			return id;
+		}
+
+		//! run every stage and wait for all of them; if a stage throws, the stages that haven't started yet are skipped and the exception is rethrown here
+		void run(JobSystem& jobSystem)
+		{
+			mTimeline.reset();
+			mError = nullptr;
+			mFailed = false;
+
+			for (auto& stage : mStages)
+			{
+				stage->remainingDependencies.store(static_cast<uint32_t>(stage->dependencies.size()), std::memory_order_relaxed);
+				stage->durationMs = 0.0;
+			}
+
+			Counter counter;
+			for (StageId id = 0; id < mStages.size(); ++id)
+			{
+				if (mStages[id]->dependencies.empty())
+				{
+					schedule(jobSystem, counter, id);
+				}
+			}
+
+			auto start = profiler::Clock::now();
+			jobSystem.wait(counter);
+			mWallMs = std::chrono::duration<double, std::milli>(profiler::Clock::now() - start).count();
+
+			if (mError)
+			{
+				std::rethrow_exception(mError);
+			}
+		}
+
+		//! the longest chain of dependent stages from the last run, from first to last
+		std::vector<StageId> criticalPath() const
+		{
+			// stages are stored in a topological order, so a single pass finds the longest path ending at each one
+			const StageId noStage = ~StageId(0);
+			std::vector<double> finish(mStages.size(), 0.0);
+			std::vector<StageId> previous(mStages.size(), noStage);
+
+			StageId last = noStage;
+			for (StageId id = 0; id < mStages.size(); ++id)
+			{
+				for (StageId dependency : mStages[id]->dependencies)
+				{
+					if (finish[dependency] > finish[id])
+					{
+						finish[id] = finish[dependency];
+						previous[id] = dependency;
+					}
+				}
+				finish[id] += mStages[id]->durationMs;
+
+				if (last == noStage || finish[id] > finish[last])
+				{
+					last = id;
+				}
+			}
+
+			std::vector<StageId> path;
+			for (StageId id = last; id != noStage; id = previous[id])
+			{
+				path.insert(path.begin(), id);
+			}
+			return path;
+		}
+
+		//! print the timeline of the last run followed by its critical path
+		void report(std::ostream& out) const
+		{
+			mTimeline.report(out);
+
+			std::vector<StageId> path = criticalPath();
+			double pathMs = 0.0;
+			for (StageId id : path)
+			{
+				pathMs += mStages[id]->durationMs;
+			}
+
+			out << std::fixed << std::setprecision(2);
+			out << "\tCritical path: " << pathMs << " ms of " << mWallMs << " ms total" << std::endl;
+			for (StageId id : path)
+			{
+				out << "\t\t" << mStages[id]->name << " (" << mStages[id]->durationMs << " ms)" << std::endl;
+			}
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+		const profiler::Timeline& timeline() const
+		{
+			return mTimeline;
+		}
+
+	private:
+		struct Stage
+		{
+			std::string name;
+			std::function<void()> function;
+			std::vector<StageId> dependencies;
+			std::vector<StageId> successors;
+			std::atomic<uint32_t> remainingDependencies{ 0 };
+			double durationMs = 0.0;
+		};
+
+		void schedule(JobSystem& jobSystem, Counter& counter, StageId id)
+		{
+			jobSystem.run([this, &jobSystem, &counter, id]()
+			{
+				execute(id);
+
+				// successors are queued before this job counts as finished, so the counter can't reach zero early
+				for (StageId successor : mStages[id]->successors)
+				{
+					if (mStages[successor]->remainingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					{
+						schedule(jobSystem, counter, successor);
+					}
+				}
+			}, &counter);
+		}
+
+		void execute(StageId id)
+		{
+			Stage& stage = *mStages[id];
+
+			// once a stage has failed, the rest of the graph only runs to completion so that the counter drains
+			if (mFailed.load(std::memory_order_acquire))
+			{
+				return;
+			}
+
+			auto start = profiler::Clock::now();
+			double waited = JobSystem::waitedJobMs();
+			try
+			{
+				stage.function();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(mErrorMutex);
+				if (!mError)
+				{
+					mError = std::current_exception();
+				}
+				mFailed.store(true, std::memory_order_release);
+			}
+			auto end = profiler::Clock::now();
+
+			// a stage that waits on a counter runs other jobs (often other stages) in the meantime, which isn't time spent on the stage itself
+			double nestedMs = JobSystem::waitedJobMs() - waited;
+			stage.durationMs = std::max(0.0, std::chrono::duration<double, std::milli>(end - start).count() - nestedMs);
+			mTimeline.record(stage.name, JobSystem::currentThreadIndex(), start, end);
+		}
+
+		std::vector<std::unique_ptr<Stage>> mStages;
+		profiler::Timeline mTimeline;
+		double mWallMs = 0.0;
+
+		std::atomic<bool> mFailed{ false };
+		std::mutex mErrorMutex;
+		std::exception_ptr mError;
+	};
+}
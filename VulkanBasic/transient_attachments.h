@@ -0,0 +1,423 @@
+#pragma once
+
+#include "deletion_queue.h"
+#include "residency_manager.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+
+Some attachments only live for the duration of a render pass: the depth buffer is cleared when the pass
+begins and its contents are dropped when it ends (VK_ATTACHMENT_STORE_OP_DONT_CARE). Such attachments
+never have to be written back to memory, and on tiled GPUs they never leave on-chip memory at all, so
+the ones marked lazy are created with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT and backed by lazily
+allocated memory where the device has it: the driver only commits physical memory for them if it really
+needs to. Attachments whose contents are stored by one render pass and loaded by another (or that have
+usages other than attachment ones) aren't lazy, and get plain device local memory instead.
+
+Attachments are described along with the passes that use them, first to last:
+
+	uint32_t depth = attachments.add({ "depth", format, extent, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, true });
+	attachments.build(device, physicalDevice);
+	... attachments.view(depth)
+
+build creates every image and then packs them into as few allocations as possible: attachments whose
+pass ranges don't overlap alias the same memory, since the contents of one are dead by the time the next
+is used (which is why every transient attachment has to start out in VK_IMAGE_LAYOUT_UNDEFINED). When the
+attachments have to be recreated, i.e. when the swap chain is resized, the old ones are retired to a
+deletion queue and build starts over.
+
+Buffers that only live for a part of the frame (addBuffer) are aliased the same way, but only with other
+buffers, and always in plain device local memory: lazily allocated memory can only back attachments.
+
+*/
+
+namespace vk
+{
+	struct TransientAttachmentInfo
+	{
+		std::string name;
+		VkFormat format;
+		VkExtent2D extent;
+		VkImageUsageFlags usage;														// VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT is added to lazy attachments with attachment usages only
+		VkImageAspectFlags aspect;
+		uint32_t firstPass;																// the contents are live from the first pass that uses the attachment...
+		uint32_t lastPass;																// ...up to and including the last one
+		bool lazy;																		// the contents never leave a render pass: never loaded, and never stored
+	};
+
+	struct TransientBufferInfo
+	{
+		std::string name;
+		VkDeviceSize size;
+		VkBufferUsageFlags usage;
+		uint32_t firstPass;
+		uint32_t lastPass;
+	};
+
+	struct TransientAttachmentStats
+	{
+		uint32_t attachments = 0;
+		uint32_t allocations = 0;
+		VkDeviceSize dedicatedBytes = 0;												// what a dedicated allocation per attachment would take
+		VkDeviceSize allocatedBytes = 0;												// what the aliased allocations take
+		VkDeviceSize committedBytes = 0;												// what the driver has actually committed: less than allocated with lazy memory
+		bool lazilyAllocated = false;
+	};
+
+	class TransientAttachments
+	{
+	public:
+		TransientAttachments() = default;
+		TransientAttachments(const TransientAttachments&) = delete;
+		TransientAttachments& operator=(const TransientAttachments&) = delete;
+
+		//! describe an attachment that build will create, returning its index
+		uint32_t add(const TransientAttachmentInfo& info)
+		{
+			if (info.firstPass > info.lastPass)
+			{
+				throw std::invalid_argument("A transient attachment's first pass can't come after its last.");
+			}
+
+			Attachment attachment;
+			attachment.info = info;
+			mAttachments.push_back(std::move(attachment));
+			return static_cast<uint32_t>(mAttachments.size() - 1);
+		}
+
+		//! describe a buffer that build will create, returning its index (which shares the numbering with attachments)
+		uint32_t addBuffer(const TransientBufferInfo& info)
+		{
+			if (info.firstPass > info.lastPass)
+			{
+				throw std::invalid_argument("A transient buffer's first pass can't come after its last.");
+			}
+
+			Attachment attachment;
+			attachment.info.name = info.name;
+			attachment.info.firstPass = info.firstPass;
+			attachment.info.lastPass = info.lastPass;
+			attachment.info.lazy = false;
+			attachment.isBuffer = true;
+			attachment.bufferSize = info.size;
+			attachment.bufferUsage = info.usage;
+			mAttachments.push_back(std::move(attachment));
+			return static_cast<uint32_t>(mAttachments.size() - 1);
+		}
+
+		//! create the images and views of every attachment that has been added, along with the memory they alias
+		void build(VkDevice device, VkPhysicalDevice physicalDevice)
+		{
+			mDevice = device;
+
+			VkPhysicalDeviceMemoryProperties memoryProperties;
+			vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+			for (Attachment& attachment : mAttachments)
+			{
+				if (attachment.isBuffer)
+				{
+					createBuffer(attachment);
+				}
+				else
+				{
+					createImage(attachment);
+				}
+			}
+
+			// the largest attachments go first, so the smaller ones fit into their slots
+			std::vector<uint32_t> order(mAttachments.size());
+			for (uint32_t i = 0; i < order.size(); ++i)
+			{
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return mAttachments[a].requirements.size > mAttachments[b].requirements.size; });
+
+			for (uint32_t index : order)
+			{
+				assignSlot(index);
+			}
+
+			for (Slot& slot : mSlots)
+			{
+				allocateSlot(slot, memoryProperties);
+			}
+
+			for (Attachment& attachment : mAttachments)
+			{
+				if (attachment.isBuffer)
+				{
+					vkBindBufferMemory(device, attachment.buffer, mSlots[attachment.slot].memory, 0);
+				}
+				else
+				{
+					vkBindImageMemory(device, attachment.image, mSlots[attachment.slot].memory, 0);
+					createView(attachment);
+				}
+			}
+		}
+
+		VkImage image(uint32_t index) const { return mAttachments[index].image; }
+		VkImageView view(uint32_t index) const { return mAttachments[index].view; }
+		VkBuffer buffer(uint32_t index) const { return mAttachments[index].buffer; }
+
+		//! the allocation an attachment or buffer was placed in: the ones that share it alias each other's memory
+		uint32_t slot(uint32_t index) const { return mAttachments[index].slot; }
+
+		//! where each allocation lives, for the residency manager
+		std::vector<Allocation> allocations() const
+		{
+			std::vector<Allocation> result;
+			for (const Slot& slot : mSlots)
+			{
+				result.push_back(slot.allocation);
+			}
+			return result;
+		}
+
+		//! hand every image, view and allocation to the deletion queue, and forget the attachments so that they can be added again
+		void retire(DeletionQueue& queue, uint64_t frame)
+		{
+			for (Attachment& attachment : mAttachments)
+			{
+				queue.retire(std::move(attachment.view), frame);
+				queue.retire(std::move(attachment.image), frame);
+				queue.retire(std::move(attachment.buffer), frame);
+			}
+			for (Slot& slot : mSlots)
+			{
+				queue.retire(std::move(slot.memory), frame);
+			}
+			mAttachments.clear();
+			mSlots.clear();
+		}
+
+		TransientAttachmentStats stats() const
+		{
+			TransientAttachmentStats s;
+			s.attachments = static_cast<uint32_t>(mAttachments.size());
+			s.allocations = static_cast<uint32_t>(mSlots.size());
+			for (const Attachment& attachment : mAttachments)
+			{
+				s.dedicatedBytes += attachment.requirements.size;
+			}
+			for (const Slot& slot : mSlots)
+			{
+				s.allocatedBytes += slot.allocation.size;
+				if (slot.lazy)
+				{
+					// only meaningful for lazily allocated memory, which starts out with nothing committed
+					VkDeviceSize committed = 0;
+					vkGetDeviceMemoryCommitment(mDevice, slot.memory, &committed);
+					s.committedBytes += committed;
+					s.lazilyAllocated = true;
+				}
+				else
+				{
+					s.committedBytes += slot.allocation.size;
+				}
+			}
+			return s;
+		}
+
+		void report(std::ostream& out) const
+		{
+			TransientAttachmentStats s = stats();
+			const double kib = 1024.0;
+			out << "Transient attachments: " << s.attachments << " in " << s.allocations << (s.lazilyAllocated ? " lazily allocated" : " device local")
+				<< " allocations, " << s.dedicatedBytes / kib << " KiB with dedicated memory, " << s.allocatedBytes / kib << " KiB aliased, "
+				<< s.committedBytes / kib << " KiB committed." << std::endl;
+			for (const Attachment& attachment : mAttachments)
+			{
+				out << "\t" << attachment.info.name << ": ";
+				if (attachment.isBuffer)
+				{
+					out << "buffer";
+				}
+				else
+				{
+					out << attachment.info.extent.width << " x " << attachment.info.extent.height;
+				}
+				out << ", passes " << attachment.info.firstPass << " to " << attachment.info.lastPass << ", " << attachment.requirements.size / kib << " KiB in allocation " << attachment.slot << std::endl;
+			}
+		}
+
+	private:
+		struct Attachment
+		{
+			TransientAttachmentInfo info;
+			Image image;
+			ImageView view;
+			bool isBuffer = false;
+			Buffer buffer;
+			VkDeviceSize bufferSize = 0;
+			VkBufferUsageFlags bufferUsage = 0;
+			VkMemoryRequirements requirements = {};
+			uint32_t slot = 0;
+		};
+
+		//! a single allocation, shared by attachments whose pass ranges don't overlap
+		struct Slot
+		{
+			std::vector<uint32_t> attachments;
+			bool buffers = false;														// buffers and images never share a slot
+			VkMemoryRequirements requirements = {};										// the largest size, and the memory types that suit every attachment
+			DeviceMemory memory;
+			Allocation allocation;
+			bool lazy = false;
+		};
+
+		void createImage(Attachment& attachment)
+		{
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.extent.width = attachment.info.extent.width;
+			imageInfo.extent.height = attachment.info.extent.height;
+			imageInfo.extent.depth = 1;
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.format = attachment.info.format;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageInfo.usage = attachment.info.usage;
+			if (attachment.info.lazy && transientUsage(attachment.info.usage))
+			{
+				imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			}
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+			if (vkCreateImage(mDevice, &imageInfo, allocationCallbacks(), attachment.image.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create transient attachment " + attachment.info.name + ".");
+			}
+
+			vkGetImageMemoryRequirements(mDevice, attachment.image, &attachment.requirements);
+		}
+
+		void createBuffer(Attachment& attachment)
+		{
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = attachment.bufferSize;
+			bufferInfo.usage = attachment.bufferUsage;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			if (vkCreateBuffer(mDevice, &bufferInfo, allocationCallbacks(), attachment.buffer.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create transient buffer " + attachment.info.name + ".");
+			}
+
+			vkGetBufferMemoryRequirements(mDevice, attachment.buffer, &attachment.requirements);
+		}
+
+		void createView(Attachment& attachment)
+		{
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = attachment.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = attachment.info.format;
+			viewInfo.subresourceRange.aspectMask = attachment.info.aspect;
+			viewInfo.subresourceRange.baseMipLevel = 0;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.baseArrayLayer = 0;
+			viewInfo.subresourceRange.layerCount = 1;
+
+			if (vkCreateImageView(mDevice, &viewInfo, allocationCallbacks(), attachment.view.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create transient attachment view " + attachment.info.name + ".");
+			}
+		}
+
+		//! VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT is only valid along with attachment usages: images that are also sampled, stored or copied get plain device local memory
+		static bool transientUsage(VkImageUsageFlags usage)
+		{
+			const VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+			return usage != 0 && (usage & ~attachmentUsage) == 0;
+		}
+
+		bool overlaps(const TransientAttachmentInfo& a, const TransientAttachmentInfo& b) const
+		{
+			return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+		}
+
+		//! put an attachment into the first slot that none of its passes overlap with (and whose memory types suit it), or into a new one
+		void assignSlot(uint32_t index)
+		{
+			Attachment& attachment = mAttachments[index];
+			for (uint32_t s = 0; s < mSlots.size(); ++s)
+			{
+				Slot& slot = mSlots[s];
+				bool free = slot.buffers == attachment.isBuffer && std::none_of(slot.attachments.begin(), slot.attachments.end(), [&](uint32_t other) { return overlaps(attachment.info, mAttachments[other].info); });
+				uint32_t memoryTypeBits = slot.requirements.memoryTypeBits & attachment.requirements.memoryTypeBits;
+				if (free && memoryTypeBits != 0)
+				{
+					slot.attachments.push_back(index);
+					slot.requirements.size = std::max(slot.requirements.size, attachment.requirements.size);
+					slot.requirements.memoryTypeBits = memoryTypeBits;
+					attachment.slot = s;
+					return;
+				}
+			}
+
+			Slot slot;
+			slot.attachments.push_back(index);
+			slot.buffers = attachment.isBuffer;
+			slot.requirements = attachment.requirements;
+			attachment.slot = static_cast<uint32_t>(mSlots.size());
+			mSlots.push_back(std::move(slot));
+		}
+
+		//! allocate a slot's memory, preferring lazily allocated memory over plain device local memory
+		void allocateSlot(Slot& slot, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+		{
+			uint32_t memoryType = memoryProperties.memoryTypeCount;
+			const VkMemoryPropertyFlags preferences[] = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT };
+			for (VkMemoryPropertyFlags properties : preferences)
+			{
+				if (slot.buffers && (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+				{
+					continue;
+				}
+				for (uint32_t i = 0; i < memoryProperties.memoryTypeCount && memoryType == memoryProperties.memoryTypeCount; ++i)
+				{
+					if ((slot.requirements.memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+					{
+						memoryType = i;
+					}
+				}
+			}
+
+			if (memoryType == memoryProperties.memoryTypeCount)
+			{
+				throw std::runtime_error("Failed to find a device local memory type for transient attachments.");
+			}
+
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = slot.requirements.size;
+			allocInfo.memoryTypeIndex = memoryType;
+
+			if (vkAllocateMemory(mDevice, &allocInfo, allocationCallbacks(), slot.memory.replace(mDevice)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate transient attachment memory.");
+			}
+
+			slot.lazy = (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+			slot.allocation.heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+			slot.allocation.size = slot.requirements.size;
+		}
+
+		VkDevice mDevice = VK_NULL_HANDLE;
+		std::vector<Attachment> mAttachments;
+		std::vector<Slot> mSlots;
+	};
+}